@@ -40,6 +40,9 @@
  */
 struct brd_device {
   int   brd_number;
+  // Device this one is a snapshot of, which may itself be a snapshot. Pages
+  // this device doesn't have are read from the closest device up the chain
+  // that does.
   struct brd_device *parent_brd;
 
   // Denotes whether or not a cow_ram is writable and snapshots are active.
@@ -58,6 +61,16 @@ struct brd_device {
   struct radix_tree_root  brd_pages;
 };
 
+/*
+ * Snapshot pages written since the snapshot was last restored are tagged dirty
+ * in brd_pages. Restoring a snapshot whose ancestors are all read-only copies
+ * their contents back into just the dirty pages and keeps them, so the next
+ * crash state written to the snapshot doesn't need to allocate them again.
+ * Untagged snapshot pages always match the ancestors, and are dropped whenever
+ * an ancestor can change.
+ */
+#define BRD_TAG_DIRTY 0
+
 /*
  * Look up and return a brd's page for a given sector.
  */
@@ -89,7 +102,42 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 }
 
 /*
- * Look up and return a brd's page for a given sector.
+ * Look up the page brd shows for a sector it has no page of its own for, from
+ * the closest device up its snapshot chain that has one.
+ */
+static struct page *brd_lookup_parent_page(struct brd_device *brd,
+    sector_t sector)
+{
+  struct brd_device *cur;
+  struct page *page;
+
+  for (cur = brd->parent_brd; cur; cur = cur->parent_brd) {
+    page = brd_lookup_page(cur, sector);
+    if (page)
+      return page;
+  }
+  return NULL;
+}
+
+static void brd_mark_dirty(struct brd_device *brd, pgoff_t idx)
+{
+  int dirty;
+
+  if (!brd->is_snapshot)
+    return;
+  rcu_read_lock();
+  dirty = radix_tree_tag_get(&brd->brd_pages, idx, BRD_TAG_DIRTY);
+  rcu_read_unlock();
+  if (dirty)
+    return;
+
+  spin_lock(&brd->brd_lock);
+  radix_tree_tag_set(&brd->brd_pages, idx, BRD_TAG_DIRTY);
+  spin_unlock(&brd->brd_lock);
+}
+
+/*
+ * Look up and return a brd's page for a given sector so it can be written.
  * If one does not exist, allocate an empty page, and insert that. Then
  * return it.
  */
@@ -102,8 +150,10 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
   struct page *parent_page = NULL;
 
   page = brd_lookup_page(brd, sector);
-  if (page)
+  if (page) {
+    brd_mark_dirty(brd, page->index);
     return page;
+  }
 
   /*
    * Must use NOIO because we don't want to recurse back into the
@@ -143,7 +193,7 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
   // Copy over the data in the parent's page to the snapshot page if the parent
   // has a page in this sector address.
   if (brd->parent_brd) {
-    parent_page = brd_lookup_page(brd->parent_brd, sector);
+    parent_page = brd_lookup_parent_page(brd, sector);
     // This page may not have originally existed in the parent.
     if (parent_page) {
       // Map both the parent and snapshot pages so that the kernel can access
@@ -157,6 +207,7 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
       kunmap_atomic(dst);
     }
   }
+  brd_mark_dirty(brd, idx);
 
   return page;
 }
@@ -179,8 +230,10 @@ static void brd_zero_page(struct brd_device *brd, sector_t sector)
   struct page *page;
 
   page = brd_lookup_page(brd, sector);
-  if (page)
+  if (page) {
     clear_highpage(page);
+    brd_mark_dirty(brd, page->index);
+  }
 }
 
 /*
@@ -220,6 +273,105 @@ static void brd_free_pages(struct brd_device *brd)
   } while (nr_pages == FREE_BATCH);
 }
 
+/*
+ * Give every dirty page of a snapshot brd its ancestors' contents again and
+ * clear its tag. The ancestors must be read-only, and, like brd_free_pages,
+ * this must only be called when there are no other users of the device.
+ */
+static void brd_restore_dirty_pages(struct brd_device *brd)
+{
+  unsigned long pos = 0;
+  struct page *pages[FREE_BATCH];
+  struct page *parent_page;
+  int nr_pages;
+
+  do {
+    int i;
+
+    rcu_read_lock();
+    nr_pages = radix_tree_gang_lookup_tag(&brd->brd_pages, (void **)pages,
+        pos, FREE_BATCH, BRD_TAG_DIRTY);
+    rcu_read_unlock();
+
+    for (i = 0; i < nr_pages; i++) {
+      pos = pages[i]->index;
+      parent_page = brd_lookup_parent_page(brd,
+          (sector_t) pos << PAGE_SECTORS_SHIFT);
+      if (parent_page)
+        copy_highpage(pages[i], parent_page);
+      else
+        clear_highpage(pages[i]);
+
+      spin_lock(&brd->brd_lock);
+      radix_tree_tag_clear(&brd->brd_pages, pos, BRD_TAG_DIRTY);
+      spin_unlock(&brd->brd_lock);
+    }
+
+    pos++;
+  } while (nr_pages == FREE_BATCH);
+}
+
+/*
+ * Free the pages of a snapshot brd that weren't written since it was last
+ * restored. Must only be called when there are no other users of the device.
+ */
+static void brd_free_clean_pages(struct brd_device *brd)
+{
+  unsigned long pos = 0;
+  struct page *pages[FREE_BATCH];
+  int nr_pages;
+
+  do {
+    int i;
+
+    rcu_read_lock();
+    nr_pages = radix_tree_gang_lookup(&brd->brd_pages, (void **)pages, pos,
+        FREE_BATCH);
+    rcu_read_unlock();
+
+    for (i = 0; i < nr_pages; i++) {
+      pos = pages[i]->index;
+      spin_lock(&brd->brd_lock);
+      if (radix_tree_tag_get(&brd->brd_pages, pos, BRD_TAG_DIRTY)) {
+        spin_unlock(&brd->brd_lock);
+        continue;
+      }
+      radix_tree_delete(&brd->brd_pages, pos);
+      spin_unlock(&brd->brd_lock);
+      __free_page(pages[i]);
+    }
+
+    pos++;
+  } while (nr_pages == FREE_BATCH);
+}
+
+static bool brd_ancestors_read_only(struct brd_device *brd)
+{
+  struct brd_device *cur;
+
+  for (cur = brd->parent_brd; cur; cur = cur->parent_brd) {
+    if (cur->is_writable)
+      return false;
+  }
+  return true;
+}
+
+static void brd_free_children_clean_pages(struct brd_device *brd);
+
+/*
+ * Reset a snapshot brd to the contents of its parent. Pages are kept when all
+ * of its ancestors are read-only, since nothing can make them stale until one
+ * is writable again.
+ */
+static void brd_restore_snapshot(struct brd_device *brd)
+{
+  if (brd_ancestors_read_only(brd))
+    brd_restore_dirty_pages(brd);
+  else
+    brd_free_pages(brd);
+  brd_free_children_clean_pages(brd);
+}
+
 /*
  * copy_to_brd_setup must be called before copy_to_brd. It may sleep.
  */
@@ -307,8 +459,7 @@ static void copy_from_brd(void *dst, struct brd_device *brd, sector_t sector,
     src = kmap_atomic(page);
     memcpy(dst, src + offset, copy);
     kunmap_atomic(src);
-  } else if (brd->parent_brd &&
-      (page = brd_lookup_page(brd->parent_brd, sector))) {
+  } else if ((page = brd_lookup_parent_page(brd, sector))) {
     // Present in the old radix tree so this page has not been modified.
     src = kmap_atomic(page);
     memcpy(dst, src + offset, copy);
@@ -329,8 +480,7 @@ static void copy_from_brd(void *dst, struct brd_device *brd, sector_t sector,
       src = kmap_atomic(page);
       memcpy(dst, src, copy);
       kunmap_atomic(src);
-    } else if (brd->parent_brd &&
-        (page = brd_lookup_page(brd->parent_brd, sector))) {
+    } else if ((page = brd_lookup_parent_page(brd, sector))) {
       // Present in the old radix tree so this page has not been modified.
       src = kmap_atomic(page);
       memcpy(dst, src, copy);
@@ -467,6 +617,13 @@ static int brd_direct_access(struct block_device *bdev, sector_t sector,
 }
 #endif
 
+static int brd_restore_from_snapshot(struct brd_device *brd,
+    unsigned long snapshot);
+static int brd_set_parent(struct block_device *bdev, struct brd_device *brd,
+    unsigned long snapshot);
+static int brd_write_extents(struct block_device *bdev, struct brd_device *brd,
+    unsigned long arg);
+
 static int brd_ioctl(struct block_device *bdev, fmode_t mode,
       unsigned int cmd, unsigned long arg)
 {
@@ -475,22 +632,38 @@ static int brd_ioctl(struct block_device *bdev, fmode_t mode,
 
   switch (cmd) {
     case COW_BRD_SNAPSHOT:
-      if (brd->is_snapshot) {
-        return -ENOTTY;
-      }
+      // Snapshots can be made read-only too, so snapshots chained off of them
+      // can keep their pages when restored.
       brd->is_writable = false;
       break;
     case COW_BRD_UNSNAPSHOT:
-      if (brd->is_snapshot) {
-        return -ENOTTY;
-      }
       brd->is_writable = true;
+      // Snapshot pages kept to match this brd may not match it anymore.
+      brd_free_children_clean_pages(brd);
       break;
     case COW_BRD_RESTORE_SNAPSHOT:
       if (!brd->is_snapshot) {
         return -ENOTTY;
       }
-      brd_free_pages(brd);
+      brd_restore_snapshot(brd);
+      break;
+    case COW_BRD_RESTORE_FROM_SNAPSHOT:
+      if (!brd->is_snapshot) {
+        return -ENOTTY;
+      }
+      error = brd_restore_from_snapshot(brd, arg);
+      break;
+    case COW_BRD_SET_PARENT:
+      if (!brd->is_snapshot) {
+        return -ENOTTY;
+      }
+      error = brd_set_parent(bdev, brd, arg);
+      break;
+    case COW_BRD_WRITE_EXTENTS:
+      if (!(mode & FMODE_WRITE)) {
+        return -EBADF;
+      }
+      error = brd_write_extents(bdev, brd, arg);
       break;
     case COW_BRD_WIPE:
       if (brd->is_snapshot) {
@@ -498,6 +671,10 @@ static int brd_ioctl(struct block_device *bdev, fmode_t mode,
       }
       // Assumes no snapshots are being used right now.
       brd_free_pages(brd);
+      brd_free_children_clean_pages(brd);
+      // Cached pages would still show the old contents to anyone reading the
+      // device after it is wiped and loaded with a new image.
+      invalidate_bdev(bdev);
       break;
     default:
       error = -ENOTTY;
@@ -552,6 +729,245 @@ __setup("ramdisk_size=", ramdisk_size);
 static LIST_HEAD(brd_devices);
 static DEFINE_MUTEX(brd_devices_mutex);
 
+/*
+ * Make the page at page index idx in brd a copy of src_page, reusing the page
+ * brd already has there if there is one.
+ */
+static int brd_copy_page(struct brd_device *brd, pgoff_t idx,
+    struct page *src_page)
+{
+  struct page *page;
+  gfp_t gfp_flags = GFP_NOIO;
+#ifndef CONFIG_BLK_DEV_XIP
+  gfp_flags |= __GFP_HIGHMEM;
+#endif
+
+  page = brd_lookup_page(brd, (sector_t) idx << PAGE_SECTORS_SHIFT);
+  if (page) {
+    copy_highpage(page, src_page);
+    brd_mark_dirty(brd, idx);
+    return 0;
+  }
+
+  page = alloc_page(gfp_flags);
+  if (!page)
+    return -ENOMEM;
+  copy_highpage(page, src_page);
+
+  if (radix_tree_preload(GFP_NOIO)) {
+    __free_page(page);
+    return -ENOMEM;
+  }
+
+  spin_lock(&brd->brd_lock);
+  page->index = idx;
+  if (radix_tree_insert(&brd->brd_pages, idx, page)) {
+    spin_unlock(&brd->brd_lock);
+    radix_tree_preload_end();
+    __free_page(page);
+    return -EEXIST;
+  }
+  if (brd->is_snapshot)
+    radix_tree_tag_set(&brd->brd_pages, idx, BRD_TAG_DIRTY);
+  spin_unlock(&brd->brd_lock);
+  radix_tree_preload_end();
+
+  return 0;
+}
+
+static bool brd_is_ancestor(struct brd_device *ancestor,
+    struct brd_device *brd)
+{
+  struct brd_device *cur;
+
+  for (cur = brd->parent_brd; cur; cur = cur->parent_brd) {
+    if (cur == ancestor)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Drop the pages snapshots anywhere down the chain from brd keep to match it,
+ * for when brd's contents are about to change.
+ */
+static void brd_free_children_clean_pages(struct brd_device *brd)
+{
+  struct brd_device *cur;
+
+  mutex_lock(&brd_devices_mutex);
+  list_for_each_entry(cur, &brd_devices, brd_list) {
+    if (brd_is_ancestor(brd, cur))
+      brd_free_clean_pages(cur);
+  }
+  mutex_unlock(&brd_devices_mutex);
+}
+
+/*
+ * Find snapshot number snapshot (the N in cow_ram_snapshotN_M) of the same disk
+ * as brd, or the disk itself if snapshot is 0.
+ */
+static struct brd_device *brd_find_snapshot(struct brd_device *brd,
+    unsigned long snapshot)
+{
+  struct brd_device *cur, *res = NULL;
+  int number;
+
+  if (snapshot > num_snapshots)
+    return NULL;
+  number = snapshot * num_disks + (brd->brd_number % num_disks);
+
+  mutex_lock(&brd_devices_mutex);
+  list_for_each_entry(cur, &brd_devices, brd_list) {
+    if (cur->brd_number == number) {
+      res = cur;
+      break;
+    }
+  }
+  mutex_unlock(&brd_devices_mutex);
+  return res;
+}
+
+/*
+ * Make the snapshot brd a fresh snapshot of another snapshot of the same disk,
+ * or of the disk itself if snapshot is 0. Whatever brd held is dropped. Must
+ * only be called when nothing is using brd or any snapshot chained off of it.
+ */
+static int brd_set_parent(struct block_device *bdev, struct brd_device *brd,
+    unsigned long snapshot)
+{
+  struct brd_device *parent = brd_find_snapshot(brd, snapshot);
+
+  if (!parent || parent == brd || brd_is_ancestor(brd, parent))
+    return -EINVAL;
+
+  brd_free_pages(brd);
+  brd_free_children_clean_pages(brd);
+  mutex_lock(&brd_devices_mutex);
+  brd->parent_brd = parent;
+  mutex_unlock(&brd_devices_mutex);
+  invalidate_bdev(bdev);
+  return 0;
+}
+
+/*
+ * Reset the snapshot brd so that it has the same contents as another snapshot
+ * of the same disk. Both snapshots share a parent, so only the pages the other
+ * snapshot has written since it was restored need to be copied. Like
+ * COW_BRD_RESTORE_SNAPSHOT, this must only be called when nothing is using
+ * either device.
+ */
+static int brd_restore_from_snapshot(struct brd_device *brd,
+    unsigned long snapshot)
+{
+  struct brd_device *src;
+  struct page *pages[FREE_BATCH];
+  unsigned long pos = 0;
+  int nr_pages, i, error = 0;
+
+  if (snapshot < 1)
+    return -EINVAL;
+  src = brd_find_snapshot(brd, snapshot);
+  if (!src || src == brd || src->parent_brd != brd->parent_brd)
+    return -EINVAL;
+
+  brd_restore_snapshot(brd);
+
+  do {
+    rcu_read_lock();
+    nr_pages = radix_tree_gang_lookup_tag(&src->brd_pages, (void **)pages,
+        pos, FREE_BATCH, BRD_TAG_DIRTY);
+    rcu_read_unlock();
+
+    for (i = 0; i < nr_pages; i++) {
+      pos = pages[i]->index;
+      error = brd_copy_page(brd, pos, pages[i]);
+      if (error) {
+        // Don't leave the snapshot half copied.
+        brd_free_pages(brd);
+        return error;
+      }
+    }
+
+    pos++;
+  } while (nr_pages == FREE_BATCH);
+
+  return error;
+}
+
+/*
+ * Copy one extent from user-land into brd, a page at a time. May sleep.
+ */
+static int brd_write_extent(struct brd_device *brd,
+    const struct cow_brd_extent *extent, u64 capacity)
+{
+  const char __user *src = (const char __user *) (unsigned long) extent->data;
+  u64 pos = extent->offset;
+  const u64 end = extent->offset + extent->size;
+  struct page *page;
+  unsigned int offset;
+  size_t copy;
+  unsigned long left;
+  void *dst;
+
+  if (end < pos || end > capacity)
+    return -EINVAL;
+
+  while (pos < end) {
+    offset = pos & (PAGE_SIZE - 1);
+    copy = min_t(u64, end - pos, PAGE_SIZE - offset);
+    page = brd_insert_page(brd, pos >> SECTOR_SHIFT);
+    if (!page)
+      return -ENOMEM;
+    dst = kmap(page);
+    left = copy_from_user(dst + offset, src, copy);
+    kunmap(page);
+    if (left)
+      return -EFAULT;
+    pos += copy;
+    src += copy;
+  }
+  return 0;
+}
+
+/*
+ * Write a batch of extents straight into brd's pages, without going through
+ * the block layer a bio at a time, then drop the now stale page cache once.
+ * Like restoring a snapshot, this must only be called when nothing else is
+ * using the device.
+ */
+#define EXTENT_BATCH 16
+static int brd_write_extents(struct block_device *bdev, struct brd_device *brd,
+    unsigned long arg)
+{
+  struct cow_brd_extent_batch batch;
+  struct cow_brd_extent extents[EXTENT_BATCH];
+  const u64 capacity = (u64) get_capacity(brd->brd_disk) << SECTOR_SHIFT;
+  u64 done = 0, nr_extents;
+  int i, error = 0;
+
+  if (!brd->is_writable)
+    return -EROFS;
+  if (copy_from_user(&batch, (void __user *) arg, sizeof(batch)))
+    return -EFAULT;
+
+  while (done < batch.num_extents && !error) {
+    nr_extents = min_t(u64, batch.num_extents - done, EXTENT_BATCH);
+    if (copy_from_user(extents, (void __user *) (unsigned long)
+          (batch.extents + done * sizeof(struct cow_brd_extent)),
+          nr_extents * sizeof(struct cow_brd_extent))) {
+      error = -EFAULT;
+      break;
+    }
+    for (i = 0; i < nr_extents && !error; i++)
+      error = brd_write_extent(brd, &extents[i], capacity);
+    done += nr_extents;
+  }
+
+  invalidate_bdev(bdev);
+  return error;
+}
+
 static struct brd_device *brd_alloc(int i)
 {
   struct brd_device *brd;
@@ -8,6 +8,7 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 
 #include "disk_wrapper_ioctl.h"
@@ -25,6 +26,20 @@ module_param(target_device_path, charp, 0);
 static char* flags_device_path = "";
 module_param(flags_device_path, charp, 0);
 
+static bool debug_log = false;
+module_param(debug_log, bool, 0644);
+MODULE_PARM_DESC(debug_log, "Print every logged bio and its flags to dmesg");
+
+static unsigned int arena_chunks = 16;
+module_param(arena_chunks, uint, 0444);
+MODULE_PARM_DESC(arena_chunks, "Number of bio data arena chunks allocated "
+    "when the module is loaded and kept when the log is cleared");
+
+static unsigned int max_log_mb = 0;
+module_param(max_log_mb, uint, 0644);
+MODULE_PARM_DESC(max_log_mb, "Most memory the log can hold before bios wait "
+    "for user-land to drain it, 0 for no limit");
+
 const char* const flag_names[] = {
   "write", "fail fast dev", "fail fast transport", "fail fast driver", "sync",
   "meta", "prio", "discard", "secure", "write same", "no idle", "fua", "flush",
@@ -38,8 +53,48 @@ struct disk_write_op {
   struct disk_write_op_meta metadata;
   void* data;
   struct disk_write_op* next;
+  // Order ops were logged in across all CPUs.
+  u64 seq;
+  // Arena chunk data is in, or NULL if it is from kmalloc.
+  struct hwm_arena_chunk* chunk;
+};
+
+/*
+ * Logged bio data is packed into chunks of pages, so logging a bio doesn't
+ * need an allocation of its own. Each CPU fills its own chunk. A chunk goes
+ * back to the arena once a CPU has moved on to another chunk and every op with
+ * data in it is freed, and up to arena_chunks of them are kept for reuse
+ * instead of being freed. Data too big for a chunk, or logged when no chunk
+ * can be had, gets a kmalloc of its own.
+ */
+#define HWM_ARENA_CHUNK_ORDER 6
+#define HWM_ARENA_CHUNK_SIZE  (PAGE_SIZE << HWM_ARENA_CHUNK_ORDER)
+
+struct hwm_arena_chunk {
+  struct list_head list;
+  unsigned long used;
+  // Ops with data in the chunk.
+  atomic_t live;
+  // No CPU is filling the chunk anymore.
+  bool retired;
+};
+
+#define HWM_ARENA_HEADER_SIZE ALIGN(sizeof(struct hwm_arena_chunk), 8)
+
+/*
+ * Ops logged on a CPU that haven't been moved to the log yet, in the order
+ * they were logged. The lock is only contended while the log is being read or
+ * checkpointed.
+ */
+struct hwm_cpu_log {
+  spinlock_t lock;
+  struct disk_write_op* head;
+  struct disk_write_op* tail;
+  struct hwm_arena_chunk* chunk;
 };
 
+static struct kmem_cache* write_op_cache;
+
 static int major_num = 0;
 
 static struct hwm_device {
@@ -79,29 +134,357 @@ static struct hwm_device {
   // Pointer to log entry to be sent to user-land next.
   struct disk_write_op* current_log_write;
   unsigned long current_checkpoint;
+  // Bios logged since the module was loaded.
+  atomic64_t logged_writes;
+
+  struct hwm_cpu_log __percpu* cpu_logs;
+  atomic64_t next_seq;
+  // Arena chunks free for reuse.
+  spinlock_t arena_lock;
+  struct list_head free_chunks;
+  unsigned int num_free_chunks;
+
+  // Memory held by ops in the log, counted against max_log_mb. Bios wait on
+  // log_space_wait while it is over the limit.
+  atomic64_t log_mem;
+  wait_queue_head_t log_space_wait;
+
+  // Reported by HWM_GET_LOG_STATS. All but arena_bytes reset with the log.
+  atomic64_t log_entries;
+  atomic64_t log_bytes;
+  atomic64_t log_overhead_ns;
+  atomic64_t arena_misses;
+  atomic64_t arena_bytes;
+  atomic64_t log_throttle_ns;
 } Device;
 
 static bool should_log(struct bio *bio);
 
-static void free_logs(void) {
-  // Remove all writes.
-  ktime_t curr_time;
-  struct disk_write_op *first = NULL;
-  struct disk_write_op* w = Device.writes;
+static inline long long write_mem(struct disk_write_op* w) {
+  return sizeof(struct disk_write_op) + w->metadata.size;
+}
+
+static inline bool log_has_room(void) {
+  return max_log_mb == 0 || !Device.log_on ||
+    atomic64_read(&Device.log_mem) < ((long long) max_log_mb << 20);
+}
+
+static void arena_free_chunk(struct hwm_arena_chunk* chunk) {
+  free_pages((unsigned long) chunk, HWM_ARENA_CHUNK_ORDER);
+  atomic64_sub(HWM_ARENA_CHUNK_SIZE, &Device.arena_bytes);
+}
+
+static struct hwm_arena_chunk* arena_get_chunk(void) {
+  struct hwm_arena_chunk* chunk = NULL;
+
+  spin_lock(&Device.arena_lock);
+  if (!list_empty(&Device.free_chunks)) {
+    chunk = list_first_entry(&Device.free_chunks, struct hwm_arena_chunk,
+        list);
+    list_del(&chunk->list);
+    --Device.num_free_chunks;
+  }
+  spin_unlock(&Device.arena_lock);
+
+  if (chunk == NULL) {
+    chunk = (struct hwm_arena_chunk*) __get_free_pages(
+        GFP_NOIO | __GFP_NOWARN, HWM_ARENA_CHUNK_ORDER);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    atomic64_add(HWM_ARENA_CHUNK_SIZE, &Device.arena_bytes);
+  }
+  chunk->used = HWM_ARENA_HEADER_SIZE;
+  atomic_set(&chunk->live, 0);
+  chunk->retired = false;
+  return chunk;
+}
+
+/*
+ * Keeps the chunk for reuse, or puts it on extra_chunks to be freed once
+ * arena_lock, which must be held, is dropped.
+ */
+static void arena_recycle_chunk(struct hwm_arena_chunk* chunk,
+    struct list_head* extra_chunks) {
+  if (Device.num_free_chunks < arena_chunks) {
+    list_add(&chunk->list, &Device.free_chunks);
+    ++Device.num_free_chunks;
+  } else {
+    list_add(&chunk->list, extra_chunks);
+  }
+}
+
+static void arena_free_extra_chunks(struct list_head* extra_chunks) {
+  struct hwm_arena_chunk* chunk;
+  struct hwm_arena_chunk* tmp_chunk;
+
+  list_for_each_entry_safe(chunk, tmp_chunk, extra_chunks, list) {
+    list_del(&chunk->list);
+    arena_free_chunk(chunk);
+  }
+}
+
+/*
+ * Called once no CPU will put more data in the chunk.
+ */
+static void arena_retire_chunk(struct hwm_arena_chunk* chunk) {
+  LIST_HEAD(extra_chunks);
+
+  spin_lock(&Device.arena_lock);
+  chunk->retired = true;
+  if (atomic_read(&chunk->live) == 0) {
+    arena_recycle_chunk(chunk, &extra_chunks);
+  }
+  spin_unlock(&Device.arena_lock);
+  arena_free_extra_chunks(&extra_chunks);
+}
+
+/*
+ * Frees a chain of ops along with their data.
+ */
+static void free_writes(struct disk_write_op* w) {
   struct disk_write_op* tmp_w;
+  LIST_HEAD(extra_chunks);
+
+  spin_lock(&Device.arena_lock);
   while (w != NULL) {
-    kfree(w->data);
     tmp_w = w;
     w = w->next;
-    kfree(tmp_w);
+    if (tmp_w->chunk == NULL) {
+      kfree(tmp_w->data);
+    } else if (atomic_dec_and_test(&tmp_w->chunk->live) &&
+        tmp_w->chunk->retired) {
+      arena_recycle_chunk(tmp_w->chunk, &extra_chunks);
+    }
+    atomic64_sub(write_mem(tmp_w), &Device.log_mem);
+    kmem_cache_free(write_op_cache, tmp_w);
+  }
+  spin_unlock(&Device.arena_lock);
+  arena_free_extra_chunks(&extra_chunks);
+  wake_up_all(&Device.log_space_wait);
+}
+
+/*
+ * Gets room for size bytes of data for write, from the arena if it can. May
+ * sleep, so no locks can be held.
+ */
+static void* log_data_alloc(struct disk_write_op* write, unsigned int size) {
+  struct hwm_cpu_log* cl;
+  struct hwm_arena_chunk* chunk;
+  struct hwm_arena_chunk* old_chunk;
+  void* data = NULL;
+  const unsigned long needed = ALIGN(size, 8);
+
+  if (needed <= HWM_ARENA_CHUNK_SIZE - HWM_ARENA_HEADER_SIZE) {
+    // The task may move to another CPU after this, which only means it shares
+    // that CPU's chunk under its lock.
+    cl = per_cpu_ptr(Device.cpu_logs, raw_smp_processor_id());
+    spin_lock(&cl->lock);
+    chunk = cl->chunk;
+    if (chunk != NULL && chunk->used + needed <= HWM_ARENA_CHUNK_SIZE) {
+      data = (u8*) chunk + chunk->used;
+      chunk->used += needed;
+      atomic_inc(&chunk->live);
+      write->chunk = chunk;
+    }
+    spin_unlock(&cl->lock);
+    if (data != NULL) {
+      return data;
+    }
+
+    // Whatever is left in the old chunk goes unused.
+    chunk = arena_get_chunk();
+    if (chunk != NULL) {
+      data = (u8*) chunk + chunk->used;
+      chunk->used += needed;
+      atomic_inc(&chunk->live);
+      write->chunk = chunk;
+      spin_lock(&cl->lock);
+      old_chunk = cl->chunk;
+      cl->chunk = chunk;
+      spin_unlock(&cl->lock);
+      if (old_chunk != NULL) {
+        arena_retire_chunk(old_chunk);
+      }
+      return data;
+    }
+  }
+
+  atomic64_inc(&Device.arena_misses);
+  return kmalloc(size, GFP_NOIO);
+}
+
+/*
+ * The sequence number is taken under the CPU's lock and the op is queued
+ * before it is dropped, so every op numbered at or below a given sequence
+ * number is queued by the time drain_staged_writes takes that lock.
+ */
+static void stage_write(struct disk_write_op* write) {
+  struct hwm_cpu_log* cl =
+    per_cpu_ptr(Device.cpu_logs, raw_smp_processor_id());
+
+  atomic64_add(write_mem(write), &Device.log_mem);
+  spin_lock(&cl->lock);
+  write->seq = atomic64_inc_return(&Device.next_seq);
+  if (cl->tail == NULL) {
+    cl->head = write;
+  } else {
+    cl->tail->next = write;
+  }
+  cl->tail = write;
+  spin_unlock(&cl->lock);
+}
+
+static struct disk_write_op* merge_by_seq(struct disk_write_op* a,
+    struct disk_write_op* b) {
+  struct disk_write_op* res = NULL;
+  struct disk_write_op** tail = &res;
+
+  while (a != NULL && b != NULL) {
+    if (a->seq < b->seq) {
+      *tail = a;
+      a = a->next;
+    } else {
+      *tail = b;
+      b = b->next;
+    }
+    tail = &(*tail)->next;
+  }
+  *tail = (a != NULL) ? a : b;
+  return res;
+}
+
+/*
+ * Moves every staged op numbered at or below limit to the end of the log, in
+ * the order they were logged. Must be called with Device.lock held.
+ */
+static void drain_staged_writes(u64 limit) {
+  struct disk_write_op* merged = NULL;
+  struct disk_write_op* first;
+  struct disk_write_op* last;
+  struct hwm_cpu_log* cl;
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    cl = per_cpu_ptr(Device.cpu_logs, cpu);
+    spin_lock(&cl->lock);
+    first = cl->head;
+    last = NULL;
+    while (cl->head != NULL && cl->head->seq <= limit) {
+      last = cl->head;
+      cl->head = cl->head->next;
+    }
+    if (cl->head == NULL) {
+      cl->tail = NULL;
+    }
+    spin_unlock(&cl->lock);
+
+    if (last != NULL) {
+      last->next = NULL;
+      merged = merge_by_seq(merged, first);
+    }
   }
 
+  if (merged == NULL) {
+    return;
+  }
+  if (Device.current_write == NULL) {
+    Device.writes = merged;
+  } else {
+    Device.current_write->next = merged;
+  }
+  // Everything before was already sent to user-land.
+  if (Device.current_log_write == NULL) {
+    Device.current_log_write = merged;
+  }
+  while (merged->next != NULL) {
+    merged = merged->next;
+  }
+  Device.current_write = merged;
+}
+
+static void drain_all_staged_writes(void) {
+  spin_lock(&Device.lock);
+  drain_staged_writes(atomic64_read(&Device.next_seq));
+  spin_unlock(&Device.lock);
+}
+
+/*
+ * Frees every op in the log and retires the chunks CPUs are filling, so the
+ * arena has all of its chunks back.
+ */
+static void free_log_entries(void) {
+  struct disk_write_op* w;
+  struct hwm_arena_chunk* chunk;
+  struct hwm_cpu_log* cl;
+  int cpu;
+
+  spin_lock(&Device.lock);
+  drain_staged_writes((u64) -1);
+  w = Device.writes;
+  Device.writes = NULL;
+  Device.current_write = NULL;
+  Device.current_log_write = NULL;
+  spin_unlock(&Device.lock);
+  free_writes(w);
+
+  for_each_possible_cpu(cpu) {
+    cl = per_cpu_ptr(Device.cpu_logs, cpu);
+    spin_lock(&cl->lock);
+    chunk = cl->chunk;
+    cl->chunk = NULL;
+    spin_unlock(&cl->lock);
+    if (chunk != NULL) {
+      arena_retire_chunk(chunk);
+    }
+  }
+
+  atomic64_set(&Device.log_entries, 0);
+  atomic64_set(&Device.log_bytes, 0);
+  atomic64_set(&Device.log_overhead_ns, 0);
+  atomic64_set(&Device.arena_misses, 0);
+  atomic64_set(&Device.log_throttle_ns, 0);
+}
+
+/*
+ * Frees the ops at the start of the log that were sent to user-land, except
+ * the last op in the log, which new ops are added after.
+ */
+static void free_sent_writes(void) {
+  struct disk_write_op* first;
+  struct disk_write_op* last = NULL;
+  struct disk_write_op* w;
+
+  spin_lock(&Device.lock);
+  first = Device.writes;
+  for (w = Device.writes; w != NULL && w != Device.current_log_write &&
+      w != Device.current_write; w = w->next) {
+    last = w;
+  }
+  if (last != NULL) {
+    Device.writes = w;
+    last->next = NULL;
+  }
+  spin_unlock(&Device.lock);
+
+  if (last != NULL) {
+    free_writes(first);
+  }
+}
+
+static void free_logs(void) {
+  // Remove all writes.
+  ktime_t curr_time;
+  struct disk_write_op *first = NULL;
+  free_log_entries();
+
   // Create default first checkpoint at start of log.
-  first = kzalloc(sizeof(struct disk_write_op), GFP_NOIO);
+  first = kmem_cache_zalloc(write_op_cache, GFP_NOIO);
   if (first == NULL) {
     printk(KERN_WARNING "hwm: error allocating default checkpoint\n");
     return;
   }
+  atomic64_add(write_mem(first), &Device.log_mem);
   curr_time = ktime_get();
 
   first->metadata.bi_flags = HWM_CHECKPOINT_FLAG;
@@ -120,11 +503,27 @@ static int disk_wrapper_ioctl(struct block_device* bdev, fmode_t mode,
   unsigned int not_copied;
   struct disk_write_op *checkpoint = NULL;
   ktime_t curr_time;
+  struct disk_write_log_batch batch;
+  struct disk_write_log_stats stats;
+  unsigned long long logged_writes;
+
+  // Bios logged so far have to be in the log before it can be read.
+  switch (cmd) {
+    case HWM_GET_LOG_META:
+    case HWM_GET_LOG_DATA:
+    case HWM_NEXT_ENT:
+    case HWM_GET_LOG_BATCH:
+    case HWM_DRAIN_LOG_BATCH:
+      drain_all_staged_writes();
+      break;
+  }
 
   switch (cmd) {
     case HWM_LOG_OFF:
       printk(KERN_INFO "hwm: turning off data logging\n");
       Device.log_on = false;
+      // Bios waiting for room in the log go ahead.
+      wake_up_all(&Device.log_space_wait);
       break;
     case HWM_LOG_ON:
       printk(KERN_INFO "hwm: turning on data logging\n");
@@ -194,6 +593,71 @@ static int disk_wrapper_ioctl(struct block_device* bdev, fmode_t mode,
       }
       Device.current_log_write = Device.current_log_write->next;
       break;
+    case HWM_GET_LOG_BATCH:
+    case HWM_DRAIN_LOG_BATCH:
+      if (copy_from_user(&batch, (void*) arg, sizeof(batch))) {
+        return -EFAULT;
+      }
+      if (Device.current_log_write == NULL) {
+        return -ENODATA;
+      }
+      batch.num_entries = 0;
+      batch.used = 0;
+      batch.next_size = 0;
+      while (Device.current_log_write != NULL) {
+        struct disk_write_op* w = Device.current_log_write;
+        unsigned long long entry_size =
+          HWM_LOG_BATCH_ENTRY_SIZE(w->metadata.size);
+        void __user* dest = (void __user*) (unsigned long) (batch.buf +
+            batch.used);
+        if (batch.used + entry_size > batch.buf_size) {
+          batch.next_size = entry_size;
+          break;
+        }
+        // Padding between entries is left as is, user-land doesn't read it.
+        if (copy_to_user(dest, &w->metadata,
+              sizeof(struct disk_write_op_meta)) ||
+            (w->metadata.size > 0 &&
+             copy_to_user(dest + sizeof(struct disk_write_op_meta), w->data,
+               w->metadata.size))) {
+          printk(KERN_WARNING "hwm: bad user land memory pointer in log "
+              "batch\n");
+          return -EFAULT;
+        }
+        batch.used += entry_size;
+        ++batch.num_entries;
+        // Locked so ops added after w aren't skipped when it was the last one.
+        spin_lock(&Device.lock);
+        Device.current_log_write = w->next;
+        spin_unlock(&Device.lock);
+      }
+      if (copy_to_user((void*) arg, &batch, sizeof(batch))) {
+        return -EFAULT;
+      }
+      if (batch.num_entries == 0) {
+        return -ENOSPC;
+      }
+      if (cmd == HWM_DRAIN_LOG_BATCH) {
+        free_sent_writes();
+      }
+      break;
+    case HWM_GET_LOG_COUNT:
+      logged_writes = atomic64_read(&Device.logged_writes);
+      if (copy_to_user((void*) arg, &logged_writes, sizeof(logged_writes))) {
+        return -EFAULT;
+      }
+      break;
+    case HWM_GET_LOG_STATS:
+      stats.entries = atomic64_read(&Device.log_entries);
+      stats.data_bytes = atomic64_read(&Device.log_bytes);
+      stats.overhead_ns = atomic64_read(&Device.log_overhead_ns);
+      stats.arena_misses = atomic64_read(&Device.arena_misses);
+      stats.arena_bytes = atomic64_read(&Device.arena_bytes);
+      stats.throttle_ns = atomic64_read(&Device.log_throttle_ns);
+      if (copy_to_user((void*) arg, &stats, sizeof(stats))) {
+        return -EFAULT;
+      }
+      break;
     case HWM_CLR_LOG:
       printk(KERN_INFO "hwm: clearing data logs\n");
       free_logs();
@@ -202,7 +666,7 @@ static int disk_wrapper_ioctl(struct block_device* bdev, fmode_t mode,
       curr_time = ktime_get();
       printk(KERN_INFO "hwm: making checkpoint in log\n");
       // Create a new log entry that just says we got a checkpoint.
-      checkpoint = kzalloc(sizeof(struct disk_write_op), GFP_NOIO);
+      checkpoint = kmem_cache_zalloc(write_op_cache, GFP_NOIO);
       if (checkpoint == NULL) {
         printk(KERN_WARNING "hwm: error allocating checkpoint\n");
         return -ENOMEM;
@@ -211,14 +675,23 @@ static int disk_wrapper_ioctl(struct block_device* bdev, fmode_t mode,
       checkpoint->metadata.bi_rw = HWM_CHECKPOINT_FLAG;
       checkpoint->metadata.bi_flags = HWM_CHECKPOINT_FLAG;
       checkpoint->metadata.time_ns = ktime_to_ns(curr_time);
-      // Aquire lock and add the new entry to the end of the list.
+      atomic64_add(write_mem(checkpoint), &Device.log_mem);
+      // Aquire lock and add the new entry to the end of the list, after every
+      // bio logged before it.
       spin_lock(&Device.lock);
+      checkpoint->seq = atomic64_inc_return(&Device.next_seq);
+      drain_staged_writes(checkpoint->seq - 1);
       // Assuming spinlock keeps the compiler from reordering this before the
       // lock is aquired...
       checkpoint->metadata.write_sector = Device.current_checkpoint;
       ++Device.current_checkpoint;
       Device.current_write->next = checkpoint;
       Device.current_write = checkpoint;
+      // If everything before this was already drained, send the checkpoint
+      // next.
+      if (Device.current_log_write == NULL) {
+        Device.current_log_write = checkpoint;
+      }
       // Drop lock and return success.
       spin_unlock(&Device.lock);
       break;
@@ -604,7 +1077,6 @@ static void print_rw_flags(unsigned long rw, unsigned long flags) {
 #endif
 }
 
-// TODO(ashmrtn): Currently not thread safe/reentrant. Make it so.
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 12, 0) && \
     LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0)) || \
   (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0) && \
@@ -631,24 +1103,32 @@ static blk_qc_t disk_wrapper_bio(struct request_queue* q, struct bio* bio) {
   struct disk_write_op *write;
   struct hwm_device* hwm;
   ktime_t curr_time;
+  ktime_t throttle_start;
 
-  /*
-  printk(KERN_INFO "hwm: bio rw of size %u headed for 0x%lx (sector 0x%lx)"
-      " has flags:\n", bio->BI_SIZE, bio->BI_SECTOR * 512, bio->BI_SECTOR);
-  print_rw_flags(bio->BI_RW, bio->bi_flags);
-  */
   // Log information about writes, fua, and flush/flush_seq events in kernel
   // memory.
   if (Device.log_on && should_log(bio)) {
+    // Hold the bio until user-land drains the log below the limit.
+    if (!log_has_room()) {
+      throttle_start = ktime_get();
+      // Timed so lowering max_log_mb through sysfs is noticed too.
+      while (!wait_event_timeout(Device.log_space_wait, log_has_room(),
+            HZ / 10)) {
+      }
+      atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), throttle_start)),
+          &Device.log_throttle_ns);
+    }
     curr_time = ktime_get();
 
-    printk(KERN_INFO "hwm: bio rw of size %u headed for 0x%lx (sector 0x%lx)"
-                     " has flags:\n", bio->BI_SIZE, bio->BI_SECTOR * 512,
-           bio->BI_SECTOR);
-    print_rw_flags(bio->BI_RW, bio->bi_flags);
+    if (debug_log) {
+      printk(KERN_INFO "hwm: bio rw of size %u headed for 0x%lx (sector 0x%lx)"
+                       " has flags:\n", bio->BI_SIZE, bio->BI_SECTOR * 512,
+             bio->BI_SECTOR);
+      print_rw_flags(bio->BI_RW, bio->bi_flags);
+    }
 
     // Log data to disk logs.
-    write = kzalloc(sizeof(struct disk_write_op), GFP_NOIO);
+    write = kmem_cache_zalloc(write_op_cache, GFP_NOIO);
     if (write == NULL) {
       printk(KERN_WARNING "hwm: unable to make new write node\n");
       goto passthrough;
@@ -660,29 +1140,13 @@ static blk_qc_t disk_wrapper_bio(struct request_queue* q, struct bio* bio) {
     write->metadata.size = bio->BI_SIZE;
     write->metadata.time_ns = ktime_to_ns(curr_time);
 
-    // Protect playing around with our list of logged bios.
-    spin_lock(&Device.lock);
-    if (Device.current_write == NULL) {
-      // With the default first checkpoint, this case should never happen.
-      printk(KERN_WARNING "hwm: found empty list of previous disk ops\n");
-
-      // This is the first write in the log.
-      Device.writes = write;
-      // Set the first write in the log so that it's picked up later.
-      Device.current_log_write = write;
-    } else {
-      // Some write(s) was/were already made so add this to the back of the
-      // chain and update pointers.
-      Device.current_write->next = write;
-    }
-    Device.current_write = write;
-    spin_unlock(&Device.lock);
-
-    write->data = kmalloc(write->metadata.size, GFP_NOIO);
-    if (write->data == NULL) {
-      printk(KERN_WARNING "hwm: unable to get memory for data logging\n");
-      kfree(write);
-      goto passthrough;
+    if (write->metadata.size > 0) {
+      write->data = log_data_alloc(write, write->metadata.size);
+      if (write->data == NULL) {
+        printk(KERN_WARNING "hwm: unable to get memory for data logging\n");
+        kmem_cache_free(write_op_cache, write);
+        goto passthrough;
+      }
     }
     copied_data = 0;
 
@@ -690,34 +1154,31 @@ static blk_qc_t disk_wrapper_bio(struct request_queue* q, struct bio* bio) {
     struct bio_vec *vec;
     int iter;
     bio_for_each_segment(vec, bio, iter) {
-      //printk(KERN_INFO "hwm: making new page for segment of data\n");
-
       void *bio_data = kmap(vec->bv_page);
       memcpy((void*) (write->data + copied_data), bio_data + vec->bv_offset,
              vec->bv_len);
-      kunmap(bio_data);
+      kunmap(vec->bv_page);
       copied_data += vec->bv_len;
     }
     #else
     struct bio_vec vec;
     struct bvec_iter iter;
     bio_for_each_segment(vec, bio, iter) {
-      //printk(KERN_INFO "hwm: making new page for segment of data\n");
-
       void *bio_data = kmap(vec.bv_page);
       memcpy((void*) (write->data + copied_data), bio_data + vec.bv_offset,
              vec.bv_len);
-      kunmap(bio_data);
+      kunmap(vec.bv_page);
       copied_data += vec.bv_len;
     }
     #endif
-    // Sanity check which prints data copied to the log.
-    /*
-    printk(KERN_INFO "hwm: copied %ld bytes of from %lx data:"
-        "\n~~~\n%s\n~~~\n",
-        write->metadata.size, write->metadata.write_sector * 512,
-        write->data);
-    */
+
+    // Only queued once its data is copied, so readers never see it half done.
+    stage_write(write);
+    atomic64_inc(&Device.logged_writes);
+    atomic64_inc(&Device.log_entries);
+    atomic64_add(write->metadata.size, &Device.log_bytes);
+    atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), curr_time)),
+        &Device.log_overhead_ns);
   }
 
  passthrough:
@@ -754,6 +1215,23 @@ static blk_qc_t disk_wrapper_bio(struct request_queue* q, struct bio* bio) {
 #endif
 }
 
+/*
+ * Frees the log, the arena, and the allocators used for them.
+ */
+static void free_arena(void) {
+  struct hwm_arena_chunk* chunk;
+  struct hwm_arena_chunk* tmp_chunk;
+
+  free_log_entries();
+  list_for_each_entry_safe(chunk, tmp_chunk, &Device.free_chunks, list) {
+    list_del(&chunk->list);
+    arena_free_chunk(chunk);
+  }
+  Device.num_free_chunks = 0;
+  free_percpu(Device.cpu_logs);
+  kmem_cache_destroy(write_op_cache);
+}
+
 // TODO(ashmrtn): Fix error when wrong device path is passed.
 static int __init disk_wrapper_init(void) {
   unsigned int flush_flags;
@@ -761,6 +1239,9 @@ static int __init disk_wrapper_init(void) {
   struct block_device *flags_device, *target_device;
   struct disk_write_op *first = NULL;
   ktime_t curr_time;
+  struct hwm_arena_chunk* chunk;
+  unsigned int i;
+  int cpu;
   printk(KERN_INFO "hwm: Hello World from module\n");
   if (strlen(target_device_path) == 0) {
     return -ENOTTY;
@@ -770,13 +1251,41 @@ static int __init disk_wrapper_init(void) {
   }
   printk(KERN_INFO "hwm: Wrapping device %s with flags device %s\n",
       target_device_path, flags_device_path);
+
+  write_op_cache = kmem_cache_create("hwm_write_op",
+      sizeof(struct disk_write_op), 0, 0, NULL);
+  if (write_op_cache == NULL) {
+    return -ENOMEM;
+  }
+  Device.cpu_logs = alloc_percpu(struct hwm_cpu_log);
+  if (Device.cpu_logs == NULL) {
+    kmem_cache_destroy(write_op_cache);
+    return -ENOMEM;
+  }
+  for_each_possible_cpu(cpu) {
+    spin_lock_init(&per_cpu_ptr(Device.cpu_logs, cpu)->lock);
+  }
+  spin_lock_init(&Device.lock);
+  spin_lock_init(&Device.arena_lock);
+  INIT_LIST_HEAD(&Device.free_chunks);
+  init_waitqueue_head(&Device.log_space_wait);
+  for (i = 0; i < arena_chunks; ++i) {
+    chunk = arena_get_chunk();
+    if (chunk == NULL) {
+      printk(KERN_WARNING "hwm: only allocated %u arena chunks\n", i);
+      break;
+    }
+    list_add(&chunk->list, &Device.free_chunks);
+    ++Device.num_free_chunks;
+  }
+
   // Get memory for our starting disk epoch node.
   Device.log_on = false;
   // Make a checkpoint marking the beginning of the log. This will be useful
   // when watches are implemented and people begin a watch at the very start of
   // a test.
   Device.current_checkpoint = 1;
-  first = kzalloc(sizeof(struct disk_write_op), GFP_NOIO);
+  first = kmem_cache_zalloc(write_op_cache, GFP_NOIO);
   if (first == NULL) {
     printk(KERN_WARNING "hwm: error allocating default checkpoint\n");
     goto out;
@@ -787,6 +1296,7 @@ static int __init disk_wrapper_init(void) {
   first->metadata.bi_rw = HWM_CHECKPOINT_FLAG;
   first->metadata.bi_flags = HWM_CHECKPOINT_FLAG;
   first->metadata.time_ns = ktime_to_ns(curr_time);
+  atomic64_add(write_mem(first), &Device.log_mem);
   Device.writes = first;
   Device.current_write = first;
   Device.current_log_write = Device.current_write;
@@ -863,9 +1373,6 @@ static int __init disk_wrapper_init(void) {
   queue_flags = flags_device->bd_queue->queue_flags;
   blkdev_put(flags_device, FMODE_READ);
 
-  // Set up our internal device.
-  spin_lock_init(&Device.lock);
-
   // And the gendisk structure.
   Device.gd = alloc_disk(1);
   if (!Device.gd) {
@@ -920,11 +1427,11 @@ static int __init disk_wrapper_init(void) {
 
   out:
     unregister_blkdev(major_num, "hwm");
+    free_arena();
     return -ENOMEM;
 }
 
 static void __exit hello_cleanup(void) {
-  free_logs();
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 12, 0) && \
     LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0)) || \
   (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0) && \
@@ -951,6 +1458,7 @@ static void __exit hello_cleanup(void) {
   del_gendisk(Device.gd);
   put_disk(Device.gd);
   unregister_blkdev(major_num, "hwm");
+  free_arena();
 
   printk(KERN_INFO "hwm: Cleaning up bye!\n");
 }
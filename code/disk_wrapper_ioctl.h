@@ -8,11 +8,45 @@
 #define HWM_NEXT_ENT              0xff04
 #define HWM_CLR_LOG               0xff05
 #define HWM_CHECKPOINT            0xff06
+#define HWM_GET_LOG_BATCH         0xff07
+// Argument is an unsigned long long that gets the number of bios logged since
+// the module was loaded. It only ever grows, so user-land can poll it to see
+// if the file system is still writing.
+#define HWM_GET_LOG_COUNT         0xff08
+// Argument is a struct disk_write_log_stats to fill in.
+#define HWM_GET_LOG_STATS         0xff09
+// Same as HWM_GET_LOG_BATCH, but frees the entries it copies so the log can be
+// read while bios are still being logged without holding all of it in memory.
+#define HWM_DRAIN_LOG_BATCH       0xff0a
 
 #define COW_BRD_SNAPSHOT          0xff06
 #define COW_BRD_UNSNAPSHOT        0xff07
 #define COW_BRD_RESTORE_SNAPSHOT  0xff08
 #define COW_BRD_WIPE              0xff09
+// Argument is the number of another snapshot of the same disk (the N in
+// cow_ram_snapshotN_M) whose contents the snapshot should be reset to.
+#define COW_BRD_RESTORE_FROM_SNAPSHOT 0xff0a
+// Argument is the number of another snapshot of the same disk, or 0 for the
+// disk itself, that the snapshot should become a fresh snapshot of. The new
+// parent should be made read-only with COW_BRD_SNAPSHOT while the snapshot is
+// used, and chains can be as long as there are snapshots.
+#define COW_BRD_SET_PARENT        0xff0b
+// Argument is a struct cow_brd_extent_batch of data to copy onto the device.
+#define COW_BRD_WRITE_EXTENTS     0xff0c
+
+// Bytes to write at a byte offset on a cow_brd device.
+struct cow_brd_extent {
+  unsigned long long offset;
+  unsigned long long size;
+  // User-land address of the data.
+  unsigned long long data;
+};
+
+struct cow_brd_extent_batch {
+  // User-land address of an array of num_extents extents, written in order.
+  unsigned long long extents;
+  unsigned long long num_extents;
+};
 
 // Defines that are separate from the kernel because these values aren't stable.
 // Based on 4.4 kernel flags. Comments below sourced from 4.4 Linux kernel.
@@ -135,4 +169,39 @@ struct disk_write_op_meta {
   unsigned long long time_ns;
 };
 
+// Argument to HWM_GET_LOG_BATCH. Starting at the next log entry to be sent to
+// user-land, the kernel copies as many whole entries as fit into the buf_size
+// bytes at buf and moves past them. Each entry is a struct disk_write_op_meta
+// followed by meta.size bytes of data, padded so the next entry starts on an
+// 8 byte boundary. On return num_entries and used say how many entries and
+// bytes were copied. If not even the next entry fits, the ioctl fails with
+// ENOSPC and next_size is the number of bytes it needs.
+struct disk_write_log_batch {
+  unsigned long long buf;
+  unsigned long long buf_size;
+  unsigned long long num_entries;
+  unsigned long long used;
+  unsigned long long next_size;
+};
+
+// Cost of logging bios, from HWM_GET_LOG_STATS. All but arena_bytes count from
+// when the log was last cleared.
+struct disk_write_log_stats {
+  unsigned long long entries;
+  unsigned long long data_bytes;
+  // Time spent copying and queueing logged bios in the bio submission path.
+  unsigned long long overhead_ns;
+  // Bios whose data was too big for, or couldn't get, an arena chunk.
+  unsigned long long arena_misses;
+  // Memory held for logged bio data, in use or not.
+  unsigned long long arena_bytes;
+  // Time bios waited for the log to be drained below max_log_mb.
+  unsigned long long throttle_ns;
+};
+
+#define HWM_LOG_BATCH_ALIGN 8
+#define HWM_LOG_BATCH_ENTRY_SIZE(data_size) \
+  ((sizeof(struct disk_write_op_meta) + (data_size) + \
+    HWM_LOG_BATCH_ALIGN - 1) & ~((unsigned long long) HWM_LOG_BATCH_ALIGN - 1))
+
 #endif
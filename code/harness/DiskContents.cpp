@@ -1,20 +1,61 @@
+#include <algorithm>
+#include <thread>
+
 #include "DiskContents.h"
+#include "../utils/FileCompare.h"
+#include "../utils/FileHash.h"
 
 using std::endl;
 using std::cout;
 using std::string;
 using std::ofstream;
+using std::vector;
+
+using fs_testing::utils::CompareFileRanges;
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintToString;
+using fs_testing::utils::HashFile;
+using fs_testing::utils::HashFiles;
+using fs_testing::utils::RangeMismatch;
 
 namespace fs_testing {
 
+namespace {
+
+// Most crash states hold a few small files, so a couple of threads is plenty.
+const unsigned int kMaxHashThreads = 4;
+const char kUnreadableHash[] = "unreadable";
+// Room for a few hundred directory entries per getdents64 call.
+const size_t kDirentBufSize = 16 * 1024;
+// Bytes printed from each file where a range comparison first differs.
+const size_t kMismatchSampleSize = 16;
+
+// Up to kMismatchSampleSize bytes of the file at offset, in hex.
+string hex_bytes_at(int fd, uint64_t offset) {
+  unsigned char buf[kMismatchSampleSize];
+  const ssize_t res = pread(fd, buf, sizeof(buf), offset);
+  if (res <= 0) {
+    return "no data";
+  }
+  string hex;
+  char byte[4];
+  for (ssize_t i = 0; i < res; ++i) {
+    snprintf(byte, sizeof(byte), "%02x ", buf[i]);
+    hex += byte;
+  }
+  hex.pop_back();
+  return hex;
+}
+
+}  // namespace
+
 fileAttributes::fileAttributes() {
-  md5sum = "";
+  content_hash = "";
   // Initialize dir_attr entries
   dir_attr.d_ino = -1;
   dir_attr.d_off = -1;
   dir_attr.d_reclen = -1;
   dir_attr.d_type = -1;
-  dir_attr.d_name[0] = '\0';
   // Initialize stat_attr entried
   stat_attr.st_ino == -1;
   stat_attr.st_mode = -1;
@@ -29,13 +70,11 @@ fileAttributes::fileAttributes() {
 fileAttributes::~fileAttributes() {
 }
 
-void fileAttributes::set_dir_attr(struct dirent* a) {
+void fileAttributes::set_dir_attr(const struct dirent64 *a) {
   dir_attr.d_ino = a->d_ino;
   dir_attr.d_off = a->d_off;
   dir_attr.d_reclen = a->d_reclen;
   dir_attr.d_type = a->d_type;
-  strncpy(dir_attr.d_name, a->d_name, sizeof(a->d_name));
-  dir_attr.d_name[sizeof(a->d_name) - 1] = '\0';
 }
 
 void fileAttributes::set_stat_attr(string path, bool islstat) {
@@ -47,23 +86,21 @@ void fileAttributes::set_stat_attr(string path, bool islstat) {
   return;
 }
 
-void fileAttributes::set_md5sum(string file_path) {
-  FILE *fp;
-  string command = "md5sum " + file_path;
-  char md5[100];
-  fp = popen(command.c_str(), "r");
-  fscanf(fp, "%s", md5);
-  fclose(fp);
-  md5sum = string(md5);
+void fileAttributes::set_content_hash(string file_path) {
+  Fingerprint hash;
+  if (HashFile(file_path, hash)) {
+    content_hash = FingerprintToString(hash);
+  } else {
+    content_hash = kUnreadableHash;
+  }
 }
 
-bool fileAttributes::compare_dir_attr(struct dirent a) {
+bool fileAttributes::compare_dir_attr(dirAttributes a) {
 
   return ((dir_attr.d_ino == a.d_ino) &&
     (dir_attr.d_off == a.d_off) &&
     (dir_attr.d_reclen == a.d_reclen) &&
-    (dir_attr.d_type == a.d_type) &&
-    (strcmp(dir_attr.d_name, a.d_name) == 0));
+    (dir_attr.d_type == a.d_type));
 }
 
 bool fileAttributes::compare_stat_attr(struct stat a) {
@@ -80,8 +117,8 @@ bool fileAttributes::compare_stat_attr(struct stat a) {
     (stat_attr.st_blocks == a.st_blocks));
 }
 
-bool fileAttributes::compare_md5sum(string a) {
-  return md5sum.compare(a);
+bool fileAttributes::compare_content_hash(string a) {
+  return content_hash.compare(a);
 }
 
 bool fileAttributes::is_regular_file() {
@@ -91,7 +128,6 @@ bool fileAttributes::is_regular_file() {
 ofstream& operator<< (ofstream& os, fileAttributes& a) {
   // print dir_attr
   os << "---Directory Atrributes---" << endl;
-  os << "Name   : " << (a.dir_attr).d_name << endl;
   os << "Inode  : " << (a.dir_attr).d_ino << endl;
   os << "Offset : " << (a.dir_attr).d_off << endl;
   os << "Length : " << (a.dir_attr).d_reclen << endl;
@@ -114,6 +150,7 @@ DiskContents::DiskContents(string path, string type) {
   disk_path = path;
   fs_type = type;
   device_mounted = false;
+  manifest_loaded = false;
 }
 
 DiskContents::~DiskContents() {
@@ -158,68 +195,141 @@ int DiskContents::unmount_and_delete_mount_point() {
     }
   } while (umount_res < 0 && err == EBUSY);
 
+  device_mounted = false;
   // Delete the mount directory
-  if (unlink(mount_point.c_str()) != 0) {
+  if (rmdir(mount_point.c_str()) != 0) {
     return -1;
   }
-  device_mounted = false;
   return 0;
 }
 
+int DiskContents::load_manifest() {
+  if (manifest_loaded) {
+    return 0;
+  }
+  if (mount_disk() != 0) {
+    cout << "Mounting " << disk_path << " failed" << endl;
+    return -1;
+  }
+  get_contents(mount_point.c_str());
+  hash_contents();
+  manifest_loaded = true;
+  return 0;
+}
+
+void DiskContents::release_mount() {
+  if (device_mounted) {
+    unmount_and_delete_mount_point();
+  }
+}
+
+// Disks with a manifest stay mounted between comparisons.
+void DiskContents::finish_compare() {
+  if (!manifest_loaded) {
+    release_mount();
+  }
+}
+
 void DiskContents::set_mount_point(string path) {
   mount_point = path;
 }
 
+/*
+ * Walk everything under path, which is on this disk's mount point, and record
+ * it sorted by path. Each entry is stated once, with lstat semantics, so
+ * symlinks are recorded as links.
+ */
 void DiskContents::get_contents(const char* path) {
-  DIR *directory;
-  struct dirent *dir_entry;
-  // open both the directories
-  if (!(directory = opendir(path))) {
+  contents.clear();
+  entry_paths.clear();
+  const int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
     return;
   }
-  // get the contents in both the directories
-  if (!(dir_entry = readdir(directory))) {
-    closedir(directory);
-    return;
-  }
-  do {
-    string parent_path(path);
-    string filename(dir_entry->d_name);
-    string current_path = parent_path + "/" + filename;
-    string relative_path = current_path;
-    relative_path.erase(0, mount_point.length());
-    struct stat statbuf;
-    fileAttributes fa;
-    if (stat(current_path.c_str(), &statbuf) == -1) {
-      continue;
-    }
-    if (dir_entry->d_type == DT_DIR) {
-      if ((strcmp(dir_entry->d_name, ".") == 0) || (strcmp(dir_entry->d_name, "..") == 0)) {
+  string relative_path(path);
+  relative_path.erase(0, mount_point.length());
+  walk_directory(dir_fd, relative_path);
+  close(dir_fd);
+
+  std::sort(contents.begin(), contents.end(),
+      [this](const entry &a, const entry &b) {
+        return compare_entry_paths(a, *this, b) < 0;
+      });
+}
+
+void DiskContents::walk_directory(int dir_fd, string &relative_path) {
+  alignas(struct dirent64) char buf[kDirentBufSize];
+  long nread;
+  while ((nread = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf))) > 0) {
+    for (long pos = 0; pos < nread;) {
+      const struct dirent64 *dir_entry = (const struct dirent64 *) (buf + pos);
+      pos += dir_entry->d_reclen;
+      if ((strcmp(dir_entry->d_name, ".") == 0) ||
+          (strcmp(dir_entry->d_name, "..") == 0)) {
         continue;
       }
-      fa.set_dir_attr(dir_entry);
-      fa.set_stat_attr(current_path, false);
-      contents[relative_path] = fa;
-      // If the entry is a directory and not . or .. make a recursive call
-      get_contents(current_path.c_str());
-    } else if (dir_entry->d_type == DT_LNK) {
-      // compare lstat outputs
-      struct stat lstatbuf;
-      if (lstat(current_path.c_str(), &lstatbuf) == -1) {
+      struct stat statbuf;
+      if (fstatat(dir_fd, dir_entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW)
+          < 0) {
         continue;
       }
-      fa.set_stat_attr(current_path, true);
-      contents[relative_path] = fa;
-    } else if (dir_entry->d_type == DT_REG) {
-      fa.set_md5sum(current_path);
-      fa.set_stat_attr(current_path, false);
-      contents[relative_path] = fa;
-    } else {
-      fa.set_stat_attr(current_path, false);
-      contents[relative_path] = fa;
+
+      const size_t parent_length = relative_path.size();
+      relative_path += '/';
+      relative_path += dir_entry->d_name;
+      contents.emplace_back();
+      entry &e = contents.back();
+      e.path_offset = entry_paths.size();
+      e.path_length = relative_path.size();
+      entry_paths += relative_path;
+      e.attrs.stat_attr = statbuf;
+      // Regular files are hashed later, and only if the caller needs it, by
+      // hash_contents.
+      if (S_ISDIR(statbuf.st_mode)) {
+        e.attrs.set_dir_attr(dir_entry);
+        const int child_fd = openat(dir_fd, dir_entry->d_name,
+            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_fd >= 0) {
+          walk_directory(child_fd, relative_path);
+          close(child_fd);
+        }
+      }
+      relative_path.resize(parent_length);
     }
-  } while (dir_entry = readdir(directory));
-  closedir(directory);
+  }
+}
+
+string DiskContents::entry_path(const entry &e) const {
+  return entry_paths.substr(e.path_offset, e.path_length);
+}
+
+int DiskContents::compare_entry_paths(const entry &a,
+    const DiskContents &b_disk, const entry &b) const {
+  return entry_paths.compare(a.path_offset, a.path_length, b_disk.entry_paths,
+      b.path_offset, b.path_length);
+}
+
+/*
+ * Hash all the regular files get_contents found, several at a time.
+ */
+void DiskContents::hash_contents() {
+  vector<string> paths;
+  vector<entry *> unhashed;
+  for (entry &e : contents) {
+    if (e.attrs.is_regular_file() && e.attrs.content_hash.empty()) {
+      paths.push_back(mount_point + entry_path(e));
+      unhashed.push_back(&e);
+    }
+  }
+  vector<Fingerprint> hashes;
+  vector<bool> ok;
+  const unsigned int threads =
+    std::min(std::thread::hardware_concurrency(), kMaxHashThreads);
+  HashFiles(paths, hashes, ok, (threads > 0) ? threads : 1);
+  for (unsigned int i = 0; i < unhashed.size(); ++i) {
+    unhashed[i]->attrs.content_hash =
+      (ok[i]) ? FingerprintToString(hashes[i]) : kUnreadableHash;
+  }
 }
 
 string DiskContents::get_mount_point() {
@@ -236,11 +346,16 @@ bool DiskContents::compare_disk_contents(DiskContents &compare_disk, ofstream &d
   string base_path = "/mnt/snapshot";
   get_contents(base_path.c_str());
 
-  if (compare_disk.mount_disk() != 0) {
-    cout << "Mounting " << compare_disk.disk_path << " failed" << endl;
+  // An oracle with a manifest was already walked and hashed.
+  const bool walk_compare_disk = !compare_disk.manifest_loaded;
+  if (walk_compare_disk) {
+    if (compare_disk.mount_disk() != 0) {
+      cout << "Mounting " << compare_disk.disk_path << " failed" << endl;
+    }
+    compare_disk.get_contents(compare_disk.get_mount_point().c_str());
+    compare_disk.hash_contents();
   }
-
-  compare_disk.get_contents(compare_disk.get_mount_point().c_str());
+  hash_contents();
 
   // Compare the size of contents
   if (contents.size() != compare_disk.contents.size()) {
@@ -249,32 +364,38 @@ bool DiskContents::compare_disk_contents(DiskContents &compare_disk, ofstream &d
     diff_file << endl << endl;
     diff_file << disk_path << " contains:" << endl;
     for (auto &i : contents) {
-      diff_file << i.first << endl;
+      diff_file << entry_path(i) << endl;
     }
     diff_file << endl;
 
     diff_file << compare_disk.disk_path << " contains:" << endl;
     for (auto &i : compare_disk.contents) {
-      diff_file << i.first << endl;
+      diff_file << compare_disk.entry_path(i) << endl;
     }
     diff_file << endl;
     retValue = false;
   }
 
-  // entry-wise comparision
+  // entry-wise comparision, merging the two sorted lists of entries
+  auto j = compare_disk.contents.begin();
   for (auto &i : contents) {
-    fileAttributes i_fa = i.second;
-    if (compare_disk.contents.find((i.first)) == compare_disk.contents.end()) {
-      diff_file << "DIFF: Missing " << i.first << endl;
+    while (j != compare_disk.contents.end() &&
+        compare_entry_paths(i, compare_disk, *j) > 0) {
+      ++j;
+    }
+    fileAttributes &i_fa = i.attrs;
+    if (j == compare_disk.contents.end() ||
+        compare_entry_paths(i, compare_disk, *j) != 0) {
+      diff_file << "DIFF: Missing " << entry_path(i) << endl;
       diff_file << "Found in " << disk_path << " only" << endl;
       diff_file << i_fa << endl << endl;
       retValue = false;
       continue;
     }
-    fileAttributes j_fa = compare_disk.contents[(i.first)];
+    fileAttributes &j_fa = j->attrs;
     if (!(i_fa.compare_dir_attr(j_fa.dir_attr)) ||
           !(i_fa.compare_stat_attr(j_fa.stat_attr))) {
-        diff_file << "DIFF: Content Mismatch " << i.first << endl << endl;
+        diff_file << "DIFF: Content Mismatch " << entry_path(i) << endl << endl;
         diff_file << disk_path << ":" << endl;
         diff_file << i_fa << endl << endl;
         diff_file << compare_disk.disk_path << ":" << endl;
@@ -284,20 +405,62 @@ bool DiskContents::compare_disk_contents(DiskContents &compare_disk, ofstream &d
     }
     // compare user data if the entry corresponds to a regular files
     if (i_fa.is_regular_file()) {
-      // check md5sum of the file contents
-      if (i_fa.compare_md5sum(j_fa.md5sum) != 0) {
-        diff_file << "DIFF : Data Mismatch of " << (i.first) << endl;
-        diff_file << disk_path << " has md5sum " << i_fa.md5sum << endl;
-        diff_file << compare_disk.disk_path << " has md5sum " << j_fa.md5sum;
+      // check the hash of the file contents
+      if (i_fa.compare_content_hash(j_fa.content_hash) != 0) {
+        diff_file << "DIFF : Data Mismatch of " << entry_path(i) << endl;
+        diff_file << disk_path << " has content hash " << i_fa.content_hash
+          << endl;
+        diff_file << compare_disk.disk_path << " has content hash "
+          << j_fa.content_hash;
         diff_file << endl << endl;
         retValue = false;
       }
     }
   }
-  compare_disk.unmount_and_delete_mount_point();
+  compare_disk.finish_compare();
   return retValue;
 }
 
+int DiskContents::ensure_mounted() {
+  if (device_mounted) {
+    return 0;
+  }
+  if (mount_disk() != 0) {
+    cout << "Mounting " << disk_path << " failed" << endl;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Stat attributes of path on this disk, from the manifest when there is one.
+ * The manifest holds lstat output for symlinks, so those are still stated on
+ * the mounted disk.
+ */
+bool DiskContents::attributes_at_path(string &path, fileAttributes &fa) {
+  if (manifest_loaded) {
+    auto e = std::lower_bound(contents.begin(), contents.end(), path,
+        [this](const entry &a, const string &b) {
+          return entry_paths.compare(a.path_offset, a.path_length, b) < 0;
+        });
+    if (e == contents.end() || entry_path(*e) != path) {
+      return false;
+    }
+    if (!S_ISLNK(e->attrs.stat_attr.st_mode)) {
+      fa = e->attrs;
+      return true;
+    }
+    ensure_mounted();
+  }
+  string full_path = mount_point + path;
+  struct stat statbuf;
+  if (stat(full_path.c_str(), &statbuf) == -1) {
+    return false;
+  }
+  fa.set_stat_attr(full_path, false);
+  return true;
+}
+
 // TODO(P.S.) Cleanup the code and pull out redundant code into separate functions
 bool DiskContents::compare_entries_at_path(DiskContents &compare_disk,
   string &path, ofstream &diff_file) {
@@ -309,7 +472,7 @@ bool DiskContents::compare_entries_at_path(DiskContents &compare_disk,
 
   string base_path = "/mnt/snapshot" + path;
 
-  if (compare_disk.mount_disk() != 0) {
+  if (!compare_disk.manifest_loaded && compare_disk.mount_disk() != 0) {
     cout << "Mounting " << compare_disk.disk_path << " failed" << endl;
   }
 
@@ -318,52 +481,48 @@ bool DiskContents::compare_entries_at_path(DiskContents &compare_disk,
 
   fileAttributes base_fa, compare_fa;
   bool failed_stat = false;
-  struct stat base_statbuf, compare_statbuf;
+  struct stat base_statbuf;
   if (stat(base_path.c_str(), &base_statbuf) == -1) {
     diff_file << "Failed stating the file " << base_path << endl;
     failed_stat = true;
   }
-  if (stat(compare_path.c_str(), &compare_statbuf) == -1) {
+  if (!compare_disk.attributes_at_path(path, compare_fa)) {
     diff_file << "Failed stating the file " << compare_path << endl;
     failed_stat = true;
   }
 
-  if (failed_stat) {
-    compare_disk.unmount_and_delete_mount_point();
-    return false;
-  }
-
-  base_fa.set_stat_attr(base_path, false);
-  compare_fa.set_stat_attr(compare_path, false);
-  if (!(base_fa.compare_stat_attr(compare_fa.stat_attr))) {
-    diff_file << "DIFF: Content Mismatch " << path << endl << endl;
-    diff_file << base_path << ":" << endl;
-    diff_file << base_fa << endl << endl;
-    diff_file << compare_path << ":" << endl;
-    diff_file << compare_fa << endl << endl;
-    compare_disk.unmount_and_delete_mount_point();
-    return false;
-  }
-
-  if (base_fa.is_regular_file()) {
-    base_fa.set_md5sum(base_path);
-    compare_fa.set_md5sum(compare_path);
-    if (base_fa.compare_md5sum(compare_fa.md5sum) != 0) {
-      diff_file << "DIFF : Data Mismatch of " << path << endl;
-      diff_file << base_path << " has md5sum " << base_fa.md5sum << endl;
-      diff_file << compare_path << " has md5sum " << compare_fa.md5sum;
-      diff_file << endl << endl;
-      compare_disk.unmount_and_delete_mount_point();
-      return false;
+  if (!failed_stat) {
+    base_fa.set_stat_attr(base_path, false);
+    if (!(base_fa.compare_stat_attr(compare_fa.stat_attr))) {
+      diff_file << "DIFF: Content Mismatch " << path << endl << endl;
+      diff_file << base_path << ":" << endl;
+      diff_file << base_fa << endl << endl;
+      diff_file << compare_path << ":" << endl;
+      diff_file << compare_fa << endl << endl;
+      retValue = false;
+    } else if (base_fa.is_regular_file()) {
+      base_fa.set_content_hash(base_path);
+      if (compare_fa.content_hash.empty()) {
+        compare_fa.set_content_hash(compare_path);
+      }
+      if (base_fa.compare_content_hash(compare_fa.content_hash) != 0) {
+        diff_file << "DIFF : Data Mismatch of " << path << endl;
+        diff_file << base_path << " has content hash " << base_fa.content_hash
+          << endl;
+        diff_file << compare_path << " has content hash "
+          << compare_fa.content_hash;
+        diff_file << endl << endl;
+        retValue = false;
+      }
     }
+  } else {
+    retValue = false;
   }
 
-  compare_disk.unmount_and_delete_mount_point();
+  compare_disk.finish_compare();
   return retValue;
 }
 
-// TODO[P.S]: Compare fixed sized segments of files,
-// to support comparing very large files.
 bool DiskContents::compare_file_contents(DiskContents &compare_disk, string path,
     int offset, int length, ofstream &diff_file) {
   bool retValue = true;
@@ -372,14 +531,14 @@ bool DiskContents::compare_file_contents(DiskContents &compare_disk, string path
   }
 
   string base_path = "/mnt/snapshot" + path;
-  if (compare_disk.mount_disk() != 0) {
-    cout << "Mounting " << compare_disk.disk_path << " failed" << endl;
+  // File data isn't in the manifest, so an oracle with one is mounted the first
+  // time its data is needed and left mounted for later checks.
+  if (compare_disk.ensure_mounted() != 0) {
     return false;
   }
   string compare_disk_mount_point(compare_disk.get_mount_point());
   string compare_path = compare_disk_mount_point + path;
 
-  fileAttributes base_fa, compare_fa;
   bool failed_stat = false;
   struct stat base_statbuf, compare_statbuf;
   if (stat(base_path.c_str(), &base_statbuf) == -1) {
@@ -392,46 +551,39 @@ bool DiskContents::compare_file_contents(DiskContents &compare_disk, string path
   }
 
   if (failed_stat) {
-    compare_disk.unmount_and_delete_mount_point();
+    compare_disk.finish_compare();
     return false;
   }
 
-  std::ifstream f1(base_path, std::ios::binary);
-  std::ifstream f2(compare_path, std::ios::binary);
-
-  if (!f1 || !f2) {
-    cout << "Error opening input file streams " << base_path  << " and ";
-    cout << compare_path << endl;
-    compare_disk.unmount_and_delete_mount_point();
-    return false;
+  const int fd1 = open(base_path.c_str(), O_RDONLY);
+  const int fd2 = open(compare_path.c_str(), O_RDONLY);
+  RangeMismatch mismatch;
+  const int res = (fd1 < 0 || fd2 < 0) ? -1 :
+    CompareFileRanges(fd1, fd2, offset, length, &mismatch);
+  if (res < 0) {
+    cout << "Error reading files " << base_path << " and " << compare_path
+      << endl;
+    retValue = false;
+  } else if (res > 0) {
+    diff_file << __func__ << " failed" << endl;
+    diff_file << "Content Mismatch of file " << path << " from ";
+    diff_file << offset << " of length " << length << endl;
+    diff_file << "First mismatch at " << mismatch.offset << ", last at "
+      << (mismatch.offset + mismatch.length - 1) << endl;
+    diff_file << base_path << " has " << hex_bytes_at(fd1, mismatch.offset)
+      << endl;
+    diff_file << compare_path << " has " << hex_bytes_at(fd2, mismatch.offset)
+      << endl;
+    retValue = false;
   }
-
-  f1.seekg(offset, std::ifstream::beg);
-  f2.seekg(offset, std::ifstream::beg);
-
-  char * buffer_f1 = new char[length + 1];
-  char * buffer_f2 = new char[length + 1];
-
-  f1.read(buffer_f1, length);
-  f2.read(buffer_f2, length);
-  f1.close();
-  f2.close();
-
-  buffer_f1[length] = '\0';
-  buffer_f2[length] = '\0';
-
-  if (strcmp(buffer_f1, buffer_f2) == 0) {
-    compare_disk.unmount_and_delete_mount_point();
-    return true;
+  if (fd1 >= 0) {
+    close(fd1);
   }
-
-  diff_file << __func__ << " failed" << endl;
-  diff_file << "Content Mismatch of file " << path << " from ";
-  diff_file << offset << " of length " << length << endl;
-  diff_file << base_path << " has " << buffer_f1 << endl;
-  diff_file << compare_path << " has " << buffer_f2 << endl;
-  compare_disk.unmount_and_delete_mount_point();
-  return false;
+  if (fd2 >= 0) {
+    close(fd2);
+  }
+  compare_disk.finish_compare();
+  return retValue;
 }
 
 bool isEmptyDirOrFile(string path) {
@@ -521,8 +673,8 @@ bool DiskContents::deleteFiles(string path, ofstream &diff_file) {
 bool DiskContents::makeFiles(string base_path, ofstream &diff_file) {
   get_contents(base_path.c_str());
   for (auto &i : contents) {
-    if (S_ISDIR((i.second).stat_attr.st_mode)) {
-      string filepath = base_path + i.first + "/" + "_dummy";
+    if (S_ISDIR((i.attrs).stat_attr.st_mode)) {
+      string filepath = base_path + entry_path(i) + "/" + "_dummy";
       int fd = open(filepath.c_str(), O_CREAT|O_RDWR);
       if (fd < 0) {
         diff_file <<  "Couldn't create file " << filepath << endl;
@@ -15,25 +15,33 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <map>
 
 namespace fs_testing {
 
+// The parts of a directory's entry in its parent that are compared.
+struct dirAttributes {
+  ino_t d_ino;
+  off_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+};
+
 class fileAttributes {
 public:
-  struct dirent dir_attr;
+  dirAttributes dir_attr;
   struct stat stat_attr;
-  std::string md5sum;
+  // Hash of the file's contents, or empty if it hasn't been hashed.
+  std::string content_hash;
 
   fileAttributes();
   ~fileAttributes();
 
-  void set_dir_attr(struct dirent* a);
+  void set_dir_attr(const struct dirent64 *a);
   void set_stat_attr(std::string path, bool islstat);
-  void set_md5sum(std::string filepath);
-  bool compare_dir_attr(struct dirent a);
+  void set_content_hash(std::string filepath);
+  bool compare_dir_attr(dirAttributes a);
   bool compare_stat_attr(struct stat a);
-  bool compare_md5sum(std::string a);
+  bool compare_content_hash(std::string a);
   bool is_regular_file();
 };
 
@@ -55,15 +63,39 @@ public:
   bool deleteFiles(std::string path, std::ofstream &diff_file);
   bool makeFiles(std::string base_path, std::ofstream &diff_file);
   bool sanity_checks(std::ofstream &diff_file);
+  // Mounts the disk and records the path, stat fields and content hash of
+  // everything on it. Comparisons against this disk then use that manifest
+  // instead of mounting and walking the disk again. The disk stays mounted, for
+  // comparisons that need file data, until release_mount is called.
+  int load_manifest();
+  void release_mount();
 
 private:
   bool device_mounted;
+  bool manifest_loaded;
   std::string disk_path;
   std::string mount_point;
   std::string fs_type;
-  std::map<std::string, fileAttributes> contents;
+  // An entry found by get_contents. Its path, relative to the mount point, is
+  // stored in entry_paths.
+  struct entry {
+    std::size_t path_offset;
+    std::size_t path_length;
+    fileAttributes attrs;
+  };
+  // Sorted by path, so two disks can be compared with a single merge.
+  std::vector<entry> contents;
+  std::string entry_paths;
   void compare_contents(DiskContents &compare_disk, std::ofstream &diff_file);
   void get_contents(const char* path);
+  void walk_directory(int dir_fd, std::string &relative_path);
+  std::string entry_path(const entry &e) const;
+  int compare_entry_paths(const entry &a, const DiskContents &b_disk,
+      const entry &b) const;
+  void hash_contents();
+  int ensure_mounted();
+  void finish_compare();
+  bool attributes_at_path(std::string &path, fileAttributes &fa);
 };
 
 } // namespace fs_testing
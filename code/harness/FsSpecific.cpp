@@ -26,6 +26,8 @@ constexpr char kExtNewUUIDCommand[] = "tune2fs -U random ";
 constexpr char kBtrfsNewUUIDCommand[] = "yes | btrfstune -u ";
 constexpr char kXfsNewUUIDCommand[] = "xfs_admin -U generate ";
 constexpr char kF2fsNewUUIDCommand[] = ":";
+
+constexpr char kXfsDuplicateMntOpts[] = "nouuid";
 }
 
 
@@ -80,6 +82,11 @@ string ExtFsSpecific::GetNewUUIDCommand(const string &disk_path) {
   return string(kExtNewUUIDCommand) + disk_path;
 }
 
+bool ExtFsSpecific::GetDuplicateMntOpts(string &opts) {
+  opts.clear();
+  return true;
+}
+
 FileSystemTestResult::ErrorType ExtFsSpecific::GetFsckReturn(
     int return_code) {
   // The following is taken from the specification in man(8) fsck.ext4.
@@ -132,6 +139,12 @@ string BtrfsFsSpecific::GetNewUUIDCommand(const string &disk_path) {
   return string(kBtrfsNewUUIDCommand) + disk_path;
 }
 
+bool BtrfsFsSpecific::GetDuplicateMntOpts(string &opts) {
+  // btrfs treats devices with the same fsid as parts of one file system.
+  opts.clear();
+  return false;
+}
+
 FileSystemTestResult::ErrorType BtrfsFsSpecific::GetFsckReturn(
     int return_code) {
   // The following is taken from the specification in man(8) btrfs-check.
@@ -174,6 +187,11 @@ string F2fsFsSpecific::GetNewUUIDCommand(const string &disk_path) {
   return string(kF2fsNewUUIDCommand);
 }
 
+bool F2fsFsSpecific::GetDuplicateMntOpts(string &opts) {
+  opts.clear();
+  return true;
+}
+
 FileSystemTestResult::ErrorType F2fsFsSpecific::GetFsckReturn(
     int return_code) {
   // The following is taken from the specification in man(8) fsck.f2fs.
@@ -217,6 +235,11 @@ string XfsFsSpecific::GetNewUUIDCommand(const string &disk_path) {
   return string(kXfsNewUUIDCommand) + disk_path;
 }
 
+bool XfsFsSpecific::GetDuplicateMntOpts(string &opts) {
+  opts = kXfsDuplicateMntOpts;
+  return true;
+}
+
 FileSystemTestResult::ErrorType XfsFsSpecific::GetFsckReturn(
     int return_code) {
   if (return_code == 0) {
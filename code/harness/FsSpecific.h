@@ -45,6 +45,13 @@ class FsSpecific {
    */
   virtual std::string GetNewUUIDCommand(const std::string &disk_path) = 0;
 
+  /*
+   * Sets opts to the arguments (to be passed to mount(2)) needed to mount a
+   * copy of the file system while another copy with the same uuid is mounted.
+   * Returns false if copies of the file system can't be mounted at once.
+   */
+  virtual bool GetDuplicateMntOpts(std::string &opts) = 0;
+
   /*
    * Returns an enum representing the exit status of the file system specific
    * file system checker used. Takes as an argument the return value that was
@@ -67,6 +74,7 @@ class ExtFsSpecific : public FsSpecific {
   virtual std::string GetPostReplayMntOpts();
   virtual std::string GetFsckCommand(const std::string &fs_path);
   virtual std::string GetNewUUIDCommand(const std::string &disk_path);
+  virtual bool GetDuplicateMntOpts(std::string &opts);
   virtual fs_testing::FileSystemTestResult::ErrorType GetFsckReturn(
       int return_code);
   virtual unsigned int GetPostRunDelaySeconds() override;
@@ -131,6 +139,7 @@ class BtrfsFsSpecific : public FsSpecific {
   virtual std::string GetPostReplayMntOpts();
   virtual std::string GetFsckCommand(const std::string &fs_path);
   virtual std::string GetNewUUIDCommand(const std::string &disk_path);
+  virtual bool GetDuplicateMntOpts(std::string &opts);
   virtual fs_testing::FileSystemTestResult::ErrorType GetFsckReturn(
       int return_code);
   virtual unsigned int GetPostRunDelaySeconds() override;
@@ -154,6 +163,7 @@ class F2fsFsSpecific : public FsSpecific {
   virtual std::string GetPostReplayMntOpts();
   virtual std::string GetFsckCommand(const std::string &fs_path);
   virtual std::string GetNewUUIDCommand(const std::string &disk_path);
+  virtual bool GetDuplicateMntOpts(std::string &opts);
   virtual fs_testing::FileSystemTestResult::ErrorType GetFsckReturn(
       int return_code);
   virtual unsigned int GetPostRunDelaySeconds() override;
@@ -180,6 +190,7 @@ class XfsFsSpecific : public FsSpecific {
   virtual std::string GetPostReplayMntOpts();
   virtual std::string GetFsckCommand(const std::string &fs_path);
   virtual std::string GetNewUUIDCommand(const std::string &disk_path);
+  virtual bool GetDuplicateMntOpts(std::string &opts);
   virtual fs_testing::FileSystemTestResult::ErrorType GetFsckReturn(
       int return_code);
   virtual unsigned int GetPostRunDelaySeconds() override;
@@ -1,10 +1,13 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <cassert>
@@ -24,6 +27,9 @@
 #include "FsSpecific.h"
 #include "Tester.h"
 #include "../disk_wrapper_ioctl.h"
+#include "../utils/DiskSnapshot.h"
+#include "../utils/FileHash.h"
+#include "../utils/ProfileLog.h"
 #include "DiskContents.h"
 
 #define TEST_CLASS_FACTORY        "test_case_get_instance"
@@ -35,6 +41,13 @@
 #define DROP_CACHES_PATH       "/proc/sys/vm/drop_caches"
 
 #define FULL_WRAPPER_PATH "/dev/hwm"
+// Size of the buffers the disk_wrapper log is drained into.
+#define LOG_BATCH_SIZE    (4 * 1024 * 1024)
+// How often the disk_wrapper log is polled while waiting for writeback.
+#define QUIESCE_POLL_MS   100
+// How often the disk_wrapper log is drained to disk while logging.
+#define LOG_DRAIN_POLL_MS 50
+#define LOG_SPILL_PREFIX  "crashmonkey_log_"
 
 // TODO(ashmrtn): Make a quiet and regular version of commands.
 // TODO(ashmrtn): Make so that commands work with user given device path.
@@ -51,6 +64,8 @@
 #define WRAPPER_MODULE_NAME "../build/disk_wrapper.ko"
 #define WRAPPER_INSMOD      "insmod " WRAPPER_MODULE_NAME " target_device_path="
 #define WRAPPER_INSMOD2      " flags_device_path="
+#define WRAPPER_INSMOD3      " max_log_mb="
+#define WRAPPER_MAX_LOG_PARAM "/sys/module/disk_wrapper/parameters/max_log_mb"
 #define WRAPPER_RMMOD       "rmmod " WRAPPER_MODULE_NAME
 
 #define COW_BRD_MODULE_NAME "../build/cow_brd.ko"
@@ -59,7 +74,13 @@
 #define COW_BRD_INSMOD3      " disk_size="
 #define COW_BRD_RMMOD       "rmmod " COW_BRD_MODULE_NAME
 #define NUM_DISKS           "1"
-#define NUM_SNAPSHOTS       "20"
+#define NUM_SNAPSHOTS       20
+// Snapshot reserved for holding the epochs shared by a group of crash states.
+// It comes after the NUM_SNAPSHOTS checkpoints can use so it never holds an
+// oracle.
+#define PREFIX_SNAPSHOT     (NUM_SNAPSHOTS + 1)
+// Snapshot the workload is profiled on and crash states are later built on.
+#define WORKLOAD_SNAPSHOT   1
 #define COW_BRD_PATH        "/dev/cow_ram0"
 
 #define DEV_SECTORS_PATH    "/sys/block/"
@@ -67,6 +88,11 @@
 
 #define SECTOR_SIZE 512
 
+#ifndef FIFREEZE
+#define FIFREEZE _IOWR('X', 119, int)
+#define FITHAW   _IOWR('X', 120, int)
+#endif
+
 namespace fs_testing {
 
 using std::calloc;
@@ -97,14 +123,21 @@ using fs_testing::permuter::permuter_destroy_t;
 using fs_testing::utils::disk_write;
 using fs_testing::utils::DiskMod;
 using fs_testing::utils::DiskWriteData;
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintBuilder;
+using fs_testing::utils::ProfileLogWriter;
 
 Tester::Tester(const unsigned int dev_size, const unsigned int sector_size,
     const bool verbosity)
   : device_size(dev_size), sector_size_(sector_size), verbose(verbosity) {
   snapshot_path_ = "/dev/cow_ram_snapshot1_0";
+  mount_point_ = MNT_MNT_POINT;
+  // Crash states are only ever written to cow_brd devices.
+  extent_writer_.EnableExtentIoctl();
 }
 
 Tester::~Tester() {
+  stop_log_drain();
   if (fs_specific_ops_ != NULL) {
     delete fs_specific_ops_;
   }
@@ -125,6 +158,22 @@ void Tester::set_flag_device(const std::string device_path) {
   flags_device = device_path;
 }
 
+void Tester::set_jobs(const unsigned int jobs) {
+  jobs_ = (jobs > 0) ? jobs : 1;
+}
+
+void Tester::set_quiesce_window(const unsigned int window_ms) {
+  quiesce_window_ms_ = window_ms;
+}
+
+void Tester::set_image_cache(const string dir) {
+  image_cache_dir_ = dir;
+}
+
+void Tester::set_max_log_mb(const unsigned int max_log_mb) {
+  max_log_mb_ = max_log_mb;
+}
+
 void Tester::StartTestSuite() {
   // Construct a new element at the end of our vector.
   test_results_.emplace_back();
@@ -135,6 +184,14 @@ void Tester::EndTestSuite() {
   current_test_suite_ = NULL;
 }
 
+unsigned int Tester::GetNumFailed() const {
+  unsigned int failed = 0;
+  for (const auto& suite : test_results_) {
+    failed += suite.GetFailed();
+  }
+  return failed;
+}
+
 unsigned int Tester::GetPostRunDelay() {
   return fs_specific_ops_->GetPostRunDelaySeconds();
 }
@@ -167,6 +224,64 @@ int Tester::clone_device_restore(int snapshot_fd, bool reread) {
   return SUCCESS;
 }
 
+int Tester::clone_device_restore_from(int snapshot_fd,
+    unsigned int source_snapshot) {
+  if (ioctl(snapshot_fd, COW_BRD_RESTORE_FROM_SNAPSHOT, source_snapshot) < 0) {
+    return DRIVE_CLONE_RESTORE_ERR;
+  }
+  return SUCCESS;
+}
+
+int Tester::clone_device_chain(int snapshot_fd,
+    unsigned int parent_snapshot) {
+  if (ioctl(snapshot_fd, COW_BRD_SET_PARENT, parent_snapshot) < 0) {
+    return DRIVE_CLONE_RESTORE_ERR;
+  }
+  return SUCCESS;
+}
+
+/*
+ * Path of the given snapshot of the disk snapshot_path_ belongs to.
+ */
+string Tester::snapshot_device_path(unsigned int snapshot) {
+  string res = "/dev/cow_ram_snapshot";
+  res += to_string(snapshot);
+  res += snapshot_path_.substr(snapshot_path_.rfind('_'));
+  return res;
+}
+
+/*
+ * Write [start, end) to the snapshot reserved for crash state prefixes,
+ * restoring it first if `restore` is set.
+ */
+int Tester::update_prefix_snapshot(
+    const vector<DiskWriteData>::iterator &start,
+    const vector<DiskWriteData>::iterator &end, bool restore) {
+  const string prefix_path = snapshot_device_path(PREFIX_SNAPSHOT);
+  const int prefix_fd = open(prefix_path.c_str(), O_WRONLY | O_DIRECT);
+  if (prefix_fd < 0) {
+    return DRIVE_CLONE_PREFIX_ERR;
+  }
+
+  if (restore) {
+    time_point<steady_clock> snapshot_start_time = steady_clock::now();
+    if (clone_device_restore(prefix_fd, false) != SUCCESS) {
+      close(prefix_fd);
+      return DRIVE_CLONE_PREFIX_ERR;
+    }
+    timing_stats[SNAPSHOT_TIME] +=
+      duration_cast<milliseconds>(steady_clock::now() - snapshot_start_time);
+  }
+
+  time_point<steady_clock> bio_write_start_time = steady_clock::now();
+  const bool write_res = test_write_data(prefix_fd, start, end);
+  timing_stats[BIO_WRITE_TIME] +=
+    duration_cast<milliseconds>(steady_clock::now() - bio_write_start_time);
+  close(prefix_fd);
+
+  return (write_res) ? SUCCESS : DRIVE_CLONE_PREFIX_ERR;
+}
+
 int Tester::mount_device_raw(const char* opts) {
   if (device_mount.empty()) {
     return MNT_BAD_DEV_ERR;
@@ -183,7 +298,7 @@ int Tester::mount_wrapper_device(const char* opts) {
 }
 
 int Tester::mount_device(const char* dev, const char* opts) {
-  if (mount(dev, MNT_MNT_POINT, fs_type.c_str(), 0, (void*) opts) < 0) {
+  if (mount(dev, mount_point_.c_str(), fs_type.c_str(), 0, (void*) opts) < 0) {
     disk_mounted = false;
     return MNT_MNT_ERR;
   }
@@ -193,7 +308,7 @@ int Tester::mount_device(const char* dev, const char* opts) {
 
 int Tester::umount_device() {
   if (disk_mounted) {
-    if (umount(MNT_MNT_POINT) < 0) {
+    if (umount(mount_point_.c_str()) < 0) {
       disk_mounted = true;
       return MNT_UMNT_ERR;
     }
@@ -203,14 +318,15 @@ int Tester::umount_device() {
 }
 
 int Tester::mount_snapshot() {
-  if (mount(snapshot_path_.c_str(), MNT_MNT_POINT, fs_type.c_str(), 0, NULL) < 0) {
+  if (mount(snapshot_path_.c_str(), mount_point_.c_str(), fs_type.c_str(), 0,
+        NULL) < 0) {
     return MNT_MNT_ERR;
   }
   return SUCCESS;
 }
 
 int Tester::umount_snapshot() {
-  if (umount(MNT_MNT_POINT) < 0) {
+  if (umount(mount_point_.c_str()) < 0) {
     return MNT_UMNT_ERR;
   }
   return SUCCESS;
@@ -225,23 +341,82 @@ int Tester::mapCheckpointToSnapshot(int checkpoint) {
   return 0;
 }
 
-int Tester::getNewDiskClone(int checkpoint) {
-  string new_snapshot_path;
-  string path(snapshot_path_);
-  string device_number = path.substr(path.rfind('_'));
-  string snapshot_number = to_string(checkpoint + 2);
-  new_snapshot_path = "/dev/cow_ram_snapshot";
-  new_snapshot_path += snapshot_number;
-  new_snapshot_path += device_number;
-  // Finally set snapshot_path_ to the new snapshot path
-  snapshot_path_ = new_snapshot_path;
-  string command = fs_specific_ops_->GetNewUUIDCommand(new_snapshot_path);
+void Tester::getCompleteRunDiskClone() {
+  snapshot_path_ = checkpointToSnapshot_[0];
+}
+
+int Tester::begin_oracle_run() {
+  // The workload runs on the snapshot it was profiled on, starting over from
+  // the base image.
+  const int snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+  if (snapshot_fd < 0) {
+    return DRIVE_CLONE_ERR;
+  }
+  const int res = clone_device_restore(snapshot_fd, false);
+  close(snapshot_fd);
+  if (res != SUCCESS) {
+    return res;
+  }
+  // Copies of the oracle file system get mounted next to crash states built on
+  // this same snapshot, which some file systems won't do if the UUIDs match.
+  string command = fs_specific_ops_->GetNewUUIDCommand(snapshot_path_);
   system(command.c_str());
-  return 0;
+  if (mount_snapshot() != SUCCESS) {
+    return MNT_MNT_ERR;
+  }
+  oracle_checkpoint_ = 0;
+  return SUCCESS;
 }
 
-void Tester::getCompleteRunDiskClone() {
-  snapshot_path_ = checkpointToSnapshot_[0];
+/*
+ * Copy the file system as it is at the checkpoint the oracle run just reached
+ * into the next free snapshot. Freezing the file system flushes everything
+ * the workload has done so far and holds off new writes while it is copied.
+ */
+int Tester::freeze_oracle_checkpoint() {
+  const int checkpoint = oracle_checkpoint_ + 1;
+  // Checkpoint n goes in snapshot n + 1, after the workload snapshot.
+  const unsigned int snapshot = checkpoint + 1;
+  if (snapshot > NUM_SNAPSHOTS) {
+    cerr << "no snapshot left for checkpoint " << checkpoint << endl;
+    return DRIVE_CLONE_ERR;
+  }
+  const string path = snapshot_device_path(snapshot);
+  const int snapshot_fd = open(path.c_str(), O_WRONLY);
+  if (snapshot_fd < 0) {
+    return DRIVE_CLONE_ERR;
+  }
+  const int mount_fd = open(mount_point_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (mount_fd < 0) {
+    close(snapshot_fd);
+    return DRIVE_CLONE_ERR;
+  }
+
+  int res = DRIVE_CLONE_ERR;
+  if (ioctl(mount_fd, FIFREEZE, 0) == 0) {
+    res = clone_device_restore_from(snapshot_fd, WORKLOAD_SNAPSHOT);
+    ioctl(mount_fd, FITHAW, 0);
+  } else {
+    cerr << "error freezing file system at checkpoint " << checkpoint << endl;
+  }
+  close(mount_fd);
+  close(snapshot_fd);
+  if (res != SUCCESS) {
+    return res;
+  }
+
+  oracle_checkpoint_ = checkpoint;
+  checkpointToSnapshot_[checkpoint] = path;
+  std::cout << "Mapping " << path << " to checkpoint " << checkpoint << std::endl;
+  return SUCCESS;
+}
+
+int Tester::end_oracle_run() {
+  oracle_checkpoint_ = -1;
+  if (umount_snapshot() != SUCCESS) {
+    return MNT_UMNT_ERR;
+  }
+  return SUCCESS;
 }
 
 int Tester::insert_cow_brd() {
@@ -249,7 +424,9 @@ int Tester::insert_cow_brd() {
     string command(COW_BRD_INSMOD);
     command += NUM_DISKS;
     command += COW_BRD_INSMOD2;
-    command += NUM_SNAPSHOTS;
+    // Check workers past the first each need a snapshot of their own, which
+    // come after the prefix snapshot.
+    command += to_string(PREFIX_SNAPSHOT + jobs_ - 1);
     command += COW_BRD_INSMOD3;
     command += std::to_string(device_size);
     if (!verbose) {
@@ -312,6 +489,9 @@ int Tester::insert_wrapper() {
     command += "/dev/cow_ram_snapshot1_0";
     command += WRAPPER_INSMOD2;
     command += flags_device;
+    if (max_log_mb_ > 0) {
+      command += WRAPPER_INSMOD3 + to_string(max_log_mb_);
+    }
     if (!verbose) {
       command += SILENT;
     }
@@ -360,27 +540,246 @@ int Tester::get_wrapper_ioctl() {
 }
 
 void Tester::put_wrapper_ioctl() {
+  stop_log_drain();
   if (ioctl_fd != -1) {
     close(ioctl_fd);
     ioctl_fd = -1;
   }
 }
 
+namespace {
+
+// Lets bios the wrapper is holding back go ahead when nothing will drain the
+// log for them.
+void DisableLogLimit() {
+  ofstream param(WRAPPER_MAX_LOG_PARAM);
+  param << 0 << endl;
+}
+
+}  // namespace
+
 void Tester::begin_wrapper_logging() {
   if (ioctl_fd != -1) {
     ioctl(ioctl_fd, HWM_LOG_ON);
+    if (max_log_mb_ > 0 && !log_drain_thread_.joinable()) {
+      log_spill_path_ = LOG_SPILL_PREFIX + to_string(getpid()) + ".spill";
+      log_spill_.reset(new ProfileLogWriter(false));
+      if (log_spill_->Open(log_spill_path_)) {
+        log_drain_stop_ = false;
+        log_drain_ok_ = true;
+        log_drain_thread_ = std::thread(&Tester::spill_wrapper_log, this);
+      } else {
+        cerr << "error opening " << log_spill_path_ << ", not limiting log "
+          "size" << endl;
+        log_spill_.reset();
+        DisableLogLimit();
+      }
+    }
+  }
+}
+
+/*
+ * Runs on log_drain_thread_, moving batches of log entries out of the wrapper
+ * and into log_spill_ until told to stop. The log is drained once more after
+ * that, so nothing logged before HWM_LOG_OFF is left behind.
+ */
+void Tester::spill_wrapper_log() {
+  size_t batch_size = LOG_BATCH_SIZE;
+  while (true) {
+    const bool last_pass = log_drain_stop_;
+    while (true) {
+      shared_ptr<char> arena(new char[batch_size], [](char* c) {delete[] c;});
+      disk_write_log_batch batch;
+      batch.buf = (unsigned long long) arena.get();
+      batch.buf_size = batch_size;
+      batch.num_entries = 0;
+      batch.used = 0;
+      batch.next_size = 0;
+      if (ioctl(ioctl_fd, HWM_DRAIN_LOG_BATCH, &batch) == -1) {
+        if (errno == ENODATA) {
+          break;
+        } else if (errno == ENOSPC) {
+          batch_size = batch.next_size;
+          continue;
+        }
+        log_drain_ok_ = false;
+        DisableLogLimit();
+        return;
+      }
+      vector<disk_write> entries;
+      if (!disk_write::deserialize_batch(arena, batch.used, batch.num_entries,
+            entries)) {
+        log_drain_ok_ = false;
+        DisableLogLimit();
+        return;
+      }
+      for (disk_write &entry : entries) {
+        if (!log_spill_->Append(entry)) {
+          log_drain_ok_ = false;
+          DisableLogLimit();
+          return;
+        }
+      }
+      batch_size = LOG_BATCH_SIZE;
+    }
+    if (last_pass) {
+      return;
+    }
+    usleep(LOG_DRAIN_POLL_MS * 1000);
+  }
+}
+
+void Tester::stop_log_drain() {
+  if (!log_drain_thread_.joinable()) {
+    return;
   }
+  log_drain_stop_ = true;
+  log_drain_thread_.join();
+  log_spill_.reset();
+  unlink(log_spill_path_.c_str());
 }
 
 void Tester::end_wrapper_logging() {
   if (ioctl_fd != -1) {
     ioctl(ioctl_fd, HWM_LOG_OFF);
+    // Older wrappers don't keep stats, in which case none are printed.
+    struct disk_write_log_stats stats;
+    if (ioctl(ioctl_fd, HWM_GET_LOG_STATS, &stats) == 0) {
+      logged_bios_ = stats.entries;
+      logged_bytes_ = stats.data_bytes;
+      logging_overhead_ns_ = stats.overhead_ns;
+      logging_arena_misses_ = stats.arena_misses;
+      logging_throttle_ns_ = stats.throttle_ns;
+    }
   }
 }
 
+/*
+ * Instead of always sleeping for the file system's post-run delay, sync the
+ * file system so nothing is left waiting for periodic writeback, then wait
+ * until the wrapper hasn't logged a bio for quiesce_window_ms_. The post-run
+ * delay is still the most this waits, so file systems that keep writing, or
+ * wrappers without HWM_GET_LOG_COUNT, wait as long as they used to.
+ */
+milliseconds Tester::wait_for_writeback() {
+  const time_point<steady_clock> start_time = steady_clock::now();
+  const milliseconds max_delay(GetPostRunDelay() * 1000);
+  unsigned long long logged;
+  if (max_delay.count() == 0) {
+    return milliseconds(0);
+  }
+  if (quiesce_window_ms_ == 0 || ioctl_fd == -1 ||
+      ioctl(ioctl_fd, HWM_GET_LOG_COUNT, &logged) < 0) {
+    unsigned int sleep_time = GetPostRunDelay();
+    while (sleep_time > 0) {
+      sleep_time = sleep(sleep_time);
+    }
+    timing_stats[WRITEBACK_TIME] += max_delay;
+    return max_delay;
+  }
+
+  const int mount_fd = open(mount_point_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (mount_fd >= 0) {
+    syncfs(mount_fd);
+    close(mount_fd);
+  }
+
+  time_point<steady_clock> last_write = steady_clock::now();
+  while (true) {
+    usleep(QUIESCE_POLL_MS * 1000);
+    const time_point<steady_clock> now = steady_clock::now();
+    unsigned long long current;
+    if (ioctl(ioctl_fd, HWM_GET_LOG_COUNT, &current) < 0) {
+      // Can't tell, so assume the file system is still writing.
+      current = logged + 1;
+    }
+    if (current != logged) {
+      logged = current;
+      last_write = now;
+    }
+    if (now - last_write >= milliseconds(quiesce_window_ms_) ||
+        now - start_time >= max_delay) {
+      break;
+    }
+  }
+
+  const milliseconds waited =
+    duration_cast<milliseconds>(steady_clock::now() - start_time);
+  timing_stats[WRITEBACK_TIME] += waited;
+  return waited;
+}
+
 int Tester::get_wrapper_log() {
   if (ioctl_fd != -1) {
+    const size_t first_log_entry = log_data.size();
+    const bool drained = log_drain_thread_.joinable();
+    // Whatever was drained while logging comes first. Wrappers without
+    // HWM_DRAIN_LOG_BATCH stop the drain before it gets anything, in which case
+    // the whole log is still in the wrapper.
+    if (log_drain_thread_.joinable()) {
+      log_drain_stop_ = true;
+      log_drain_thread_.join();
+      const uint64_t spilled = log_spill_->GetNumRecords();
+      const bool saved = log_spill_->Close() && log_drain_ok_;
+      log_spill_.reset();
+      if (spilled > 0 && (!saved ||
+            !fs_testing::utils::LoadProfileLog(log_spill_path_, log_data))) {
+        cerr << "error reading log entries drained to " << log_spill_path_ <<
+          endl;
+        unlink(log_spill_path_.c_str());
+        log_data.clear();
+        return WRAPPER_DATA_ERR;
+      }
+      unlink(log_spill_path_.c_str());
+      for (size_t i = first_log_entry; i < log_data.size(); ++i) {
+        block_store_.Add(log_data[i]);
+      }
+    }
+
+    // Drain the log in large batches, each parsed in place into its own arena.
+    // Modules without HWM_GET_LOG_BATCH fall back to one entry at a time. Data
+    // drained from the wrapper is moved into block_store_, so each arena is
+    // freed as soon as its batch is parsed and repeated blocks are kept once.
+    size_t batch_size = LOG_BATCH_SIZE;
+    bool batched = true;
     while (1) {
+      shared_ptr<char> arena(new char[batch_size], [](char* c) {delete[] c;});
+      disk_write_log_batch batch;
+      batch.buf = (unsigned long long) arena.get();
+      batch.buf_size = batch_size;
+      batch.num_entries = 0;
+      batch.used = 0;
+      batch.next_size = 0;
+      int result = ioctl(ioctl_fd, HWM_GET_LOG_BATCH, &batch);
+      if (result == -1) {
+        if (errno == ENODATA) {
+          break;
+        } else if (errno == ENOSPC) {
+          // A single entry larger than the arena.
+          batch_size = batch.next_size;
+          continue;
+        } else if (errno == EINVAL || errno == ENOTTY) {
+          batched = false;
+          break;
+        }
+        cerr << "error draining log entries\n";
+        log_data.clear();
+        return WRAPPER_DATA_ERR;
+      }
+      const size_t first_entry = log_data.size();
+      if (!disk_write::deserialize_batch(arena, batch.used, batch.num_entries,
+            log_data)) {
+        cerr << "malformed batch of log entries\n";
+        log_data.clear();
+        return WRAPPER_DATA_ERR;
+      }
+      for (size_t i = first_entry; i < log_data.size(); ++i) {
+        block_store_.Add(log_data[i]);
+      }
+      batch_size = LOG_BATCH_SIZE;
+    }
+
+    while (!batched) {
       disk_write_op_meta meta;
 
       int result = ioctl(ioctl_fd, HWM_GET_LOG_META, &meta);
@@ -410,6 +809,7 @@ int Tester::get_wrapper_log() {
       }
       log_data.emplace_back(meta, data);
       delete[] data;
+      block_store_.Add(log_data.back());
 
       result = ioctl(ioctl_fd, HWM_NEXT_ENT);
       if (result == -1) {
@@ -424,6 +824,25 @@ int Tester::get_wrapper_log() {
         }
       }
     }
+
+    // A checkpoint logged while the drain had emptied the log must still make
+    // it out, or every later checkpoint number is off by one. The default
+    // checkpoint at the start of the log has sector 0 and isn't counted.
+    if (drained) {
+      unsigned int checkpoints = 0;
+      for (size_t i = first_log_entry; i < log_data.size(); ++i) {
+        if (log_data[i].is_checkpoint() &&
+            log_data[i].metadata.write_sector > 0) {
+          ++checkpoints;
+        }
+      }
+      if (checkpoints != logged_checkpoints_) {
+        cerr << "drained log has " << checkpoints << " checkpoints but " <<
+          logged_checkpoints_ << " were made" << endl;
+        log_data.clear();
+        return WRAPPER_DATA_ERR;
+      }
+    }
   }
   std::cout << "fetched " << log_data.size() << " log data entries"
       << std::endl;
@@ -431,6 +850,7 @@ int Tester::get_wrapper_log() {
 }
 
 void Tester::clear_wrapper_log() {
+  logged_checkpoints_ = 0;
   if (ioctl_fd != -1) {
     ioctl(ioctl_fd, HWM_CLR_LOG);
   }
@@ -490,10 +910,14 @@ int Tester::GetChangeData(const int fd) {
 }
 
 int Tester::CreateCheckpoint() {
+  if (oracle_checkpoint_ >= 0) {
+    return freeze_oracle_checkpoint();
+  }
   if (ioctl_fd == -1) {
     return WRAPPER_DATA_ERR;
   }
   if (ioctl(ioctl_fd, HWM_CHECKPOINT) == 0) {
+    ++logged_checkpoints_;
     return SUCCESS;
   }
   return WRAPPER_DATA_ERR;
@@ -596,17 +1020,61 @@ int Tester::wipe_partitions() {
   return SUCCESS;
 }
 
+/*
+ * Cached images are named after the file system type and a hash of everything
+ * that goes into formatting the disk, so a change to any of them misses.
+ */
+string Tester::formatted_image_path(const string &mkfs_command) {
+  const string key = mkfs_command + "\n" + to_string(device_size) + "\n" +
+    to_string(sector_size_);
+  return image_cache_dir_ + "/" + fs_type + "-" +
+    fs_testing::utils::FingerprintToString(
+        fs_testing::utils::HashBytes(key.data(), key.size()));
+}
+
 int Tester::format_drive() {
   if (device_raw.empty()) {
     return PART_PART_ERR;
   }
   string command = fs_specific_ops_->GetMkfsCommand(device_mount);
+  string image_path;
+  if (!image_cache_dir_.empty()) {
+    image_path = formatted_image_path(command);
+    if (access(image_path.c_str(), R_OK) == 0) {
+      if (load_disk_image(image_path) == SUCCESS) {
+        std::cout << "loaded formatted disk from " << image_path << endl;
+        return SUCCESS;
+      }
+      cerr << "error loading formatted disk from " << image_path
+        << ", running mkfs" << endl;
+    }
+  }
+
   if (!verbose) {
     command += SILENT;
   }
   if (system(command.c_str()) != 0) {
     return FMT_FMT_ERR;
   }
+
+  if (!image_path.empty()) {
+    // Saved under a temporary name and renamed so a partly written image is
+    // never picked up.
+    const string tmp_path = image_path + ".tmp." + to_string(getpid());
+    const uint64_t dev_bytes = (uint64_t) device_size * 2 * 512;
+    fs_testing::utils::DiskSnapshotStats stats;
+    if (mkdir(image_cache_dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+      cerr << "error creating image cache " << image_cache_dir_ << endl;
+    } else if (!fs_testing::utils::SaveDiskSnapshot(cow_brd_fd, dev_bytes,
+          tmp_path, &stats) ||
+        rename((tmp_path + ".pages").c_str(),
+          (image_path + ".pages").c_str()) < 0 ||
+        rename(tmp_path.c_str(), image_path.c_str()) < 0) {
+      cerr << "error saving formatted disk to " << image_path << endl;
+      unlink(tmp_path.c_str());
+      unlink((tmp_path + ".pages").c_str());
+    }
+  }
   return SUCCESS;
 }
 
@@ -615,6 +1083,7 @@ int Tester::test_setup() {
 }
 
 int Tester::test_init_values(string mount_dir, long filesys_size) {
+  filesys_size_ = filesys_size;
   return test_loader.get_instance()->init_values(mount_dir, filesys_size);
 }
 
@@ -641,12 +1110,23 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
     const string device_path, const unsigned int last_checkpoint,
     SingleTestInfo &test_info, bool automate_check_test) {
   vector<milliseconds> res(3, duration<int, std::milli>(-1));
+  // Check workers each mount a copy of the same file system, so they all have
+  // the same uuid.
+  string duplicate_opts;
+  if (jobs_ > 1) {
+    fs_specific_ops_->GetDuplicateMntOpts(duplicate_opts);
+  }
+  string replay_opts = fs_specific_ops_->GetPostReplayMntOpts();
+  if (!replay_opts.empty() && !duplicate_opts.empty()) {
+    replay_opts += ",";
+  }
+  replay_opts += duplicate_opts;
+
   // Try mounting the file system so that the kernel can clean up orphan lists
   // and anything else it may need to so that fsck does a better job later if
   // we run it.
   time_point<steady_clock> mount_start_time = steady_clock::now();
-  if (mount_device(device_path.c_str(),
-        fs_specific_ops_->GetPostReplayMntOpts().c_str()) != SUCCESS) {
+  if (mount_device(device_path.c_str(), replay_opts.c_str()) != SUCCESS) {
     test_info.fs_test.SetError(FileSystemTestResult::kKernelMount);
   }
   time_point<steady_clock> mount_end_time = steady_clock::now();
@@ -704,7 +1184,9 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
     // TODO(ashmrtn): Consider mounting with options specified for test
     // profile?
     mount_start_time = steady_clock::now();
-    if (mount_device(device_path.c_str(), NULL) != SUCCESS) {
+    if (mount_device(device_path.c_str(),
+          (duplicate_opts.empty()) ? NULL : duplicate_opts.c_str())
+        != SUCCESS) {
       test_info.fs_test.SetError(FileSystemTestResult::kUnmountable);
       return res;
     }
@@ -750,6 +1232,41 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
   return res;
 }
 
+/*
+ * The oracle for a checkpoint doesn't change during a run, so it is walked and
+ * hashed once and the result reused for every crash state at that checkpoint.
+ * All oracles share a UUID, so only one is left mounted at a time. Returns NULL
+ * if the oracle couldn't be read, in which case callers compare against the
+ * snapshot directly.
+ */
+DiskContents *Tester::get_oracle_manifest(int checkpoint) {
+  auto cached = oracle_manifests_.find(checkpoint);
+  if (cached != oracle_manifests_.end()) {
+    for (auto &manifest : oracle_manifests_) {
+      if (manifest.first != checkpoint) {
+        manifest.second->release_mount();
+      }
+    }
+    return cached->second.get();
+  }
+
+  release_oracle_mounts();
+  std::unique_ptr<DiskContents> manifest(
+      new DiskContents(checkpointToSnapshot_[checkpoint], fs_type));
+  if (manifest->load_manifest() != 0) {
+    return NULL;
+  }
+  DiskContents *res = manifest.get();
+  oracle_manifests_[checkpoint] = std::move(manifest);
+  return res;
+}
+
+void Tester::release_oracle_mounts() {
+  for (auto &manifest : oracle_manifests_) {
+    manifest.second->release_mount();
+  }
+}
+
 bool Tester::check_disk_and_snapshot_contents(string disk_path, int last_checkpoint) {
 
   if (checkpointToSnapshot_.find(last_checkpoint) == checkpointToSnapshot_.end()) {
@@ -763,8 +1280,10 @@ bool Tester::check_disk_and_snapshot_contents(string disk_path, int last_checkpo
   diff_file.open("diff-at-check" + to_string(last_checkpoint),
     std::fstream::out | std::fstream::app);
 
-  DiskContents disk1(disk_path, fs_type), disk2(snapshot_path, fs_type);
-  disk1.set_mount_point("/mnt/snapshot");
+  DiskContents disk1(disk_path, fs_type), uncached_oracle(snapshot_path, fs_type);
+  disk1.set_mount_point(mount_point_);
+  DiskContents *oracle = get_oracle_manifest(last_checkpoint);
+  DiskContents &disk2 = (oracle != NULL) ? *oracle : uncached_oracle;
 
   assert(last_checkpoint < mods_.size() && (last_checkpoint > 0));
   for (auto i : mods_.at(last_checkpoint-1)) {
@@ -815,6 +1334,25 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
   time_point<steady_clock> start_time = steady_clock::now();
   Permuter *p = permuter_loader.get_instance();
   p->InitDataVector(sector_size_, log_data);
+  // Permuters that enumerate the crash state space know how many states there
+  // are, which lets us tell the user whether the search was exhaustive.
+  const unsigned long long num_crash_states =
+    p->GetNumCrashStates(full_bio_replay);
+  if (num_crash_states > 0) {
+    cout << "Permuter reports " << num_crash_states << " crash states" << endl;
+    log << "Permuter reports " << num_crash_states << " crash states" << endl;
+  }
+  p->ReserveCrashStates(num_rounds);
+  const bool share_prefixes = p->GroupsStatesByPrefix();
+  if (jobs_ > 1) {
+    const int worker_res = start_check_workers();
+    if (worker_res != SUCCESS) {
+      return worker_res;
+    }
+  }
+  // Prefix currently written to the prefix snapshot.
+  unsigned int prefix_epochs = 0;
+  unsigned int prefix_size = 0;
   vector<DiskWriteData> permutes;
   for (int rounds = 0; rounds < num_rounds; ++rounds) {
     // Print status every 1024 iterations.
@@ -847,8 +1385,73 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
       break;
     }
 
+    // If the permuter hands us crash states grouped by their prefix of full
+    // epochs, keep that prefix written out on a separate snapshot and only
+    // write the rest of each crash state.
+    const bool use_prefix = share_prefixes &&
+      test_info.permute_data.prefix_epochs > 0;
+
+    // Crash states that leave the disk the same as an earlier one would get
+    // the same results, so reuse those instead of checking the disk again.
+    // Hashing the crash state counts as part of generating it.
+    permute_start_time = steady_clock::now();
+    const Fingerprint state_key =
+      crash_state_key(permutes, test_info.permute_data, use_prefix);
+    timing_stats[PERMUTE_TIME] +=
+        duration_cast<milliseconds>(steady_clock::now() - permute_start_time);
+    const auto cached = check_cache_.find(state_key);
+    if (cached != check_cache_.end()) {
+      test_info.cached_from = cached->second.test_num;
+      test_info.fs_test = cached->second.fs_test;
+      test_info.data_test = cached->second.data_test;
+      test_info.PrintResults(log);
+      current_test_suite_->TallyReorderingResult(test_info);
+      continue;
+    }
+
+    if (use_prefix &&
+        test_info.permute_data.prefix_epochs != prefix_epochs) {
+      // Prefixes are always whole epochs from the start of the log, so a longer
+      // prefix can just be written on top of the current one. The snapshot may
+      // hold anything before the first prefix is written, so restore it then.
+      const bool extends = test_info.permute_data.prefix_epochs > prefix_epochs;
+      auto prefix_start = permutes.begin() + ((extends) ? prefix_size : 0);
+      if (update_prefix_snapshot(prefix_start,
+            permutes.begin() + test_info.permute_data.prefix_size,
+            !extends || prefix_epochs == 0) != SUCCESS) {
+        prefix_epochs = 0;
+        prefix_size = 0;
+        test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
+        test_info.PrintResults(log);
+        current_test_suite_->TallyReorderingResult(test_info);
+        continue;
+      }
+      prefix_epochs = test_info.permute_data.prefix_epochs;
+      prefix_size = test_info.permute_data.prefix_size;
+    }
+
+    // With check workers, write the crash state to the snapshot of a worker
+    // that isn't busy and let it do the checking while we make the next one.
+    // Workers that die are dropped, so if none are left we fall back to
+    // checking crash states here.
+    CheckWorker *worker = NULL;
+    while (worker == NULL && !check_workers_.empty()) {
+      for (CheckWorker &w : check_workers_) {
+        if (!w.busy) {
+          worker = &w;
+          break;
+        }
+      }
+      if (worker == NULL && collect_check_results(log, false) != SUCCESS) {
+        fail_pending_checks(log);
+        stop_check_workers();
+      }
+    }
+    const string &device_path =
+      (worker == NULL) ? snapshot_path_ : worker->device_path;
+
     // Restore disk clone.
-    int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+    int cow_brd_snapshot_fd = open(device_path.c_str(), O_WRONLY | O_DIRECT);
     if (cow_brd_snapshot_fd < 0) {
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
       test_info.PrintResults(log);
@@ -857,7 +1460,11 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
     }
     // Begin snapshot timing.
     time_point<steady_clock> snapshot_start_time = steady_clock::now();
-    if (clone_device_restore(cow_brd_snapshot_fd, false) != SUCCESS) {
+    const int restore_res = (use_prefix)
+      ? clone_device_restore_from(cow_brd_snapshot_fd, PREFIX_SNAPSHOT)
+      : clone_device_restore(cow_brd_snapshot_fd, false);
+    if (restore_res != SUCCESS) {
+      close(cow_brd_snapshot_fd);
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
       test_info.PrintResults(log);
       current_test_suite_->TallyReorderingResult(test_info);
@@ -870,9 +1477,14 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
 
     // Write recorded data out to block device in different orders so that we
     // can if they are all valid or not.
+    auto write_start = permutes.begin();
+    if (use_prefix) {
+      write_start += prefix_size;
+    }
     time_point<steady_clock> bio_write_start_time = steady_clock::now();
     const int write_data_res =
-      test_write_data(cow_brd_snapshot_fd, permutes.begin(), permutes.end());
+      test_write_data(cow_brd_snapshot_fd, write_start, permutes.end());
+    ++crash_states_written_;
     time_point<steady_clock> bio_write_end_time = steady_clock::now();
     timing_stats[BIO_WRITE_TIME] +=
         duration_cast<milliseconds>(bio_write_end_time - bio_write_start_time);
@@ -885,28 +1497,36 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
     }
     close(cow_brd_snapshot_fd);
 
+    if (worker != NULL) {
+      dispatch_check(*worker, test_info, state_key);
+      continue;
+    }
+
     // Test the crash state that was just written out.
     vector<milliseconds> check_res = test_fsck_and_user_test(snapshot_path_,
         test_info.permute_data.last_checkpoint, test_info, false);
-    test_info.PrintResults(log);
-    current_test_suite_->TallyReorderingResult(test_info);
+    finish_permutation_check(test_info, check_res, log);
+    cache_check_result(state_key, test_info);
+  }
 
-    // Accounting for time it took to run the test.
-    if (check_res.at(0).count() > -1) {
-      timing_stats[FSCK_TIME] += check_res.at(0);
-    }
-    if (check_res.at(1).count() > -1) {
-      timing_stats[TEST_CASE_TIME] += check_res.at(1);
-    }
-    if (check_res.at(2).count() > -1) {
-      timing_stats[MOUNT_TIME] += check_res.at(2);
+  if (!check_workers_.empty()) {
+    if (collect_check_results(log, true) != SUCCESS) {
+      fail_pending_checks(log);
     }
+    stop_check_workers();
   }
 
   time_point<steady_clock> end_time = steady_clock::now();
   timing_stats[TOTAL_TIME] = duration_cast<milliseconds>(end_time - start_time);
-
-  if (current_test_suite_->GetReorderingCompleted() < num_rounds) {
+  crash_state_stats_ = p->GetCrashStateStats();
+
+  if (num_crash_states > 0 &&
+      current_test_suite_->GetReorderingCompleted() == num_crash_states) {
+    cout << "=============== Explored all " << num_crash_states <<
+      " crash states ===============" << endl << endl;
+    log << "=============== Explored all " << num_crash_states <<
+      " crash states ===============" << endl << endl;
+  } else if (current_test_suite_->GetReorderingCompleted() < num_rounds) {
     cout << "=============== Unable to find new unique state, stopping at " <<
       current_test_suite_->GetReorderingCompleted() <<
       " tests ===============" << endl << endl;
@@ -917,6 +1537,383 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
   return SUCCESS;
 }
 
+namespace {
+
+// Sent to a check worker for each crash state it should check.
+struct CheckRequest {
+  unsigned int last_checkpoint;
+};
+
+// Sent back by a check worker once it has checked a crash state. Followed by
+// the fsck output, the fsck error description, and the data test error
+// description, with the lengths given here.
+struct CheckResultHeader {
+  unsigned int fs_error;
+  int fs_check_return;
+  unsigned int data_error;
+  long long check_ms[3];
+  unsigned int fsck_result_len;
+  unsigned int fs_description_len;
+  unsigned int data_description_len;
+};
+
+bool WriteAll(const int fd, const void *buf, const size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    // Don't die from SIGPIPE if the other end already went away.
+    const ssize_t res =
+      send(fd, (const char *) buf + done, size - done, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    done += res;
+  }
+  return true;
+}
+
+bool ReadAll(const int fd, void *buf, const size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t res = read(fd, (char *) buf + done, size - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    } else if (res <= 0) {
+      return false;
+    }
+    done += res;
+  }
+  return true;
+}
+
+bool WriteCheckResult(const int fd, const SingleTestInfo &test_info,
+    const vector<milliseconds> &check_res) {
+  CheckResultHeader header;
+  header.fs_error = test_info.fs_test.GetError();
+  header.fs_check_return = test_info.fs_test.fs_check_return;
+  header.data_error = test_info.data_test.GetError();
+  for (unsigned int i = 0; i < 3; ++i) {
+    header.check_ms[i] = check_res.at(i).count();
+  }
+  header.fsck_result_len = test_info.fs_test.fsck_result.size();
+  header.fs_description_len = test_info.fs_test.error_description.size();
+  header.data_description_len = test_info.data_test.error_description.size();
+
+  return WriteAll(fd, &header, sizeof(header)) &&
+    WriteAll(fd, test_info.fs_test.fsck_result.data(),
+        header.fsck_result_len) &&
+    WriteAll(fd, test_info.fs_test.error_description.data(),
+        header.fs_description_len) &&
+    WriteAll(fd, test_info.data_test.error_description.data(),
+        header.data_description_len);
+}
+
+bool ReadCheckResult(const int fd, SingleTestInfo &test_info,
+    vector<milliseconds> &check_res) {
+  CheckResultHeader header;
+  if (!ReadAll(fd, &header, sizeof(header))) {
+    return false;
+  }
+  string fsck_result(header.fsck_result_len, '\0');
+  string fs_description(header.fs_description_len, '\0');
+  string data_description(header.data_description_len, '\0');
+  if (!ReadAll(fd, &fsck_result[0], fsck_result.size()) ||
+      !ReadAll(fd, &fs_description[0], fs_description.size()) ||
+      !ReadAll(fd, &data_description[0], data_description.size())) {
+    return false;
+  }
+
+  test_info.fs_test.SetError(
+      (FileSystemTestResult::ErrorType) header.fs_error);
+  test_info.fs_test.fs_check_return = header.fs_check_return;
+  test_info.fs_test.fsck_result = fsck_result;
+  test_info.fs_test.error_description = fs_description;
+  test_info.data_test.SetError(
+      (fs_testing::tests::DataTestResult::ErrorType) header.data_error);
+  test_info.data_test.error_description = data_description;
+  for (unsigned int i = 0; i < 3; ++i) {
+    check_res.at(i) = milliseconds(header.check_ms[i]);
+  }
+  return true;
+}
+
+}  // namespace
+
+/*
+ * Fingerprint of the disk contents crash_state produces when written on top of
+ * the base snapshot, along with the checkpoint the user test will check
+ * against. Only the data in the crash state is hashed, so crash states that
+ * overwrite a sector with the data already on the base snapshot still get
+ * different keys.
+ *
+ * Crash states written on top of a shared prefix are keyed by the prefix's
+ * fingerprint and the writes after it. The prefix is hashed once each time it
+ * changes, so grouped crash states don't pay for it again here.
+ */
+Fingerprint Tester::crash_state_key(vector<DiskWriteData> &crash_state,
+    const PermuteTestResult &permute_data, const bool use_prefix) {
+  auto start = crash_state.begin();
+  FingerprintBuilder builder;
+  builder.Add(permute_data.last_checkpoint);
+  if (use_prefix) {
+    if (permute_data.prefix_epochs != prefix_key_epochs_ ||
+        permute_data.prefix_size != prefix_key_size_) {
+      FingerprintBuilder prefix_builder;
+      add_writes_to_fingerprint(start, start + permute_data.prefix_size,
+          prefix_builder);
+      prefix_key_ = prefix_builder.Finish();
+      prefix_key_epochs_ = permute_data.prefix_epochs;
+      prefix_key_size_ = permute_data.prefix_size;
+    }
+    builder.Add(prefix_key_.hi >> 32);
+    builder.Add(prefix_key_.hi);
+    builder.Add(prefix_key_.lo >> 32);
+    builder.Add(prefix_key_.lo);
+    start += permute_data.prefix_size;
+  }
+  add_writes_to_fingerprint(start, crash_state.end(), builder);
+  return builder.Finish();
+}
+
+void Tester::add_writes_to_fingerprint(
+    const vector<DiskWriteData>::iterator &start,
+    const vector<DiskWriteData>::iterator &end, FingerprintBuilder &builder) {
+  extent_writer_.Clear();
+  for (auto current = start; current != end; ++current) {
+    if (current->size == 0) {
+      continue;
+    }
+    extent_writer_.Add(current->disk_offset, current->size,
+        (const char *) current->GetData());
+  }
+  extent_writer_.AddToFingerprint(builder);
+  extent_writer_.Clear();
+}
+
+void Tester::cache_check_result(const Fingerprint &state_key,
+    const SingleTestInfo &test_info) {
+  // Don't hold on to failures of the harness itself.
+  if (test_info.fs_test.GetError() & FileSystemTestResult::kOther) {
+    return;
+  }
+  // With check workers, a duplicate may finish before the state it duplicates
+  // was looked up. Keep whichever result came first.
+  check_cache_.emplace(state_key,
+      CachedCheck{test_info.test_num, test_info.fs_test, test_info.data_test});
+}
+
+/*
+ * Print and tally the result of checking a permuted crash state.
+ */
+void Tester::finish_permutation_check(SingleTestInfo &test_info,
+    const vector<milliseconds> &check_res, ofstream &log) {
+  test_info.PrintResults(log);
+  current_test_suite_->TallyReorderingResult(test_info);
+
+  // Accounting for time it took to run the test. With check workers this is
+  // the sum over all workers rather than wall clock time.
+  if (check_res.at(0).count() > -1) {
+    timing_stats[FSCK_TIME] += check_res.at(0);
+  }
+  if (check_res.at(1).count() > -1) {
+    timing_stats[TEST_CASE_TIME] += check_res.at(1);
+  }
+  if (check_res.at(2).count() > -1) {
+    timing_stats[MOUNT_TIME] += check_res.at(2);
+  }
+}
+
+/*
+ * Fork jobs_ processes that each check crash states written to their own
+ * snapshot device, mounted at their own mount point. The first worker uses the
+ * snapshot and mount point the harness normally uses, the others use the
+ * snapshots after PREFIX_SNAPSHOT and mount points next to the usual one.
+ */
+int Tester::start_check_workers() {
+  for (unsigned int i = 0; i < jobs_; ++i) {
+    CheckWorker worker;
+    if (i == 0) {
+      worker.device_path = snapshot_path_;
+      worker.mount_point = mount_point_;
+    } else {
+      worker.device_path = snapshot_device_path(PREFIX_SNAPSHOT + i);
+      worker.mount_point = mount_point_ + to_string(i);
+    }
+    if (access(worker.device_path.c_str(), F_OK) < 0) {
+      cerr << "Missing snapshot device " << worker.device_path <<
+        " for check worker" << endl;
+      stop_check_workers();
+      return CHECK_WORKER_ERR;
+    }
+    if (mkdir(worker.mount_point.c_str(), 0777) < 0 && errno != EEXIST) {
+      cerr << "Error making mount point " << worker.mount_point << endl;
+      stop_check_workers();
+      return CHECK_WORKER_ERR;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+      stop_check_workers();
+      return CHECK_WORKER_ERR;
+    }
+    // Don't let the worker print out anything we have buffered a second time.
+    cout.flush();
+    cerr.flush();
+    worker.pid = fork();
+    if (worker.pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      stop_check_workers();
+      return CHECK_WORKER_ERR;
+    } else if (worker.pid == 0) {
+      close(fds[0]);
+      for (const CheckWorker &w : check_workers_) {
+        close(w.fd);
+      }
+      worker.fd = fds[1];
+      run_check_worker(worker);
+    }
+    close(fds[1]);
+    worker.fd = fds[0];
+    check_workers_.push_back(worker);
+  }
+  return SUCCESS;
+}
+
+void Tester::stop_check_workers() {
+  // Workers exit when they see the other end of their socket close.
+  for (CheckWorker &worker : check_workers_) {
+    close(worker.fd);
+  }
+  for (CheckWorker &worker : check_workers_) {
+    while (waitpid(worker.pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+  }
+  check_workers_.clear();
+  // Workers that already exited were dropped from check_workers_, so go by
+  // jobs_ to find every mount point start_check_workers made.
+  for (unsigned int i = 1; i < jobs_; ++i) {
+    rmdir((mount_point_ + to_string(i)).c_str());
+  }
+}
+
+/*
+ * Record the crash states busy check workers haven't sent results for as
+ * failed, so they still show up in the results when the workers are stopped
+ * early.
+ */
+void Tester::fail_pending_checks(ofstream &log) {
+  for (CheckWorker &worker : check_workers_) {
+    if (!worker.busy) {
+      continue;
+    }
+    worker.busy = false;
+    worker.test_info.fs_test.SetError(FileSystemTestResult::kOther);
+    worker.test_info.fs_test.error_description =
+      "check worker stopped before finishing";
+    const vector<milliseconds> check_res(3, duration<int, std::milli>(-1));
+    finish_permutation_check(worker.test_info, check_res, log);
+  }
+}
+
+/*
+ * Main loop of a check worker process. Never returns.
+ */
+void Tester::run_check_worker(const CheckWorker &worker) {
+  mount_point_ = worker.mount_point;
+  disk_mounted = false;
+  setenv("MOUNT_FS", mount_point_.c_str(), 1);
+  test_init_values(mount_point_, filesys_size_);
+
+  CheckRequest request;
+  while (ReadAll(worker.fd, &request, sizeof(request))) {
+    SingleTestInfo test_info;
+    const vector<milliseconds> check_res = test_fsck_and_user_test(
+        worker.device_path, request.last_checkpoint, test_info, false);
+    if (!WriteCheckResult(worker.fd, test_info, check_res)) {
+      break;
+    }
+  }
+
+  // Skip destructors and atexit handlers, they belong to the parent.
+  cout.flush();
+  cerr.flush();
+  _exit(0);
+}
+
+/*
+ * Hand a crash state that was just written to the worker's snapshot to the
+ * worker. If the worker died, collect_check_results will notice and record the
+ * crash state as failed.
+ */
+void Tester::dispatch_check(CheckWorker &worker, SingleTestInfo &test_info,
+    const Fingerprint &state_key) {
+  CheckRequest request;
+  request.last_checkpoint = test_info.permute_data.last_checkpoint;
+  worker.test_info = test_info;
+  worker.state_key = state_key;
+  worker.busy = true;
+  WriteAll(worker.fd, &request, sizeof(request));
+}
+
+/*
+ * Wait for busy check workers and record the results of the crash states they
+ * checked. Returns after at least one worker finishes, or after all workers
+ * finish if wait_for_all is set. Workers that exit are removed.
+ */
+int Tester::collect_check_results(ofstream &log, bool wait_for_all) {
+  bool collected = false;
+  while (true) {
+    vector<struct pollfd> fds;
+    vector<unsigned int> worker_idx;
+    for (unsigned int i = 0; i < check_workers_.size(); ++i) {
+      if (check_workers_.at(i).busy) {
+        fds.push_back({check_workers_.at(i).fd, POLLIN, 0});
+        worker_idx.push_back(i);
+      }
+    }
+    if (fds.empty() || (collected && !wait_for_all)) {
+      return SUCCESS;
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return CHECK_WORKER_ERR;
+    }
+
+    vector<unsigned int> dead;
+    for (unsigned int i = 0; i < fds.size(); ++i) {
+      if (fds.at(i).revents == 0) {
+        continue;
+      }
+      CheckWorker &worker = check_workers_.at(worker_idx.at(i));
+      vector<milliseconds> check_res(3, duration<int, std::milli>(-1));
+      if (!ReadCheckResult(worker.fd, worker.test_info, check_res)) {
+        worker.test_info.fs_test.SetError(FileSystemTestResult::kOther);
+        worker.test_info.fs_test.error_description = "check worker exited";
+        dead.push_back(worker_idx.at(i));
+      }
+      worker.busy = false;
+      collected = true;
+      finish_permutation_check(worker.test_info, check_res, log);
+      cache_check_result(worker.state_key, worker.test_info);
+    }
+
+    for (auto iter = dead.rbegin(); iter != dead.rend(); ++iter) {
+      CheckWorker &worker = check_workers_.at(*iter);
+      cerr << "Check worker for " << worker.device_path << " exited" << endl;
+      close(worker.fd);
+      while (waitpid(worker.pid, NULL, 0) < 0 && errno == EINTR) {
+      }
+      check_workers_.erase(check_workers_.begin() + *iter);
+    }
+  }
+}
+
 /*
  * Replays the operations in the recorded workload, stopping at each Checkpoint
  * found in the workload. At each Checkpoint, the user test case is called so
@@ -938,6 +1935,25 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
     return SUCCESS;
   }
 
+  // The log is replayed once, in order, onto the prefix snapshot, which nothing
+  // else uses at this point. At each checkpoint the prefix snapshot is made
+  // read-only and snapshot_path_ is chained off of it to be checked, so
+  // mounting and fsck there don't change the disk the rest of the log is
+  // written on top of, and only the pages they write are restored for the next
+  // checkpoint. Modules without chained snapshots get a copy of the prefix
+  // snapshot instead.
+  const string replay_path = snapshot_device_path(PREFIX_SNAPSHOT);
+  const int replay_fd = open(replay_path.c_str(), O_WRONLY | O_DIRECT);
+  if (replay_fd < 0) {
+    return DRIVE_CLONE_PREFIX_ERR;
+  }
+  if (clone_device_restore(replay_fd, false) != SUCCESS) {
+    close(replay_fd);
+    return DRIVE_CLONE_PREFIX_ERR;
+  }
+  bool replay_ok = true;
+  bool chained = false;
+
   // Skip the first disk write as it is just the Checkpoint at the start of the
   // log.
   auto log_iter = log_data.begin() + 1;
@@ -950,6 +1966,7 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
     // Keep going through the workload data log until we reach a Checkpoint.
     // Also, skip the very first checkpoint which occurs at the very beginning
     // of the log.
+    const size_t checkpoint_start = crash_state.size();
     while (log_iter != log_data.end() && !log_iter->is_checkpoint()) {
       DiskWriteData wd = DiskWriteData(true, op_index, 0,
           log_iter->metadata.write_sector * SECTOR_SIZE,
@@ -959,79 +1976,91 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
       ++op_index;
     }
 
-    // When we see a Checkpoint, we need to do several things:
-    // 0. Setup the test result struct with info about this test
-    // 1. Restore the disk so that we start from a clean state
-    // 2. Write out the data in the log from the start until the checkpoint we
-    //    found
-    // 3. Test the resulting disk state with fsck and the user test case
-
-    // 0.
+    // 1. Write the data logged since the last checkpoint out to the replay
+    // device. If the iterator points to the end of the log, we are alright
+    // because the function is [begin, end) and the end iterator is a sentinal
+    // value. The same logic applies for checkpoints (which we don't really want
+    // to replay).
+    if (replay_ok) {
+      replay_ok = test_write_data(replay_fd,
+          crash_state.begin() + checkpoint_start, crash_state.end());
+    }
 
-    // Update checkpoint. It's not always the log_iter's value as log_iter may
-    // point to the end of the recorded workload, not a checkpoint.
-    if (log_iter->is_checkpoint()) {
-      last_checkpoint = log_iter->metadata.write_sector;
+    // Nothing is checked past the last checkpoint.
+    if (log_iter == log_data.end()) {
+      break;
     }
+
+    // When we see a Checkpoint, we need to do several things:
+    // 2. Setup the test result struct with info about this test
+    // 3. Copy the replay device to the device we check
+    // 4. Test the resulting disk state with fsck and the user test case
+    last_checkpoint = log_iter->metadata.write_sector;
     SingleTestInfo test_info;
     test_info.permute_data.crash_state = crash_state;
-    // We reached the checkpoint, so it is indeed the last one we saw, unless we
-    // have replayed the entire log.
     test_info.permute_data.last_checkpoint = last_checkpoint;
     // Tests for this portion will be numbered starting from 1.
     test_info.test_num = test_num++;
 
-    // 1. Restore disk clone.
-    int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
-    if (cow_brd_snapshot_fd < 0) {
-      test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
-      continue;
-    }
-    if (clone_device_restore(cow_brd_snapshot_fd, false) != SUCCESS) {
-      test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
-      continue;
-    }
-
-    // 2. Write recorded data out to block device. If the iterator points to the
-    // end of the log, we are alright because the function is [begin, end) and
-    // the end iterator is a sentinal value. The same logic applies for
-    // checkpoints (which we don't really want to replay).
-    const int write_data_res =
-      test_write_data(cow_brd_snapshot_fd, crash_state.begin(),
-          crash_state.end());
-    if (!write_data_res) {
+    if (!replay_ok) {
       test_info.fs_test.SetError(FileSystemTestResult::kBioWrite);
-      close(cow_brd_snapshot_fd);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
-      continue;
-    }
-    close(cow_brd_snapshot_fd);
-
-    // 3. Check the resulting disk image with fsck and the user test. For now,
-    // just ignore the timing data that we can get from this function.
-    if (log_iter->is_checkpoint()) {
-      test_fsck_and_user_test(snapshot_path_,
-          test_info.permute_data.last_checkpoint, test_info, automate_check_test);
-
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
-    }
-
-    // Exit loop after doing final test.
-    if (log_iter == log_data.end()) {
-      break;
+    } else {
+      const int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+      bool restored = false;
+      const bool frozen = cow_brd_snapshot_fd >= 0 &&
+        ioctl(replay_fd, COW_BRD_SNAPSHOT) == 0;
+      if (frozen) {
+        restored = (chained)
+          ? clone_device_restore(cow_brd_snapshot_fd, false) == SUCCESS
+          : clone_device_chain(cow_brd_snapshot_fd, PREFIX_SNAPSHOT) ==
+            SUCCESS;
+        chained = chained || restored;
+      }
+      if (!restored && !chained && cow_brd_snapshot_fd >= 0) {
+        restored = clone_device_restore_from(cow_brd_snapshot_fd,
+            PREFIX_SNAPSHOT) == SUCCESS;
+      }
+      if (cow_brd_snapshot_fd >= 0) {
+        close(cow_brd_snapshot_fd);
+      }
+      if (!restored) {
+        test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
+      } else {
+        ++crash_states_written_;
+        test_fsck_and_user_test(snapshot_path_,
+            test_info.permute_data.last_checkpoint, test_info,
+            automate_check_test);
+      }
+      // The next checkpoint's bios go on top of the prefix snapshot.
+      if (frozen && ioctl(replay_fd, COW_BRD_UNSNAPSHOT) < 0) {
+        replay_ok = false;
+      }
     }
+    test_info.PrintResults(log);
+    current_test_suite_->TallyTimingResult(test_info);
 
     // Increment our end pointer iterater passed the Checkpoint we just stopped
     // at.
     ++log_iter;
     ++op_index;
   }
+  close(replay_fd);
+  // Oracles are rebuilt along with the snapshots for the next workload run.
+  release_oracle_mounts();
+  oracle_manifests_.clear();
+
+  // Crash states are built on the base disk again from here on.
+  if (chained) {
+    const int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+    const bool unchained = cow_brd_snapshot_fd >= 0 &&
+      clone_device_chain(cow_brd_snapshot_fd, 0) == SUCCESS;
+    if (cow_brd_snapshot_fd >= 0) {
+      close(cow_brd_snapshot_fd);
+    }
+    if (!unchained) {
+      return DRIVE_CLONE_RESTORE_ERR;
+    }
+  }
   return SUCCESS;
 }
 
@@ -1096,60 +2125,48 @@ int Tester::test_restore_log() {
 bool Tester::test_write_data_dw(const int disk_fd,
     const vector<disk_write>::iterator& start,
     const vector<disk_write>::iterator& end) {
+  extent_writer_.Clear();
   for (auto current = start; current != end; ++current) {
     // Operation is not a write so skip it.
     if (!current->has_write_flag()) {
       continue;
     }
 
-    const unsigned long int byte_addr =
-      current->metadata.write_sector * SECTOR_SIZE;
-    if (lseek(disk_fd, byte_addr, SEEK_SET) < 0) {
-      return false;
-    }
-    unsigned int bytes_written = 0;
-    void *data_base_addr = current->get_data().get();
-    while (bytes_written < current->metadata.size) {
-      int res = write(disk_fd,
-          (void*) ((unsigned long) data_base_addr + bytes_written),
-          current->metadata.size - bytes_written);
-      if (res < 0) {
-        return false;
-      }
-      bytes_written += res;
-    }
+    extent_writer_.Add(current->metadata.write_sector * SECTOR_SIZE,
+        current->metadata.size, current->get_data().get());
   }
-  return true;
+  const bool res = extent_writer_.Write(disk_fd);
+  extent_writer_.Clear();
+  return res;
 }
 
+/*
+ * Writes are coalesced into contiguous extents before being sent to the disk,
+ * so the data in [start, end) is written with a handful of syscalls instead of
+ * a seek and write for each DiskWriteData.
+ */
 bool Tester::test_write_data(const int disk_fd,
     const vector<DiskWriteData>::iterator &start,
     const vector<DiskWriteData>::iterator &end) {
+  extent_writer_.Clear();
   for (auto current = start; current != end; ++current) {
     if (current->size == 0) {
       // It's *possible* that zero length sectors could have an invalid
       // disk_offset (I have not tested/confirmed).
       continue;
     }
-    if (lseek(disk_fd, current->disk_offset, SEEK_SET) < 0) {
-      return false;
-    }
-    unsigned int bytes_written = 0;
-    void *data_base_addr = current->GetData();
-    while (bytes_written < current->size) {
-      int res = write(disk_fd,
-          (void*) ((unsigned long) data_base_addr + bytes_written),
-          current->size - bytes_written);
-      if (res < 0) {
-        return false;
-      }
-      bytes_written += res;
-    }
+    extent_writer_.Add(current->disk_offset, current->size,
+        (const char *) current->GetData());
   }
-  return true;
+  const bool res = extent_writer_.Write(disk_fd);
+  extent_writer_.Clear();
+  return res;
 }
 
 void Tester::cleanup_harness() {
+  // Oracle snapshots can't be removed with cow_brd while they are mounted.
+  release_oracle_mounts();
+  oracle_manifests_.clear();
   int umount_res;
   int err;
   do {
@@ -1188,6 +2205,72 @@ void Tester::cleanup_harness() {
   }
 }
 
+int Tester::reset_for_next_test() {
+  release_oracle_mounts();
+  oracle_manifests_.clear();
+  int umount_res;
+  int err;
+  do {
+    umount_res = umount_device();
+    if (umount_res < 0) {
+      err = errno;
+      usleep(500);
+    }
+  } while (umount_res < 0 && err == EBUSY);
+  if (umount_res < 0) {
+    cerr << "Unable to unmount device" << endl;
+    return MNT_UMNT_ERR;
+  }
+  put_wrapper_ioctl();
+  if (remove_wrapper() != SUCCESS) {
+    cerr << "Unable to remove wrapper device" << endl;
+    return WRAPPER_REMOVE_ERR;
+  }
+  permuter_unload_class();
+  test_unload_class();
+
+  // Drop the pages of every snapshot, then the base disk's own, so the next
+  // test case starts from an empty disk.
+  snapshot_path_ = "/dev/cow_ram_snapshot1_0";
+  for (unsigned int i = 1; i < PREFIX_SNAPSHOT + jobs_; ++i) {
+    const int snapshot_fd = open(snapshot_device_path(i).c_str(), O_WRONLY);
+    if (snapshot_fd < 0) {
+      return DRIVE_CLONE_RESTORE_ERR;
+    }
+    const int res = ioctl(snapshot_fd, COW_BRD_RESTORE_SNAPSHOT);
+    close(snapshot_fd);
+    if (res < 0) {
+      return DRIVE_CLONE_RESTORE_ERR;
+    }
+  }
+  if (ioctl(cow_brd_fd, COW_BRD_UNSNAPSHOT) < 0 ||
+      ioctl(cow_brd_fd, COW_BRD_WIPE) < 0) {
+    return DRIVE_CLONE_RESTORE_ERR;
+  }
+
+  log_data.clear();
+  block_store_.Clear();
+  mods_.clear();
+  checkpointToSnapshot_.clear();
+  oracle_checkpoint_ = -1;
+  check_cache_.clear();
+  prefix_key_epochs_ = 0;
+  prefix_key_size_ = 0;
+  test_results_.clear();
+  current_test_suite_ = NULL;
+  for (unsigned int i = 0; i < NUM_TIME; ++i) {
+    timing_stats[i] = milliseconds(0);
+  }
+  crash_state_stats_ = {};
+  crash_states_written_ = 0;
+  logged_bios_ = 0;
+  logged_bytes_ = 0;
+  logging_overhead_ns_ = 0;
+  logging_arena_misses_ = 0;
+  logging_throttle_ns_ = 0;
+  return SUCCESS;
+}
+
 int Tester::clear_caches() {
   sync();
   const int cache_fd = open(DROP_CACHES_PATH, O_WRONLY);
@@ -1213,24 +2296,16 @@ int Tester::log_profile_save(string log_file) {
   // class specific one that is set at class creation time. That way people
   // don't break our logging system.
   std::cout << "saving " << log_data.size() << " disk operations" << endl;
-  ofstream log(log_file, std::ofstream::trunc | ios::binary);
-  for (const disk_write& dw : log_data) {
-    disk_write::serialize(log, dw);
+  // Left uncompressed so loading it later doesn't need to copy any data.
+  if (!fs_testing::utils::SaveProfileLog(log_file, log_data, false)) {
+    return LOG_CLONE_ERR;
   }
-  log.close();
   return SUCCESS;
 }
 
 int Tester::log_profile_load(string log_file) {
-  ifstream log(log_file, ios::binary);
-  while (log.peek() != EOF) {
-    log_data.push_back(disk_write::deserialize(log));
-  }
-  bool err = log.fail();
-  int errnum = errno;
-  log.close();
-  if (err) {
-    std::cout << "error " << strerror(errnum) << std::endl;
+  // Handles both the current format and logs saved by older versions.
+  if (!fs_testing::utils::LoadProfileLog(log_file, log_data)) {
     return LOG_CLONE_ERR;
   }
   std::cout << "loaded " << log_data.size() << " disk operations" << endl;
@@ -1238,133 +2313,64 @@ int Tester::log_profile_load(string log_file) {
 }
 
 int Tester::log_snapshot_save(string log_file) {
-  // TODO(ashmrtn): What happens if this fails?
-  // TODO(ashmrtn): Change device_clone to be an mmap of the disk we need to get
-  // stuff on.
   // device_size happens to be the number of 1k blocks on cow_brd (from original
   // brd behavior...), so convert it to a number of bytes.
-  unsigned int dev_bytes = device_size * 2 * 512;
-  unsigned int bytes_done = 0;
-  const unsigned int buf_size = 4096;
-  unsigned int buf[buf_size];
-  int log_fd =
-    open(log_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-  if (log_fd < 0) {
-    cerr << "error opening log file" << endl;
+  const uint64_t dev_bytes = (uint64_t) device_size * 2 * 512;
+  fs_testing::utils::DiskSnapshotStats stats;
+  if (!fs_testing::utils::SaveDiskSnapshot(cow_brd_fd, dev_bytes, log_file,
+        &stats)) {
     return LOG_CLONE_ERR;
   }
+  std::cout << "saved " << stats.data_bytes << " of " << stats.device_bytes
+    << " bytes of the disk in " << stats.extents << " extents" << endl;
+  return SUCCESS;
+}
 
-  int res = lseek(cow_brd_fd, 0, SEEK_SET);
-  if (res < 0) {
-    cerr << "error seeking to start of test device" << endl;
+int Tester::log_snapshot_load(string log_file) {
+  if (load_disk_image(log_file) != SUCCESS) {
     return LOG_CLONE_ERR;
   }
-  while (bytes_done < dev_bytes) {
-    // Read a block of data from the base disk image.
-    unsigned int bytes = 0;
-    unsigned int new_amount = (dev_bytes < bytes_done + buf_size)
-                            ? dev_bytes - bytes_done
-                            : buf_size;
-    do {
-      int res = read(cow_brd_fd, buf + bytes, new_amount - bytes);
-      if (res < 0) {
-        cerr << "error reading from raw device to log disk snapshot" << endl;
-        return LOG_CLONE_ERR;
-      }
-      bytes += res;
-    } while (bytes < new_amount);
 
-    // Write a block of data to the log file.
-    bytes = 0;
-    do {
-      int res = write(log_fd, buf + bytes, new_amount - bytes);
-      if (res < 0) {
-        cerr << "error reading from raw device to log disk snapshot" << endl;
-        return LOG_CLONE_ERR;
-      }
-      bytes += res;
-    } while (bytes < new_amount);
-    bytes_done += new_amount;
+  fsync(cow_brd_fd);
+  int res = ioctl(cow_brd_fd, COW_BRD_SNAPSHOT);
+  if (res < 0) {
+    cerr << "error restoring snapshot from log" << endl;
+    return LOG_CLONE_ERR;
   }
-
-  fsync(log_fd);
   return SUCCESS;
 }
 
-int Tester::log_snapshot_load(string log_file) {
-  // TODO(ashmrtn): What happens if this fails?
-  // TODO(ashmrtn): Change device_clone to be an mmap of the disk we need to get
-  // stuff on.
+/*
+ * Replaces everything on the base disk with the image saved at path, leaving
+ * the disk writable.
+ */
+int Tester::load_disk_image(const string &path) {
   int res = ioctl(cow_brd_fd, COW_BRD_WIPE);
   if (res < 0) {
     cerr << "error wiping old disk snapshot" << endl;
     return LOG_CLONE_ERR;
   }
 
-  // device_size happens to be the number of 1k blocks on cow_brd (from original
-  // brd behavior...), so convert it to a number of bytes.
-  unsigned int dev_bytes = device_size * 2 * 512;
-  unsigned int bytes_done = 0;
-  const unsigned int buf_size = 4096;
-  unsigned int buf[buf_size];
-  int log_fd = open(log_file.c_str(), O_RDONLY);
-  if (log_fd < 0) {
-    cerr << "error opening log file" << endl;
-    return LOG_CLONE_ERR;
-  }
-
   // cow_brd_fd is RDONLY.
-  int device_path = open(COW_BRD_PATH, O_WRONLY);
-  if (device_path < 0) {
-    cerr << "error opening log file" << endl;
+  int device_fd = open(COW_BRD_PATH, O_WRONLY);
+  if (device_fd < 0) {
+    cerr << "error opening test device" << endl;
     return LOG_CLONE_ERR;
   }
 
-  res = lseek(device_path, 0, SEEK_SET);
-  if (res < 0) {
-    cerr << "error seeking to start of test device" << endl;
-    return LOG_CLONE_ERR;
-  }
-  res = lseek(log_fd, 0, SEEK_SET);
-  if (res < 0) {
-    cerr << "error seeking to start of log file" << endl;
-    return LOG_CLONE_ERR;
-  }
-  while (bytes_done < dev_bytes) {
-    // Read a block of data from the base disk image.
-    unsigned int bytes = 0;
-    unsigned int new_amount = (dev_bytes < bytes_done + buf_size)
-                            ? dev_bytes - bytes_done
-                            : buf_size;
-    do {
-      int res = read(log_fd, buf + bytes, new_amount - bytes);
-      if (res < 0) {
-        cerr << "error reading from raw device to log disk snapshot" << endl;
-        return LOG_CLONE_ERR;
-      }
-      bytes += res;
-    } while (bytes < new_amount);
-
-    // Write a block of data to the log file.
-    bytes = 0;
-    do {
-      int res = write(device_path, buf + bytes, new_amount - bytes);
-      if (res < 0) {
-        cerr << "error reading from raw device to log disk snapshot" << endl;
-        return LOG_CLONE_ERR;
-      }
-      bytes += res;
-    } while (bytes < new_amount);
-    bytes_done += new_amount;
-  }
-  close(device_path);
-
-  fsync(cow_brd_fd);
-  res = ioctl(cow_brd_fd, COW_BRD_SNAPSHOT);
-  if (res < 0) {
-    cerr << "error restoring snapshot from log" << endl;
+  // The wiped device reads back as zeros, so only the extents the saved image
+  // has data for need to be written.
+  const uint64_t dev_bytes = (uint64_t) device_size * 2 * 512;
+  fs_testing::utils::DiskSnapshotStats stats;
+  const bool loaded = fs_testing::utils::LoadDiskSnapshot(path, device_fd,
+      dev_bytes, &stats);
+  fsync(device_fd);
+  close(device_fd);
+  if (!loaded) {
     return LOG_CLONE_ERR;
   }
+  std::cout << "loaded " << stats.data_bytes << " of " << stats.device_bytes
+    << " bytes of the disk in " << stats.extents << " extents" << endl;
   return SUCCESS;
 }
 
@@ -1388,6 +2394,43 @@ void Tester::PrintTestStats(std::ostream& os) {
   }
 }
 
+void Tester::PrintTimingStats(std::ostream& os) {
+  for (unsigned int i = 0; i < NUM_TIME; ++i) {
+    os << "\t" << (time_stats) i << ": " << timing_stats[i].count() << " ms" <<
+      endl;
+  }
+  if (logged_bios_ > 0) {
+    os << "\tbio logging overhead: " << logging_overhead_ns_ / 1000000 <<
+      " ms for " << logged_bios_ << " bios (" << logged_bytes_ / 1024 <<
+      " KB, " << logging_arena_misses_ << " outside the arena)" << endl;
+  }
+  if (block_store_.GetAddedBytes() > 0) {
+    os << "\tbio data kept: " << block_store_.GetStoredBytes() / 1024 <<
+      " KB of " << block_store_.GetAddedBytes() / 1024 << " KB logged" << endl;
+  }
+  if (logging_throttle_ns_ > 0) {
+    os << "\tbios waiting for the log to drain: " <<
+      logging_throttle_ns_ / 1000000 << " ms" << endl;
+  }
+  if (crash_states_written_ > 0) {
+    os << "\tbio write syscalls: " << extent_writer_.GetNumSyscalls() << " (" <<
+      extent_writer_.GetNumSyscalls() / (double) crash_states_written_ <<
+      " per crash state)" << endl;
+  }
+
+  // Only permuters that can return duplicate crash states use the set.
+  if (crash_state_stats_.lookups == 0) {
+    return;
+  }
+  os << "\tcompleted crash states: " << crash_state_stats_.size << " of " <<
+    crash_state_stats_.capacity << " slots (" <<
+    crash_state_stats_.memory_bytes / 1024 << " KB)" << endl;
+  os << "\tcrash state lookups: " << crash_state_stats_.lookups <<
+    ", probe collisions: " << crash_state_stats_.probe_collisions <<
+    ", max probe length: " << crash_state_stats_.max_probe_length <<
+    ", resizes: " << crash_state_stats_.resizes << endl;
+}
+
 std::chrono::milliseconds Tester::get_timing_stat(time_stats timing_stat) {
   return timing_stats[timing_stat];
 }
@@ -1412,6 +2455,9 @@ std::ostream& operator<<(std::ostream& os, Tester::time_stats time) {
     case fs_testing::Tester::MOUNT_TIME:
       os << "mount/umount time";
       break;
+    case fs_testing::Tester::WRITEBACK_TIME:
+      os << "writeback wait time";
+      break;
     case fs_testing::Tester::TOTAL_TIME:
       os << "total time";
       break;
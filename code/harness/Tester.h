@@ -1,20 +1,30 @@
 #ifndef TESTER_H
 #define TESTER_H
 
+#include <sys/types.h>
+
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <map>
 
+#include "DiskContents.h"
 #include "FsSpecific.h"
 #include "../permuter/Permuter.h"
 #include "../results/TestSuiteResult.h"
 #include "../tests/BaseTestCase.h"
+#include "../utils/BlockStore.h"
 #include "../utils/ClassLoader.h"
 #include "../utils/DiskMod.h"
+#include "../utils/ExtentWriter.h"
+#include "../utils/ProfileLog.h"
 #include "../utils/utils.h"
 
 #define SUCCESS                  0
@@ -23,6 +33,8 @@
 #define DRIVE_CLONE_EXISTS_ERR   -3
 #define TEST_TEST_ERR            -4
 #define LOG_CLONE_ERR            -5
+#define DRIVE_CLONE_PREFIX_ERR   -6
+#define CHECK_WORKER_ERR         -7
 #define TEST_CASE_FILE_ERR       -11
 #define MNT_BAD_DEV_ERR          -12
 #define MNT_MNT_ERR              -13
@@ -60,6 +72,7 @@ class Tester {
     FSCK_TIME,
     TEST_CASE_TIME,
     MOUNT_TIME,
+    WRITEBACK_TIME,
     TOTAL_TIME,
     NUM_TIME,
   };
@@ -71,6 +84,11 @@ class Tester {
   void set_fs_type(const std::string type);
   void set_device(const std::string device_path);
   void set_flag_device(const std::string device_path);
+  /*
+   * Number of crash states to check at once when testing permuted crash states.
+   * Must be set before insert_cow_brd() so there are enough snapshot devices.
+   */
+  void set_jobs(const unsigned int jobs);
 
   const char* update_dirty_expire_time(const char* time);
 
@@ -79,6 +97,10 @@ class Tester {
   int format_drive();
   int clone_device();
   int clone_device_restore(int snapshot_fd, bool reread);
+  int clone_device_restore_from(int snapshot_fd, unsigned int source_snapshot);
+  // Makes the snapshot a fresh snapshot of parent_snapshot, or of the disk
+  // itself when parent_snapshot is 0.
+  int clone_device_chain(int snapshot_fd, unsigned int parent_snapshot);
 
   int permuter_load_class(const char* path);
   void permuter_unload_class();
@@ -102,8 +124,14 @@ class Tester {
   int umount_snapshot();
 
   int mapCheckpointToSnapshot(int checkpoint);
-  int getNewDiskClone(int checkpoint);
   void getCompleteRunDiskClone();
+  /*
+   * Oracle run for automated checking: between these calls the workload runs
+   * once, start to finish, on snapshot_path_, and CreateCheckpoint freezes the
+   * file system at each checkpoint into a snapshot of its own.
+   */
+  int begin_oracle_run();
+  int end_oracle_run();
 
   int insert_cow_brd();
   int remove_cow_brd();
@@ -114,6 +142,18 @@ class Tester {
   void put_wrapper_ioctl();
   void begin_wrapper_logging();
   void end_wrapper_logging();
+  // Waits until the file system on the wrapper device stops writing, or for
+  // the file system's post-run delay if it doesn't. Returns the time waited.
+  std::chrono::milliseconds wait_for_writeback();
+  // Quiet time that counts as done writing. 0 always waits the full delay.
+  void set_quiesce_window(const unsigned int window_ms);
+  // Directory freshly formatted disk images are kept in so format_drive can
+  // load one instead of running mkfs. Empty disables the cache.
+  void set_image_cache(const std::string dir);
+  // Most memory, in MB, the wrapper may hold for its log before bios wait for
+  // it to be drained. When set, the log is drained to a file in the current
+  // directory while the workload runs. 0 never drains it early.
+  void set_max_log_mb(const unsigned int max_log_mb);
   int get_wrapper_log();
   void clear_wrapper_log();
   int GetChangeData(const int fd);
@@ -122,6 +162,9 @@ class Tester {
 
   int clear_caches();
   void cleanup_harness();
+  // Returns the harness to how it was right after insert_cow_brd, so another
+  // test case can be run without reloading the module.
+  int reset_for_next_test();
   // TODO(ashmrtn): Save the fstype in the log file so that we don't
   // accidentally mix logs of one fs type with mount options for another?
   int log_profile_save(std::string log_file);
@@ -135,6 +178,7 @@ class Tester {
   void PrintTestStats(std::ostream& os);
   void StartTestSuite();
   void EndTestSuite();
+  unsigned int GetNumFailed() const;
 
   unsigned int GetPostRunDelay();
 
@@ -163,8 +207,55 @@ class Tester {
   int ioctl_fd = -1;
   const unsigned int sector_size_;
   std::vector<fs_testing::utils::disk_write> log_data;
+  // Holds the data of log_data drained from the wrapper.
+  fs_testing::utils::BlockStore block_store_;
   std::vector<std::vector<fs_testing::utils::DiskMod>> mods_;
 
+  unsigned int jobs_ = 1;
+  unsigned int quiesce_window_ms_ = 0;
+  long filesys_size_ = 0;
+  std::string mount_point_;
+  std::string image_cache_dir_;
+  unsigned int max_log_mb_ = 0;
+
+  // Drains the wrapper log to log_spill_ while the workload runs.
+  std::thread log_drain_thread_;
+  std::atomic<bool> log_drain_stop_{false};
+  std::atomic<bool> log_drain_ok_{true};
+  std::unique_ptr<fs_testing::utils::ProfileLogWriter> log_spill_;
+  std::string log_spill_path_;
+  // HWM_CHECKPOINT calls since the wrapper log was last cleared.
+  unsigned int logged_checkpoints_ = 0;
+
+  // A forked process that mounts, fscks, and runs the user test on crash states
+  // written to its own snapshot device.
+  struct CheckWorker {
+    pid_t pid = -1;
+    // Socket used to send crash states to the worker and get results back.
+    int fd = -1;
+    std::string device_path;
+    std::string mount_point;
+    bool busy = false;
+    SingleTestInfo test_info;
+    fs_testing::utils::Fingerprint state_key;
+  };
+  std::vector<CheckWorker> check_workers_;
+
+  // Results of checking permuted crash states, keyed by a fingerprint of the
+  // last checkpoint and the disk contents the crash state produced.
+  struct CachedCheck {
+    unsigned int test_num;
+    FileSystemTestResult fs_test;
+    fs_testing::tests::DataTestResult data_test;
+  };
+  std::unordered_map<fs_testing::utils::Fingerprint, CachedCheck,
+      fs_testing::utils::FingerprintHash> check_cache_;
+  // Fingerprint of the prefix shared by crash states with prefix_key_epochs_
+  // epochs of prefix, so only the writes after it are hashed for each state.
+  unsigned int prefix_key_epochs_ = 0;
+  unsigned int prefix_key_size_ = 0;
+  fs_testing::utils::Fingerprint prefix_key_ = {};
+
   int mount_device(const char* dev, const char* opts);
 
   bool read_dirty_expire_time(int fd);
@@ -176,19 +267,67 @@ class Tester {
   bool test_write_data(const int disk_fd,
       const std::vector<fs_testing::utils::DiskWriteData>::iterator &start,
       const std::vector<fs_testing::utils::DiskWriteData>::iterator &end);
+  std::string snapshot_device_path(unsigned int snapshot);
+  std::string formatted_image_path(const std::string &mkfs_command);
+  int load_disk_image(const std::string &path);
+  void spill_wrapper_log();
+  void stop_log_drain();
+  fs_testing::utils::Fingerprint crash_state_key(
+      std::vector<fs_testing::utils::DiskWriteData> &crash_state,
+      const fs_testing::PermuteTestResult &permute_data, bool use_prefix);
+  void add_writes_to_fingerprint(
+      const std::vector<fs_testing::utils::DiskWriteData>::iterator &start,
+      const std::vector<fs_testing::utils::DiskWriteData>::iterator &end,
+      fs_testing::utils::FingerprintBuilder &builder);
+  void cache_check_result(const fs_testing::utils::Fingerprint &state_key,
+      const SingleTestInfo &test_info);
+  int update_prefix_snapshot(
+      const std::vector<fs_testing::utils::DiskWriteData>::iterator &start,
+      const std::vector<fs_testing::utils::DiskWriteData>::iterator &end,
+      bool restore);
 
   std::vector<std::chrono::milliseconds> test_fsck_and_user_test(
       const std::string device_path, const unsigned int last_checkpoint,
       SingleTestInfo &test_info, bool automate_check_test);
 
   bool check_disk_and_snapshot_contents(std::string disk_path, int last_checkpoint);
+  DiskContents *get_oracle_manifest(int checkpoint);
+  void release_oracle_mounts();
+
+  int start_check_workers();
+  void stop_check_workers();
+  void fail_pending_checks(std::ofstream &log);
+  void run_check_worker(const CheckWorker &worker);
+  void dispatch_check(CheckWorker &worker, SingleTestInfo &test_info,
+      const fs_testing::utils::Fingerprint &state_key);
+  int collect_check_results(std::ofstream &log, bool wait_for_all);
+  void finish_permutation_check(SingleTestInfo &test_info,
+      const std::vector<std::chrono::milliseconds> &check_res,
+      std::ofstream &log);
 
   std::vector<TestSuiteResult> test_results_;
   std::chrono::milliseconds timing_stats[NUM_TIME] =
       {std::chrono::milliseconds(0)};
+  fs_testing::utils::FingerprintSetStats crash_state_stats_ = {};
+  // Shared by all bio writes so its buffers and syscall count persist.
+  fs_testing::utils::ExtentWriter extent_writer_;
+  unsigned long long crash_states_written_ = 0;
+  // Cost of logging the workload's bios, from the wrapper.
+  unsigned long long logged_bios_ = 0;
+  unsigned long long logged_bytes_ = 0;
+  unsigned long long logging_overhead_ns_ = 0;
+  unsigned long long logging_arena_misses_ = 0;
+  unsigned long long logging_throttle_ns_ = 0;
+
+  int freeze_oracle_checkpoint();
 
   std::map<int, std::string> checkpointToSnapshot_;
+  // Oracle contents for each checkpoint, walked and hashed the first time a
+  // crash state at that checkpoint is checked.
+  std::map<int, std::unique_ptr<DiskContents>> oracle_manifests_;
   std::string snapshot_path_;
+  // Last checkpoint reached by the oracle run, or -1 when it isn't running.
+  int oracle_checkpoint_ = -1;
 
 };
 
@@ -35,18 +35,23 @@
 #define DIRECTORY_PERMS \
   (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
-#define OPTS_STRING "bd:cf:e:l:m:np:r:s:t:vFIPS:"
+#define OPTS_STRING "bcd:e:f:i:j:l:m:np:q:r:s:t:vDFIL:M:PS:"
 
 namespace {
 
 static const unsigned int kSocketQueueDepth = 2;
 static constexpr char kChangePath[] = "run_changes";
+// Passed to run() so it never stops early at a checkpoint. Checkpoints are
+// counted from 1, so no checkpoint matches it.
+static constexpr int kOracleRunCheckpoint = -1;
 
 }  // namespace
 
 using std::cerr;
 using std::cout;
 using std::endl;
+using std::getline;
+using std::ifstream;
 using std::ofstream;
 using std::string;
 using std::to_string;
@@ -62,260 +67,91 @@ static const option long_options[] = {
   {"test-dev", required_argument, NULL, 'd'},
   {"disk_size", required_argument, NULL, 'e'},
   {"flag-device", required_argument, NULL, 'f'},
+  {"image-cache", required_argument, NULL, 'i'},
+  {"jobs", required_argument, NULL, 'j'},
   {"log-file", required_argument, NULL, 'l'},
   {"mount-opts", required_argument, NULL, 'm'},
   {"dry-run", no_argument, NULL, 'n'},
   {"permuter", required_argument, NULL, 'p'},
+  {"quiesce-window", required_argument, NULL, 'q'},
   {"reload-log-file", required_argument, NULL, 'r'},
   {"iterations", required_argument, NULL, 's'},
   {"fs-type", required_argument, NULL, 't'},
   {"verbose", no_argument, NULL, 'v'},
+  {"daemon", no_argument, NULL, 'D'},
   {"full-bio-replay", no_argument, NULL, 'F'},
   {"no-in-order-replay", no_argument, NULL, 'I'},
+  {"test-list", required_argument, NULL, 'L'},
+  {"max-log-mb", required_argument, NULL, 'M'},
   {"no-permuted-order-replay", no_argument, NULL, 'P'},
   {"sector-size", required_argument, NULL, 'S'},
   {0, 0, 0, 0},
 };
 
-int main(int argc, char** argv) {
-  cout << "running " << argv << endl;
-
-  string dirty_expire_time_centisecs(TEST_DIRTY_EXPIRE_TIME_STRING);
-  string fs_type("ext4");
-  string flags_dev("/dev/vda");
-  string test_dev("/dev/ram0");
-  string mount_opts("");
-  string log_file_save("");
-  string log_file_load("");
-  string permuter(PERMUTER_SO_PATH "RandomPermuter.so");
-  bool background = false;
-  bool automate_check_test = false;
-  bool dry_run = false;
-  bool no_lvm = false;
-  bool verbose = false;
-  bool in_order_replay = true;
-  bool permuted_order_replay = true;
-  bool full_bio_replay = false;
-  int iterations = 10000;
-  int disk_size = 10240;
-  unsigned int sector_size = 512;
-  int option_idx = 0;
-  ServerSocket* background_com = NULL;
-
-  // Parse command line arguments.
-  for (int c = getopt_long(argc, argv, OPTS_STRING, long_options, &option_idx);
-        c != -1;
-        c = getopt_long(argc, argv, OPTS_STRING, long_options, &option_idx)) {
-    switch (c) {
-      case 'b':
-        background = true;
-        break;
-      case 'c':
-        automate_check_test = true;
-        break;
-      case 'f':
-        flags_dev = string(optarg);
-        break;
-      case 'd':
-        test_dev = string(optarg);
-        break;
-      case 'e':
-        disk_size = atoi(optarg);
-        break;
-      case 'l':
-        log_file_save = string(optarg);
-        break;
-      case 'm':
-        mount_opts = string(optarg);
-        break;
-      case 'n':
-        in_order_replay = false;
-        permuted_order_replay = false;
-        dry_run = 1;
-        break;
-      case 'p':
-        permuter = string(optarg);
-        break;
-      case 'r':
-        log_file_load = string(optarg);
-        break;
-      case 's':
-        iterations = atoi(optarg);
-        break;
-      case 't':
-        fs_type = string(optarg);
-        // Convert to lower so we can compare against it later if we want.
-        for (auto c : fs_type) {
-          c = std::tolower(c);
-        }
-        break;
-      case 'v':
-        verbose = true;
-        break;
-      case 'F':
-        full_bio_replay = true;
-        break;
-      case 'I':
-        in_order_replay = false;
-        break;
-      case 'P':
-        permuted_order_replay = false;
-        break;
-      case 'S':
-        sector_size = atoi(optarg);
-        break;
-      case '?':
-      default:
-        return -1;
-    }
-  }
-
+namespace {
 
-  /*****************************************************************************
-   * PHASE 0:
-   * Basic setup of the test harness:
-   * 1. check arguments are sane
-   * 2. load up socket connections if/when needed
-   * 3. load basic kernel modules
-   * 4. load static objects for permuter and test case
-   ****************************************************************************/
-  const unsigned int test_case_idx = optind;
-  const string path = argv[test_case_idx];
+// Settings that apply to every test case the harness runs.
+struct HarnessOptions {
+  string flags_dev;
+  string mount_opts;
+  string log_file_save;
+  string log_file_load;
+  string permuter;
+  string mount_dir;
+  bool background;
+  bool automate_check_test;
+  bool in_order_replay;
+  bool permuted_order_replay;
+  bool full_bio_replay;
+  int iterations;
+  long test_dev_size;
+};
 
+// <date>_<time>-<test name>.log for the test case .so at test_path.
+string LogFileName(const string &test_path) {
   // Get the name of the test being run.
-  int begin = path.rfind('/');
+  int begin = test_path.rfind('/');
   // Remove everything before the last /.
-  string test_name = path.substr(begin + 1);
+  string test_name = test_path.substr(begin + 1);
   // Remove the extension.
   test_name = test_name.substr(0, test_name.length() - 3);
   // Get the date and time stamp and format.
   time_t now = time(0);
   char time_st[18];
   strftime(time_st, sizeof(time_st), "%Y%m%d_%H%M%S", localtime(&now));
-  string s = string(time_st) + "-" + test_name + ".log";
-  ofstream logfile(s);
-
-  // This should be changed in the option is added to mount tests in other
-  // directories.
-  string mount_dir = "/mnt/snapshot"; 
-  if(setenv("MOUNT_FS", mount_dir.c_str(), 1) == -1){
-    cerr << "Error setting environment variable MOUNT_FS" << endl;
-  }
-  
-  cout << "========== PHASE 0: Setting up CrashMonkey basics =========="
-    << endl;
-  logfile << "========== PHASE 0: Setting up CrashMonkey basics =========="
-    << endl;
-  if (test_case_idx == argc) {
-    cerr << "Please give a .so test case to load" << endl;
-    return -1;
-  }
-
-  if (iterations < 0) {
-    cerr << "Please give a positive number of iterations to run" << endl;
-    return -1;
-  }
-
-  if (disk_size <= 0) {
-    cerr << "Please give a positive number for the RAM disk size to use"
-      << endl;
-    return -1;
-  }
-
-  if (sector_size <= 0) {
-    cerr << "Please give a positive number for the sector size" << endl;
-    return -1;
-  }
-
-  // Create a socket to coordinate with the outside world.
-  // TODO(ashmrtn): Fix permissions on the socket.
-  /*
-  struct stat socket_dir;
-  int res = stat(SOCKET_DIR, &socket_dir);
-  // Directory does not exist.
-  if (res < 0 && errno == 2) {
-    if (mkdir(SOCKET_DIR, DIRECTORY_PERMS) < 0) {
-      cerr << "Error creating temp directory" << endl;
-      delete background_com;
-      return -1;
-    }
-  } else if (res < 0) {
-    // Some other error.
-    cerr << "Error trying to find temp directory" << endl;
-    delete background_com;
-    return -1;
-  } else if (!S_ISDIR(socket_dir.st_mode)) {
-    // Something there that's not a directory.
-    cerr << "Something not a directory already exists at " << SOCKET_DIR
-      << endl;
-    delete background_com;
-    return -1;
-  }
-
-  // Incorrect permissions.
-  if ((socket_dir.st_mode & DIRECTORY_PERMS) != DIRECTORY_PERMS) {
-    cout << "Changing permissions on " << SOCKET_DIR << " to be world "
-      << "readable and writable" << endl;
-    if (chmod(SOCKET_DIR, DIRECTORY_PERMS) < 0) {
-      cerr << "Error changing permissions on " << SOCKET_DIR << endl;
-      delete background_com;
-      return -1;
-    }
-  }
-  */
+  return string(time_st) + "-" + test_name + ".log";
+}
 
-  background_com = new ServerSocket(kSocketNameOutbound);
-  if (background_com->Init(kSocketQueueDepth) < 0) {
-    int err_no = errno;
-    cerr << "Error starting socket to listen on " << err_no << endl;
-    delete background_com;
-    return -1;
-  }
+}  // namespace
 
+/*
+ * Runs phases 1 through 3 for the test case at test_path on a harness that has
+ * cow_brd loaded and nothing else set up. Returns -1 if the test case couldn't
+ * be run, in which case the caller has to clean up the harness.
+ */
+static int RunTestCase(Tester &test_harness, const string &test_path,
+    const HarnessOptions &options, ServerSocket *background_com,
+    ofstream &logfile) {
+  const string &flags_dev = options.flags_dev;
+  const string &mount_opts = options.mount_opts;
+  const string &log_file_save = options.log_file_save;
+  const string &log_file_load = options.log_file_load;
+  const string &permuter = options.permuter;
+  const string &mount_dir = options.mount_dir;
+  const bool background = options.background;
+  const bool automate_check_test = options.automate_check_test;
+  const bool in_order_replay = options.in_order_replay;
+  const bool permuted_order_replay = options.permuted_order_replay;
+  const bool full_bio_replay = options.full_bio_replay;
+  const int iterations = options.iterations;
+  const long test_dev_size = options.test_dev_size;
 
-  Tester test_harness(disk_size, sector_size, verbose);
   test_harness.StartTestSuite();
 
-  cout << "Inserting RAM disk module" << endl;
-  logfile << "Inserting RAM disk module" << endl;
-  if (test_harness.insert_cow_brd() != SUCCESS) {
-    cerr << "Error inserting RAM disk module" << endl;
-    return -1;
-  }
-  test_harness.set_fs_type(fs_type);
-  test_harness.set_device(test_dev);
-  FILE *input;
-  char buf[512];
-  if(!(input = popen(("fdisk -l " + test_dev + " | grep " + test_dev + ": ").c_str(), "r"))){
-    cerr << "Error finding the filesize of mounted filesystem" << endl;  
-  }
-  string filesize;
-  while(fgets(buf, 512, input)){
-    filesize += buf;
-  }
-  pclose(input);
-  char *filesize_cstr = new char[filesize.length() + 1];
-  strcpy(filesize_cstr, filesize.c_str()); 
-  char * tok = strtok(filesize_cstr, " ");
-  int pos = 0;
-  while (pos < 4 && tok != NULL){
-    pos ++;
-    tok = strtok(NULL, " ");
-  }
-  long test_dev_size = 0;
-  if(tok != NULL){
-    test_dev_size = atol(tok);
-  }
-  delete [] filesize_cstr;
-  if(setenv("FILESYS_SIZE", filesize.c_str(), 1) == -1){
-    cerr << "Error setting environment variable FILESYS_SIZE" << endl;
-  }
-  
   // Load the class being tested.
   cout << "Loading test case" << endl;
-  if (test_harness.test_load_class(argv[test_case_idx]) != SUCCESS) {
-    test_harness.cleanup_harness();
-      return -1;
+  if (test_harness.test_load_class(test_path.c_str()) != SUCCESS) {
+    return -1;
   }
   
   test_harness.test_init_values(mount_dir, test_dev_size);
@@ -326,24 +162,11 @@ int main(int argc, char** argv) {
   cout << "Loading permuter" << endl;
   logfile << "Loading permuter" << endl;
   if (test_harness.permuter_load_class(permuter.c_str()) != SUCCESS) {
-    test_harness.cleanup_harness();
-      return -1;
-  }
-
-  // Update dirty_expire_time.
-  cout << "Updating dirty_expire_time_centisecs to "
-    << dirty_expire_time_centisecs << endl;
-  logfile << "Updating dirty_expire_time_centisecs to "
-    << dirty_expire_time_centisecs << endl;
-  const char* old_expire_time =
-    test_harness.update_dirty_expire_time(dirty_expire_time_centisecs.c_str());
-  if (old_expire_time == NULL) {
-    cerr << "Error updating dirty_expire_time_centisecs" << endl;
-    test_harness.cleanup_harness();
     return -1;
   }
 
 
+
   /*****************************************************************************
    * PHASE 1:
    * Setup the base image of the disk for snapshots later. This could happen in
@@ -380,7 +203,6 @@ int main(int argc, char** argv) {
     logfile << "Formatting test drive" << endl;
     if (test_harness.format_drive() != SUCCESS) {
       cerr << "Error formatting test drive" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -389,7 +211,6 @@ int main(int argc, char** argv) {
     logfile << "Mounting test file system for pre-test setup" << endl;
     if (test_harness.mount_device_raw(mount_opts.c_str()) != SUCCESS) {
       cerr << "Error mounting test device" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -406,8 +227,6 @@ int main(int argc, char** argv) {
       do {
         if (background_com->WaitForMessage(&command) != SocketError::kNone) {
           cerr << "Error getting message from socket" << endl;
-          delete background_com;
-          test_harness.cleanup_harness();
           return -1;
         }
 
@@ -415,8 +234,6 @@ int main(int argc, char** argv) {
           if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
               SocketError::kNone) {
             cerr << "Error sending response to client" << endl;
-            delete background_com;
-            test_harness.cleanup_harness();
             return -1;
           }
           background_com->CloseClient();
@@ -434,7 +251,6 @@ int main(int argc, char** argv) {
         const pid_t child = fork();
         if (child < 0) {
           cerr << "Error creating child process to run pre-test setup" << endl;
-          test_harness.cleanup_harness();
           return -1;
         } else if (child != 0) {
           // Parent process should wait for child to terminate before proceeding.
@@ -442,11 +258,10 @@ int main(int argc, char** argv) {
           wait(&status);
           if (status != 0) {
             cerr << "Error in pre-test setup" << endl;
-            test_harness.cleanup_harness();
             return -1;
           }
         } else {
-          return test_harness.test_setup();
+          exit(test_harness.test_setup());
         }
       }
     }
@@ -459,7 +274,6 @@ int main(int argc, char** argv) {
     cout << "Unmounting test file system after pre-test setup" << endl;
     logfile << "Unmounting test file system after pre-test setup" << endl;
     if (test_harness.umount_device() != SUCCESS) {
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -467,7 +281,6 @@ int main(int argc, char** argv) {
     cout << "Making new snapshot" << endl;
     logfile << "Making new snapshot" << endl;
     if (test_harness.clone_device() != SUCCESS) {
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -482,7 +295,6 @@ int main(int argc, char** argv) {
       logfile << "Saving snapshot to log file" << endl;
       if (test_harness.log_snapshot_save(log_file_save + "_snap")
           != SUCCESS) {
-        test_harness.cleanup_harness();
         return -1;
       }
     }
@@ -495,7 +307,6 @@ int main(int argc, char** argv) {
     cout << "Loading saved snapshot" << endl;
     logfile << "Loading saved snapshot" << endl;
     if (test_harness.log_snapshot_load(log_file_load + "_snap") != SUCCESS) {
-      test_harness.cleanup_harness();
       return -1;
     }
   }
@@ -524,7 +335,6 @@ int main(int argc, char** argv) {
   logfile << "Clearing caches" << endl;
   if (test_harness.clear_caches() != SUCCESS) {
     cerr << "Error clearing caches" << endl;
-    test_harness.cleanup_harness();
     return -1;
   }
 
@@ -539,7 +349,6 @@ int main(int argc, char** argv) {
     logfile << "Inserting wrapper module into kernel" << endl;
     if (test_harness.insert_wrapper() != SUCCESS) {
       cerr << "Error inserting kernel wrapper module" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -548,7 +357,6 @@ int main(int argc, char** argv) {
     logfile << "Getting wrapper device ioctl fd" << endl;
     if (test_harness.get_wrapper_ioctl() != SUCCESS) {
       cerr << "Error opening device file" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -567,7 +375,6 @@ int main(int argc, char** argv) {
     cout << "Mounting wrapper file system" << endl;
     if (test_harness.mount_wrapper_device(mount_opts.c_str()) != SUCCESS) {
       cerr << "Error mounting wrapper file system" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
 
@@ -592,8 +399,6 @@ int main(int argc, char** argv) {
       if (background_com->SendCommand(SocketMessage::kBeginLogDone) !=
           SocketError::kNone) {
         cerr << "Error telling user ready for workload" << endl;
-        delete background_com;
-        test_harness.cleanup_harness();
         return -1;
       }
       background_com->CloseClient();
@@ -607,8 +412,6 @@ int main(int argc, char** argv) {
       do {
         if (background_com->WaitForMessage(&command) != SocketError::kNone) {
           cerr << "Error getting command from socket" << endl;
-          delete background_com;
-          test_harness.cleanup_harness();
           return -1;
         }
 
@@ -621,16 +424,12 @@ int main(int argc, char** argv) {
               if (background_com->SendCommand(SocketMessage::kCheckpointDone) !=
                   SocketError::kNone) {
                 cerr << "Error telling user done with checkpoint" << endl;
-                delete background_com;
-                test_harness.cleanup_harness();
                 return -1;
               }
             } else {
               if (background_com->SendCommand(SocketMessage::kCheckpointFailed)
                   != SocketError::kNone) {
                 cerr << "Error telling user checkpoint failed" << endl;
-                delete background_com;
-                test_harness.cleanup_harness();
                 return -1;
               }
             }
@@ -640,8 +439,6 @@ int main(int argc, char** argv) {
             if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
                 SocketError::kNone) {
               cerr << "Error sending response to client" << endl;
-              delete background_com;
-              test_harness.cleanup_harness();
               return -1;
             }
             background_com->CloseClient();
@@ -663,15 +460,15 @@ int main(int argc, char** argv) {
       /*************************************************************************
        * If automated_check_test is enabled, a snapshot is taken at every checkpoint
        * in the run() workload. The first iteration is the complete execution of run()
-       * and is profiled. Subsequent iterations save snapshots at every checkpoint()
-       * present in the run() workload.
+       * and is profiled. The second runs run() once more, start to finish, on
+       * an unlogged snapshot and freezes a copy of the file system at every
+       * checkpoint() present in the run() workload.
        ************************************************************************/
       do {
         {
           const pid_t child = fork();
           if (child < 0) {
             cerr << "Error spinning off test process" << endl;
-            test_harness.cleanup_harness();
             return -1;
           } else if (child != 0) {
             pid_t status = -1;
@@ -690,8 +487,6 @@ int main(int argc, char** argv) {
                           != SocketError::kNone) {
                         // TODO(ashmrtn): Handle better.
                         cerr << "Error telling user done with checkpoint" << endl;
-                        delete background_com;
-                        test_harness.cleanup_harness();
                         return -1;
                     }
                   } else {
@@ -700,8 +495,6 @@ int main(int argc, char** argv) {
                         != SocketError::kNone) {
                       // TODO(ashmrtn): Handle better.
                       cerr << "Error telling user checkpoint failed" << endl;
-                      delete background_com;
-                      test_harness.cleanup_harness();
                       return -1;
                     }
                   }
@@ -710,8 +503,6 @@ int main(int argc, char** argv) {
                         SocketMessage::kInvalidCommand)
                       != SocketError::kNone) {
                     cerr << "Error sending response to client" << endl;
-                    delete background_com;
-                    test_harness.cleanup_harness();
                     return -1;
                   }
                 }
@@ -721,7 +512,6 @@ int main(int argc, char** argv) {
             } while (wait_res == 0);
             if (WIFEXITED(status) == 0) {
               cerr << "Error terminating test_run process, status: " << status << endl;
-              test_harness.cleanup_harness();
               return -1;
             } else {
               if (WEXITSTATUS(status) == 1) {
@@ -730,11 +520,10 @@ int main(int argc, char** argv) {
                 if (checkpoint == 0) {
                   cout << "Completely executed run process" << endl;
                 } else {
-                  cout << "Run process hit checkpoint " << checkpoint << endl;
+                  cout << "Completely executed oracle run process" << endl;
                 }
               } else {
                 cerr << "Error in test run, exits with status: " << status << endl;
-                test_harness.cleanup_harness();
                 return -1;
               }
             }
@@ -745,25 +534,25 @@ int main(int argc, char** argv) {
               change_fd = open(kChangePath, O_CREAT | O_WRONLY | O_TRUNC,
                 S_IRUSR | S_IWUSR);
               if (change_fd < 0) {
-                return change_fd;
+                exit(change_fd);
               }
             }
-            const int res = test_harness.test_run(change_fd, checkpoint);
+            const int res = test_harness.test_run(change_fd,
+                (checkpoint == 0) ? 0 : kOracleRunCheckpoint);
 
             if (checkpoint == 0) {
               close(change_fd);
             }
-            return res;
+            exit(res);
           }
         }
         // End wrapper logging for profiling the complete execution of run process
         if (checkpoint == 0) {
-          cout << "Waiting for writeback delay" << endl;
-          logfile << "Waiting for writeback delay" << endl;
-          unsigned int sleep_time = test_harness.GetPostRunDelay();
-          while (sleep_time > 0) {
-            sleep_time = sleep(sleep_time);
-          }
+          cout << "Waiting for writeback" << endl;
+          logfile << "Waiting for writeback" << endl;
+          const long writeback_ms = test_harness.wait_for_writeback().count();
+          cout << "Writeback done after " << writeback_ms << " ms" << endl;
+          logfile << "Writeback done after " << writeback_ms << " ms" << endl;
 
           cout << "Disabling wrapper device logging" << endl;
           logfile << "Disabling wrapper device logging" << endl;
@@ -771,7 +560,6 @@ int main(int argc, char** argv) {
           cout << "Getting wrapper data" << endl;
           logfile << "Getting wrapper data" << endl;
           if (test_harness.get_wrapper_log() != SUCCESS) {
-            test_harness.cleanup_harness();
             return -1;
           }
 
@@ -779,7 +567,6 @@ int main(int argc, char** argv) {
           logfile << "Unmounting wrapper file system after test profiling" << endl;
           if (test_harness.umount_device() != SUCCESS) {
             cerr << "Error unmounting wrapper file system" << endl;
-            test_harness.cleanup_harness();
             return -1;
           }
 
@@ -790,7 +577,6 @@ int main(int argc, char** argv) {
           logfile << "Removing wrapper module from kernel" << endl;
           if (test_harness.remove_wrapper() != SUCCESS) {
             cerr << "Error cleaning up: remove wrapper module" << endl;
-            test_harness.cleanup_harness();
             return -1;
           }
 
@@ -800,45 +586,37 @@ int main(int argc, char** argv) {
           const int change_fd = open(kChangePath, O_RDONLY);
           if (change_fd < 0) {
             cerr << "Error reading change data" << endl;
-            test_harness.cleanup_harness();
             return -1;
           }
 
           if (lseek(change_fd, 0, SEEK_SET) < 0) {
             cerr << "Error reading change data" << endl;
-            test_harness.cleanup_harness();
             return -1;
           }
 
           if (test_harness.GetChangeData(change_fd) != SUCCESS) {
-            test_harness.cleanup_harness();
             return -1;
           }
         } 
 
         if (automate_check_test) {
-          // Map snapshot of the disk to the current checkpoint and unmount the clone
-          test_harness.mapCheckpointToSnapshot(checkpoint);
-          if (checkpoint != 0) {
-            if (test_harness.umount_snapshot() != SUCCESS) {
-              test_harness.cleanup_harness();
+          if (checkpoint == 0) {
+            // Mount a fresh copy of the base image for the oracle run.
+            test_harness.mapCheckpointToSnapshot(checkpoint);
+            if (test_harness.begin_oracle_run() != SUCCESS) {
+              cerr << "Error starting oracle run" << endl;
               return -1;
             }
-          }
-          // get a new diskclone and mount it for next the checkpoint
-          test_harness.getNewDiskClone(checkpoint);
-          if (!last_checkpoint) {
-            if (test_harness.mount_snapshot() != SUCCESS) {
-              test_harness.cleanup_harness();
+          } else {
+            // Every checkpoint has its snapshot now, so reset the snapshot path
+            // for crash states.
+            if (test_harness.end_oracle_run() != SUCCESS) {
               return -1;
             }
+            last_checkpoint = true;
+            test_harness.getCompleteRunDiskClone();
           }
         }
-        // reset the snapshot path if we completed all the executions
-        if (automate_check_test && last_checkpoint) {
-          test_harness.getCompleteRunDiskClone();
-        }
-        // Increment the checkpoint at which run exits
         checkpoint += 1;
       } while (!last_checkpoint && automate_check_test);
     }
@@ -852,12 +630,11 @@ int main(int argc, char** argv) {
     // TODO (P.S.) pull out the common code between the code path when
     // checkpoint is zero above and if background mode is on here
     if (background) {
-      cout << "Waiting for writeback delay" << endl;
-      logfile << "Waiting for writeback delay" << endl;
-      unsigned int sleep_time = test_harness.GetPostRunDelay();
-      while (sleep_time > 0) {
-        sleep_time = sleep(sleep_time);
-      }
+      cout << "Waiting for writeback" << endl;
+      logfile << "Waiting for writeback" << endl;
+      const long writeback_ms = test_harness.wait_for_writeback().count();
+      cout << "Writeback done after " << writeback_ms << " ms" << endl;
+      logfile << "Writeback done after " << writeback_ms << " ms" << endl;
 
       cout << "Disabling wrapper device logging" << endl;
       logfile << "Disabling wrapper device logging" << endl;
@@ -865,7 +642,6 @@ int main(int argc, char** argv) {
       cout << "Getting wrapper data" << endl;
       logfile << "Getting wrapper data" << endl;
       if (test_harness.get_wrapper_log() != SUCCESS) {
-        test_harness.cleanup_harness();
         return -1;
       }
 
@@ -873,7 +649,6 @@ int main(int argc, char** argv) {
       logfile << "Unmounting wrapper file system after test profiling" << endl;
       if (test_harness.umount_device() != SUCCESS) {
         cerr << "Error unmounting wrapper file system" << endl;
-        test_harness.cleanup_harness();
         return -1;
       }
 
@@ -884,7 +659,6 @@ int main(int argc, char** argv) {
       logfile << "Removing wrapper module from kernel" << endl;
       if (test_harness.remove_wrapper() != SUCCESS) {
         cerr << "Error cleaning up: remove wrapper module" << endl;
-        test_harness.cleanup_harness();
         return -1;
       }
 
@@ -894,18 +668,15 @@ int main(int argc, char** argv) {
       const int change_fd = open(kChangePath, O_RDONLY);
       if (change_fd < 0) {
         cerr << "Error reading change data" << endl;
-        test_harness.cleanup_harness();
         return -1;
       }
 
       if (lseek(change_fd, 0, SEEK_SET) < 0) {
         cerr << "Error reading change data" << endl;
-        test_harness.cleanup_harness();
         return -1;
       }
 
       if (test_harness.GetChangeData(change_fd) != SUCCESS) {
-        test_harness.cleanup_harness();
         return -1;
       }
     }
@@ -926,7 +697,6 @@ int main(int argc, char** argv) {
       if (test_harness.log_profile_save(log_file_save + "_profile") != SUCCESS) {
         cerr << "Error saving logged test file" << endl;
         // TODO(ashmrtn): Remove this in later versions?
-        test_harness.cleanup_harness();
         return -1;
       }
     }
@@ -940,8 +710,6 @@ int main(int argc, char** argv) {
       if (background_com->SendCommand(SocketMessage::kEndLogDone) !=
           SocketError::kNone) {
         cerr << "Error telling user done logging" << endl;
-        delete background_com;
-        test_harness.cleanup_harness();
         return -1;
       }
       background_com->CloseClient();
@@ -955,7 +723,6 @@ int main(int argc, char** argv) {
     logfile << "Loading logged profile data from disk" << endl;
     if (test_harness.log_profile_load(log_file_load + "_profile") != SUCCESS) {
       cerr << "Error loading logged test file" << endl;
-      test_harness.cleanup_harness();
       return -1;
     }
   }
@@ -982,8 +749,6 @@ int main(int argc, char** argv) {
       logfile << "+++++ Ready to run tests, please confirm start +++++" << endl;
       if (background_com->WaitForMessage(&command) != SocketError::kNone) {
         cerr << "Error getting command from socket" << endl;
-        delete background_com;
-        test_harness.cleanup_harness();
         return -1;
       }
 
@@ -991,8 +756,6 @@ int main(int argc, char** argv) {
         if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
             SocketError::kNone) {
           cerr << "Error sending response to client" << endl;
-          delete background_com;
-          test_harness.cleanup_harness();
           return -1;
         }
         background_com->CloseClient();
@@ -1022,11 +785,7 @@ int main(int argc, char** argv) {
     test_harness.test_check_random_permutations(full_bio_replay, iterations,
         logfile);
 
-    for (unsigned int i = 0; i < Tester::NUM_TIME; ++i) {
-      cout << "\t" << (Tester::time_stats) i << ": " <<
-        test_harness.get_timing_stat((Tester::time_stats) i).count() <<
-        " ms" << endl;
-    }
+    test_harness.PrintTimingStats(cout);
   }
 
   if (in_order_replay) {
@@ -1043,6 +802,420 @@ int main(int argc, char** argv) {
   test_harness.PrintTestStats(logfile);
   test_harness.EndTestSuite();
 
+  return 0;
+}
+
+/*
+ * Runs test cases one after another without reloading cow_brd in between.
+ * Test cases come from the file at test_list, one .so path per line, or from
+ * run_test commands on the socket until stop_harness is sent if there is no
+ * test list.
+ */
+static int RunDaemon(Tester &test_harness, const string &test_list,
+    const HarnessOptions &options, ServerSocket *background_com) {
+  if (!test_list.empty()) {
+    ifstream tests(test_list);
+    if (!tests.is_open()) {
+      cerr << "Error opening test list " << test_list << endl;
+      return -1;
+    }
+    string test_path;
+    while (getline(tests, test_path)) {
+      if (test_path.empty() || test_path[0] == '#') {
+        continue;
+      }
+      ofstream logfile(LogFileName(test_path));
+      if (RunTestCase(test_harness, test_path, options, background_com,
+            logfile) == 0) {
+        cout << test_path << ": " << test_harness.GetNumFailed()
+          << " failed crash states" << endl;
+      } else {
+        cout << test_path << ": error running test case" << endl;
+      }
+      logfile.close();
+      if (test_harness.reset_for_next_test() != SUCCESS) {
+        cerr << "Error resetting harness for the next test case" << endl;
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  SocketMessage command;
+  while (true) {
+    cout << "+++++ Waiting for a test case to run +++++" << endl;
+    if (background_com->WaitForMessage(&command) != SocketError::kNone) {
+      cerr << "Error getting command from socket" << endl;
+      return -1;
+    }
+
+    if (command.type == SocketMessage::kStopHarness) {
+      if (background_com->SendCommand(SocketMessage::kStopHarnessDone) !=
+          SocketError::kNone) {
+        cerr << "Error sending response to client" << endl;
+        return -1;
+      }
+      background_com->CloseClient();
+      return 0;
+    } else if (command.type != SocketMessage::kRunTest) {
+      if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
+          SocketError::kNone) {
+        cerr << "Error sending response to client" << endl;
+        return -1;
+      }
+      background_com->CloseClient();
+      continue;
+    }
+
+    // The workload reports its checkpoints over the same socket, so the
+    // client waiting on the result can't hold it while the test runs.
+    const int client = background_com->DetachClient();
+    ofstream logfile(LogFileName(command.string_value));
+    SocketMessage done;
+    done.type = SocketMessage::kRunTestDone;
+    done.int_value = -1;
+    if (RunTestCase(test_harness, command.string_value, options,
+          background_com, logfile) == 0) {
+      done.int_value = test_harness.GetNumFailed();
+    }
+    logfile.close();
+    if (background_com->ReplyToDetached(client, done) != SocketError::kNone) {
+      cerr << "Error telling client test case is done" << endl;
+    }
+    if (test_harness.reset_for_next_test() != SUCCESS) {
+      cerr << "Error resetting harness for the next test case" << endl;
+      return -1;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  cout << "running " << argv << endl;
+
+  string dirty_expire_time_centisecs(TEST_DIRTY_EXPIRE_TIME_STRING);
+  string fs_type("ext4");
+  string flags_dev("/dev/vda");
+  string test_dev("/dev/ram0");
+  string mount_opts("");
+  string log_file_save("");
+  string log_file_load("");
+  string permuter(PERMUTER_SO_PATH "RandomPermuter.so");
+  bool background = false;
+  bool automate_check_test = false;
+  bool dry_run = false;
+  bool no_lvm = false;
+  bool verbose = false;
+  bool in_order_replay = true;
+  bool permuted_order_replay = true;
+  bool full_bio_replay = false;
+  bool daemon = false;
+  string test_list("");
+  int iterations = 10000;
+  int disk_size = 10240;
+  int jobs = 1;
+  // Milliseconds without a logged bio after which writeback is considered done.
+  int quiesce_window = 2000;
+  string image_cache("");
+  // Most memory the wrapper's log may use before it is drained to disk. 0 keeps
+  // the whole log in memory.
+  int max_log_mb = 0;
+  unsigned int sector_size = 512;
+  int option_idx = 0;
+  ServerSocket* background_com = NULL;
+
+  // Parse command line arguments.
+  for (int c = getopt_long(argc, argv, OPTS_STRING, long_options, &option_idx);
+        c != -1;
+        c = getopt_long(argc, argv, OPTS_STRING, long_options, &option_idx)) {
+    switch (c) {
+      case 'b':
+        background = true;
+        break;
+      case 'c':
+        automate_check_test = true;
+        break;
+      case 'f':
+        flags_dev = string(optarg);
+        break;
+      case 'd':
+        test_dev = string(optarg);
+        break;
+      case 'e':
+        disk_size = atoi(optarg);
+        break;
+      case 'i':
+        image_cache = string(optarg);
+        break;
+      case 'j':
+        jobs = atoi(optarg);
+        if (jobs < 1) {
+          cerr << "Number of jobs must be at least 1" << endl;
+          return -1;
+        }
+        break;
+      case 'l':
+        log_file_save = string(optarg);
+        break;
+      case 'm':
+        mount_opts = string(optarg);
+        break;
+      case 'n':
+        in_order_replay = false;
+        permuted_order_replay = false;
+        dry_run = 1;
+        break;
+      case 'p':
+        permuter = string(optarg);
+        break;
+      case 'q':
+        quiesce_window = atoi(optarg);
+        if (quiesce_window < 0) {
+          cerr << "Quiesce window must not be negative" << endl;
+          return -1;
+        }
+        break;
+      case 'r':
+        log_file_load = string(optarg);
+        break;
+      case 's':
+        iterations = atoi(optarg);
+        break;
+      case 't':
+        fs_type = string(optarg);
+        // Convert to lower so we can compare against it later if we want.
+        for (auto c : fs_type) {
+          c = std::tolower(c);
+        }
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      case 'D':
+        daemon = true;
+        break;
+      case 'F':
+        full_bio_replay = true;
+        break;
+      case 'I':
+        in_order_replay = false;
+        break;
+      case 'L':
+        test_list = string(optarg);
+        daemon = true;
+        break;
+      case 'M':
+        max_log_mb = atoi(optarg);
+        if (max_log_mb < 0) {
+          cerr << "Max log size must not be negative" << endl;
+          return -1;
+        }
+        break;
+      case 'P':
+        permuted_order_replay = false;
+        break;
+      case 'S':
+        sector_size = atoi(optarg);
+        break;
+      case '?':
+      default:
+        return -1;
+    }
+  }
+
+
+  /*****************************************************************************
+   * PHASE 0:
+   * Basic setup of the test harness:
+   * 1. check arguments are sane
+   * 2. load up socket connections if/when needed
+   * 3. load basic kernel modules
+   * 4. load static objects for permuter and test case
+   ****************************************************************************/
+  if (jobs > 1) {
+    // Check workers mount copies of the same file system at the same time.
+    fs_testing::FsSpecific *fs_ops = fs_testing::GetFsSpecific(fs_type);
+    string duplicate_opts;
+    const bool can_share = fs_ops == NULL ||
+      fs_ops->GetDuplicateMntOpts(duplicate_opts);
+    delete fs_ops;
+    if (!can_share) {
+      cerr << fs_type << " can't mount copies of the same file system at "
+        "once, so crash states can't be checked with more than one job" <<
+        endl;
+      return -1;
+    }
+  }
+
+  const int test_case_idx = optind;
+  if (!daemon && test_case_idx == argc) {
+    cerr << "Please give a .so test case to load" << endl;
+    return -1;
+  }
+  // A daemon logs its own setup here, and each test case to a file of its own.
+  const string path = daemon ? "harness.so" : argv[test_case_idx];
+  ofstream logfile(LogFileName(path));
+
+  // This should be changed in the option is added to mount tests in other
+  // directories.
+  string mount_dir = "/mnt/snapshot"; 
+  if(setenv("MOUNT_FS", mount_dir.c_str(), 1) == -1){
+    cerr << "Error setting environment variable MOUNT_FS" << endl;
+  }
+  
+  cout << "========== PHASE 0: Setting up CrashMonkey basics =========="
+    << endl;
+  logfile << "========== PHASE 0: Setting up CrashMonkey basics =========="
+    << endl;
+  if (daemon && (background || !log_file_save.empty() ||
+        !log_file_load.empty())) {
+    cerr << "Background mode and log files can't be used with daemon mode"
+      << endl;
+    return -1;
+  }
+
+  if (iterations < 0) {
+    cerr << "Please give a positive number of iterations to run" << endl;
+    return -1;
+  }
+
+  if (disk_size <= 0) {
+    cerr << "Please give a positive number for the RAM disk size to use"
+      << endl;
+    return -1;
+  }
+
+  if (sector_size <= 0) {
+    cerr << "Please give a positive number for the sector size" << endl;
+    return -1;
+  }
+
+  // Create a socket to coordinate with the outside world.
+  // TODO(ashmrtn): Fix permissions on the socket.
+  /*
+  struct stat socket_dir;
+  int res = stat(SOCKET_DIR, &socket_dir);
+  // Directory does not exist.
+  if (res < 0 && errno == 2) {
+    if (mkdir(SOCKET_DIR, DIRECTORY_PERMS) < 0) {
+      cerr << "Error creating temp directory" << endl;
+      delete background_com;
+      return -1;
+    }
+  } else if (res < 0) {
+    // Some other error.
+    cerr << "Error trying to find temp directory" << endl;
+    delete background_com;
+    return -1;
+  } else if (!S_ISDIR(socket_dir.st_mode)) {
+    // Something there that's not a directory.
+    cerr << "Something not a directory already exists at " << SOCKET_DIR
+      << endl;
+    delete background_com;
+    return -1;
+  }
+
+  // Incorrect permissions.
+  if ((socket_dir.st_mode & DIRECTORY_PERMS) != DIRECTORY_PERMS) {
+    cout << "Changing permissions on " << SOCKET_DIR << " to be world "
+      << "readable and writable" << endl;
+    if (chmod(SOCKET_DIR, DIRECTORY_PERMS) < 0) {
+      cerr << "Error changing permissions on " << SOCKET_DIR << endl;
+      delete background_com;
+      return -1;
+    }
+  }
+  */
+
+  background_com = new ServerSocket(kSocketNameOutbound);
+  if (background_com->Init(kSocketQueueDepth) < 0) {
+    int err_no = errno;
+    cerr << "Error starting socket to listen on " << err_no << endl;
+    delete background_com;
+    return -1;
+  }
+
+
+  Tester test_harness(disk_size, sector_size, verbose);
+  test_harness.set_jobs(jobs);
+  test_harness.set_quiesce_window(quiesce_window);
+  test_harness.set_image_cache(image_cache);
+  test_harness.set_max_log_mb(max_log_mb);
+
+  cout << "Inserting RAM disk module" << endl;
+  logfile << "Inserting RAM disk module" << endl;
+  if (test_harness.insert_cow_brd() != SUCCESS) {
+    cerr << "Error inserting RAM disk module" << endl;
+    return -1;
+  }
+  test_harness.set_fs_type(fs_type);
+  test_harness.set_device(test_dev);
+  FILE *input;
+  char buf[512];
+  if(!(input = popen(("fdisk -l " + test_dev + " | grep " + test_dev + ": ").c_str(), "r"))){
+    cerr << "Error finding the filesize of mounted filesystem" << endl;  
+  }
+  string filesize;
+  while(fgets(buf, 512, input)){
+    filesize += buf;
+  }
+  pclose(input);
+  char *filesize_cstr = new char[filesize.length() + 1];
+  strcpy(filesize_cstr, filesize.c_str()); 
+  char * tok = strtok(filesize_cstr, " ");
+  int pos = 0;
+  while (pos < 4 && tok != NULL){
+    pos ++;
+    tok = strtok(NULL, " ");
+  }
+  long test_dev_size = 0;
+  if(tok != NULL){
+    test_dev_size = atol(tok);
+  }
+  delete [] filesize_cstr;
+  if(setenv("FILESYS_SIZE", filesize.c_str(), 1) == -1){
+    cerr << "Error setting environment variable FILESYS_SIZE" << endl;
+  }
+
+  // Update dirty_expire_time.
+  cout << "Updating dirty_expire_time_centisecs to "
+    << dirty_expire_time_centisecs << endl;
+  logfile << "Updating dirty_expire_time_centisecs to "
+    << dirty_expire_time_centisecs << endl;
+  const char* old_expire_time =
+    test_harness.update_dirty_expire_time(dirty_expire_time_centisecs.c_str());
+  if (old_expire_time == NULL) {
+    cerr << "Error updating dirty_expire_time_centisecs" << endl;
+    test_harness.cleanup_harness();
+    return -1;
+  }
+
+  HarnessOptions options;
+  options.flags_dev = flags_dev;
+  options.mount_opts = mount_opts;
+  options.log_file_save = log_file_save;
+  options.log_file_load = log_file_load;
+  options.permuter = permuter;
+  options.mount_dir = mount_dir;
+  options.background = background;
+  options.automate_check_test = automate_check_test;
+  options.in_order_replay = in_order_replay;
+  options.permuted_order_replay = permuted_order_replay;
+  options.full_bio_replay = full_bio_replay;
+  options.iterations = iterations;
+  options.test_dev_size = test_dev_size;
+
+  int res;
+  if (daemon) {
+    res = RunDaemon(test_harness, test_list, options, background_com);
+  } else {
+    res = RunTestCase(test_harness, path, options, background_com, logfile);
+  }
+  if (res != 0) {
+    delete background_com;
+    test_harness.cleanup_harness();
+    return -1;
+  }
+
   cout << endl << "========== PHASE 4: Cleaning up ==========" << endl;
   logfile << endl << "========== PHASE 4: Cleaning up ==========" << endl;
 
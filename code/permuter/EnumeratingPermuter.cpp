@@ -0,0 +1,243 @@
+#include <cassert>
+
+#include <climits>
+#include <numeric>
+#include <vector>
+
+#include "Permuter.h"
+#include "EnumeratingPermuter.h"
+
+namespace fs_testing {
+namespace permuter {
+using std::iota;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteData;
+
+EnumeratingPermuter::Cursor::Cursor() {
+  Reset();
+}
+
+void EnumeratingPermuter::Cursor::Reset() {
+  epoch = 0;
+  full_done = false;
+  subset_size = 0;
+  indices.clear();
+}
+
+EnumeratingPermuter::EnumeratingPermuter() { }
+
+EnumeratingPermuter::EnumeratingPermuter(vector<disk_write> *data) { }
+
+void EnumeratingPermuter::init_data(vector<epoch> *data) {
+  bio_slots_.clear();
+  epoch_sectors_.clear();
+  sector_slots_.clear();
+  prefix_ops_.clear();
+  bio_cursor_.Reset();
+  sector_cursor_.Reset();
+
+  unsigned int total_ops = 0;
+  for (epoch &e : *data) {
+    prefix_ops_.push_back(total_ops);
+    total_ops += e.ops.size();
+
+    unsigned int slots = e.ops.size();
+    if (e.has_barrier) {
+      --slots;
+    }
+    bio_slots_.push_back(slots);
+
+    // Sector crash states drop coalesced sectors of the non-barrier ops, so
+    // figure those out once here instead of for every crash state.
+    vector<EpochOpSector> sectors;
+    for (unsigned int i = 0; i < slots; ++i) {
+      vector<EpochOpSector> op_sectors = e.ops.at(i).ToSectors(sector_size_);
+      sectors.insert(sectors.end(), op_sectors.begin(), op_sectors.end());
+    }
+    epoch_sectors_.push_back(CoalesceSectors(e, sectors));
+    sector_slots_.push_back(epoch_sectors_.back().size());
+  }
+}
+
+unsigned long long EnumeratingPermuter::NumEpochStates(const epoch &epoch,
+    unsigned int num_slots) {
+  if (num_slots == 0) {
+    // Only the full epoch.
+    return 1;
+  }
+  if (num_slots >= sizeof(unsigned long long) * CHAR_BIT) {
+    return ULLONG_MAX;
+  }
+  // Every subset of the droppable slots. Without a barrier, keeping all the
+  // slots is the same as the full epoch so it isn't counted twice. The empty
+  // subset is the same as the full version of the epoch before this one.
+  unsigned long long res = 1ULL << num_slots;
+  return (epoch.has_barrier) ? res : res - 1;
+}
+
+unsigned long long EnumeratingPermuter::GetNumCrashStates(
+    bool full_bio_replay) {
+  const vector<unsigned int> &slots =
+    (full_bio_replay) ? bio_slots_ : sector_slots_;
+  unsigned long long total = 0;
+  for (unsigned int i = 0; i < slots.size(); ++i) {
+    unsigned long long epoch_states =
+      NumEpochStates(GetEpochs()->at(i), slots.at(i));
+    if (ULLONG_MAX - total < epoch_states) {
+      return ULLONG_MAX;
+    }
+    total += epoch_states;
+  }
+  return total;
+}
+
+bool EnumeratingPermuter::NextCombination(vector<unsigned int> &indices,
+    unsigned int n) {
+  const unsigned int k = indices.size();
+  // Find the rightmost index that can still be moved to the right.
+  int i = k - 1;
+  while (i >= 0 && indices.at(i) == n - k + i) {
+    --i;
+  }
+  if (i < 0) {
+    return false;
+  }
+  ++indices.at(i);
+  for (unsigned int j = i + 1; j < k; ++j) {
+    indices.at(j) = indices.at(j - 1) + 1;
+  }
+  return true;
+}
+
+bool EnumeratingPermuter::Advance(Cursor &cursor,
+    const vector<unsigned int> &slots) {
+  const unsigned int num_slots = slots.at(cursor.epoch);
+  if (!cursor.full_done) {
+    cursor.full_done = true;
+    // Start with the largest subset that isn't the same as the full epoch.
+    if (num_slots == 0) {
+      cursor.subset_size = 0;
+    } else {
+      cursor.subset_size = (GetEpochs()->at(cursor.epoch).has_barrier)
+        ? num_slots
+        : num_slots - 1;
+    }
+  } else if (NextCombination(cursor.indices, num_slots)) {
+    return true;
+  } else {
+    --cursor.subset_size;
+  }
+
+  if (cursor.subset_size == 0) {
+    // Done with this epoch.
+    ++cursor.epoch;
+    cursor.full_done = false;
+    cursor.indices.clear();
+    return cursor.epoch < slots.size();
+  }
+
+  cursor.indices.resize(cursor.subset_size);
+  iota(cursor.indices.begin(), cursor.indices.end(), 0);
+  return true;
+}
+
+unsigned int EnumeratingPermuter::LastCheckpoint(unsigned int epoch_index,
+    bool full_epoch) {
+  // Same reasoning as in RandomPermuter: a partially persisted epoch only
+  // reaches the checkpoint of the epoch before it.
+  if (full_epoch) {
+    return GetEpochs()->at(epoch_index).checkpoint_epoch;
+  }
+  return (epoch_index > 0)
+    ? GetEpochs()->at(epoch_index - 1).checkpoint_epoch
+    : 0;
+}
+
+bool EnumeratingPermuter::gen_one_state(vector<epoch_op>& res,
+    PermuteTestResult &log_data) {
+  res.clear();
+  vector<epoch> *epochs = GetEpochs();
+  if (bio_cursor_.epoch >= epochs->size()) {
+    return false;
+  }
+
+  const unsigned int target_index = bio_cursor_.epoch;
+  epoch &target = epochs->at(target_index);
+  const bool full_epoch = !bio_cursor_.full_done;
+  log_data.last_checkpoint = LastCheckpoint(target_index, full_epoch);
+  log_data.prefix_epochs = target_index;
+  log_data.prefix_size = prefix_ops_.at(target_index);
+
+  unsigned int num_target = (full_epoch)
+    ? target.ops.size()
+    : bio_cursor_.indices.size();
+  res.reserve(prefix_ops_.at(target_index) + num_target);
+  for (unsigned int i = 0; i < target_index; ++i) {
+    res.insert(res.end(), epochs->at(i).ops.begin(), epochs->at(i).ops.end());
+  }
+  if (full_epoch) {
+    res.insert(res.end(), target.ops.begin(), target.ops.end());
+  } else {
+    // Indices are sorted, so the bios stay in submission order.
+    for (const unsigned int index : bio_cursor_.indices) {
+      res.push_back(target.ops.at(index));
+    }
+  }
+
+  Advance(bio_cursor_, bio_slots_);
+  return true;
+}
+
+bool EnumeratingPermuter::gen_one_sector_state(vector<DiskWriteData> &res,
+    PermuteTestResult &log_data) {
+  res.clear();
+  vector<epoch> *epochs = GetEpochs();
+  if (sector_cursor_.epoch >= epochs->size()) {
+    return false;
+  }
+
+  const unsigned int target_index = sector_cursor_.epoch;
+  epoch &target = epochs->at(target_index);
+  const bool full_epoch = !sector_cursor_.full_done;
+  log_data.last_checkpoint = LastCheckpoint(target_index, full_epoch);
+  log_data.prefix_epochs = target_index;
+  log_data.prefix_size = prefix_ops_.at(target_index);
+
+  unsigned int num_target = (full_epoch)
+    ? target.ops.size()
+    : sector_cursor_.indices.size();
+  res.reserve(prefix_ops_.at(target_index) + num_target);
+  // Epochs before the one we crash in are always written as whole bios.
+  for (unsigned int i = 0; i < target_index; ++i) {
+    for (epoch_op &op : epochs->at(i).ops) {
+      res.push_back(op.ToWriteData());
+    }
+  }
+  if (full_epoch) {
+    for (epoch_op &op : target.ops) {
+      res.push_back(op.ToWriteData());
+    }
+  } else {
+    vector<EpochOpSector> &sectors = epoch_sectors_.at(target_index);
+    for (const unsigned int index : sector_cursor_.indices) {
+      res.push_back(sectors.at(index).ToWriteData());
+    }
+  }
+
+  Advance(sector_cursor_, sector_slots_);
+  return true;
+}
+
+}  // namespace permuter
+}  // namespace fs_testing
+
+extern "C" fs_testing::permuter::Permuter* permuter_get_instance(
+    std::vector<fs_testing::utils::disk_write> *data) {
+  return new fs_testing::permuter::EnumeratingPermuter(data);
+}
+
+extern "C" void permuter_delete_instance(fs_testing::permuter::Permuter* p) {
+  delete p;
+}
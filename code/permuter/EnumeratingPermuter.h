@@ -0,0 +1,86 @@
+#ifndef ENUMERATING_PERMUTER_H
+#define ENUMERATING_PERMUTER_H
+
+#include <vector>
+
+#include "Permuter.h"
+#include "../utils/utils.h"
+#include "../results/PermuteTestResult.h"
+
+namespace fs_testing {
+namespace permuter {
+
+using fs_testing::PermuteTestResult;
+
+/*
+ * Walks the crash state space in a fixed order instead of sampling it. For each
+ * epoch (in order) it first returns the prefix ending with the full epoch, then
+ * every subset of the non-barrier ops (or coalesced sectors when generating
+ * sector crash states) of that epoch, largest subsets first. Since no state is
+ * ever produced twice, the permuter needs neither a random number generator
+ * nor the duplicate tracking done in the Permuter base class, and it can report
+ * exactly how many crash states it will produce.
+ */
+class EnumeratingPermuter : public Permuter {
+ public:
+  EnumeratingPermuter();
+  EnumeratingPermuter(std::vector<fs_testing::utils::disk_write> *data);
+
+  virtual unsigned long long GetNumCrashStates(bool full_bio_replay) override;
+  virtual bool GroupsStatesByPrefix() override { return true; }
+
+ private:
+  /*
+   * Position in the crash state space. The subset of the current epoch that is
+   * being returned is the combination of `subset_size` slots in `indices`.
+   */
+  struct Cursor {
+    Cursor();
+    void Reset();
+
+    unsigned int epoch;
+    bool full_done;
+    unsigned int subset_size;
+    std::vector<unsigned int> indices;
+  };
+
+  virtual void init_data(std::vector<epoch> *data);
+  virtual bool gen_one_state(std::vector<epoch_op>& res,
+      PermuteTestResult &log_data);
+  virtual bool gen_one_sector_state(
+      std::vector<fs_testing::utils::DiskWriteData> &res,
+      PermuteTestResult &log_data) override;
+  virtual bool gen_unique_states() override { return true; }
+
+  /*
+   * Advance the cursor to the next crash state given the number of droppable
+   * slots in each epoch. Returns false once every state has been returned.
+   */
+  bool Advance(Cursor &cursor, const std::vector<unsigned int> &slots);
+  /*
+   * Step `indices` to the next lexicographic combination of the same size drawn
+   * from [0, n). Returns false if `indices` was the last combination.
+   */
+  static bool NextCombination(std::vector<unsigned int> &indices,
+      unsigned int n);
+  static unsigned long long NumEpochStates(const epoch &epoch,
+      unsigned int num_slots);
+
+  unsigned int LastCheckpoint(unsigned int epoch_index, bool full_epoch);
+
+  // Number of ops in the epoch that may be dropped (i.e. all but the barrier).
+  std::vector<unsigned int> bio_slots_;
+  // Coalesced sectors of the droppable ops in each epoch and their counts.
+  std::vector<std::vector<EpochOpSector>> epoch_sectors_;
+  std::vector<unsigned int> sector_slots_;
+  // Number of ops in epochs [0, i).
+  std::vector<unsigned int> prefix_ops_;
+
+  Cursor bio_cursor_;
+  Cursor sector_cursor_;
+};
+
+}  // namespace permuter
+}  // namespace fs_testing
+
+#endif
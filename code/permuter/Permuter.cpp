@@ -1,7 +1,7 @@
 #include <cassert>
 
 #include <algorithm>
-#include <list>
+#include <iterator>
 #include <memory>
 #include <unordered_set>
 #include <vector>
@@ -12,7 +12,7 @@
 namespace fs_testing {
 namespace permuter {
 
-using std::list;
+using std::make_pair;
 using std::pair;
 using std::shared_ptr;
 using std::size_t;
@@ -20,6 +20,9 @@ using std::vector;
 
 using fs_testing::utils::disk_write;
 using fs_testing::utils::DiskWriteData;
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintBuilder;
+using fs_testing::utils::FingerprintSetStats;
 
 namespace {
 
@@ -30,28 +33,6 @@ static const unsigned int kKernelSectorSize = 512;
 }  // namespace
 
 
-size_t BioVectorHash::operator() (const vector<unsigned int>& permutation)
-    const {
-  unsigned int seed = permutation.size();
-  for (const auto& bio_pos : permutation) {
-    seed ^= bio_pos + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-  }
-  return seed;
-}
-
-bool BioVectorEqual::operator() (const std::vector<unsigned int>& a,
-    const std::vector<unsigned int>& b) const {
-  if (a.size() != b.size()) {
-    return false;
-  }
-  for (unsigned int i = 0; i < a.size(); ++i) {
-    if (a.at(i) != b.at(i)) {
-      return false;
-    }
-  }
-  return true;
-}
-
 vector<EpochOpSector> epoch_op::ToSectors(unsigned int sector_size) {
   const unsigned int num_sectors =
     (op.metadata.size + (sector_size - 1)) / sector_size;
@@ -125,58 +106,79 @@ DiskWriteData EpochOpSector::ToWriteData() {
 }
 
 /*
- * Given a disk_write operation and a *sorted* list of already existing ranges,
- * determine if the current operation partially or completely overlaps any of
- * the operations already in the list.
+ * Record the op at `op_index` in `epoch` as the latest writer of its sectors in
+ * `ranges`, noting in the epoch's overlap_map every op whose sectors it
+ * overwrites. Since the ranges are kept disjoint and sorted, this only touches
+ * the ranges the op actually overlaps, making it O(log n) amortized.
  *
- * Returns false if the operation does not belong to any range.
+ * Returns false if the operation does not overlap any earlier operation.
  * Else, returns true.
  */
-bool Permuter::FindOverlapsAndInsert(disk_write &dw,
-    list<pair<unsigned int, unsigned int>> &ranges) const {
-
-  unsigned int start = dw.metadata.write_sector;
-  unsigned int end = start + dw.metadata.size - 1;
-  for (auto range_iter = ranges.begin(); range_iter != ranges.end();
-      range_iter++) {
-    if ((range_iter->first <= start && range_iter->second >= start) ||
-        (range_iter->first <= end && range_iter->second >= end) ||
-        (range_iter->first >= start && range_iter->second <= end)) {
-      // We need to extend our range to cover what we are looking at.
-      if (range_iter->first > dw.metadata.write_sector) {
-        range_iter->first = dw.metadata.write_sector;
-      }
-      unsigned int end =
-        dw.metadata.write_sector + dw.metadata.size - 1;
-      if (range_iter->second < end) {
-        range_iter->second = end;
-      }
-      return true;
-    } else if (range_iter->first > end) {
-      // We assume the list we are given is ordered. Therefore, if the next item
-      // in the list has a start that is greater than the end of the disk_write
-      // in question, we know we won't find anything else in the list this
-      // disk_write overlaps with. In this case, we should insert the
-      // disk_write in the list where we currently are.
-      ranges.insert(range_iter,
-          {dw.metadata.write_sector,
-          dw.metadata.write_sector + dw.metadata.size - 1});
-      return false;
+bool Permuter::FindOverlapsAndInsert(epoch &epoch, unsigned int op_index,
+    SectorRanges &ranges) const {
+  if (epoch.overlap_map.size() <= op_index) {
+    epoch.overlap_map.resize(op_index + 1);
+  }
+
+  const disk_write &dw = epoch.ops.at(op_index).op;
+  if (dw.metadata.size == 0) {
+    // Doesn't write anything so it can't overlap anything.
+    return false;
+  }
+  const unsigned long start = dw.metadata.write_sector;
+  const unsigned long end = start +
+    ((dw.metadata.size + kKernelSectorSize - 1) / kKernelSectorSize) - 1;
+
+  // Find the first range that could contain `start`.
+  auto range_iter = ranges.upper_bound(start);
+  if (range_iter != ranges.begin()) {
+    auto prev_iter = std::prev(range_iter);
+    if (prev_iter->second.first >= start) {
+      range_iter = prev_iter;
     }
   }
 
-  // We reached the end of the list of ranges without finding anything starting
-  // after the end of what we are looking at.
-  ranges.emplace_back(dw.metadata.write_sector,
-      dw.metadata.write_sector + dw.metadata.size - 1);
-  return false;
+  vector<unsigned int> owners;
+  while (range_iter != ranges.end() && range_iter->first <= end) {
+    const unsigned long range_start = range_iter->first;
+    const unsigned long range_end = range_iter->second.first;
+    const unsigned int owner = range_iter->second.second;
+    owners.push_back(owner);
+
+    // Keep whatever parts of the old range we don't cover. The part after us
+    // gets a new entry, which the loop condition will stop at.
+    if (range_end > end) {
+      ranges.emplace(end + 1, make_pair(range_end, owner));
+    }
+    if (range_start < start) {
+      range_iter->second.first = start - 1;
+      ++range_iter;
+    } else {
+      range_iter = ranges.erase(range_iter);
+    }
+  }
+  ranges.emplace(start, make_pair(end, op_index));
+
+  if (owners.empty()) {
+    return false;
+  }
+
+  // The same op may own several of the ranges we replaced.
+  sort(owners.begin(), owners.end());
+  owners.erase(unique(owners.begin(), owners.end()), owners.end());
+  vector<unsigned int> &overlaps = epoch.overlap_map.at(op_index);
+  for (const unsigned int owner : owners) {
+    overlaps.push_back(owner);
+    epoch.overlap_map.at(owner).push_back(op_index);
+  }
+  return true;
 }
 
 void Permuter::InitDataVector(unsigned int sector_size,
     vector<disk_write> &data) {
   sector_size_ = sector_size;
   epochs_.clear();
-  list<pair<unsigned int, unsigned int>> epoch_overlaps;
+  SectorRanges epoch_overlaps;
   struct epoch *current_epoch = NULL;
   // Make sure that the first time we mark a checkpoint epoch, we start at 0 and
   // not 1.
@@ -215,14 +217,15 @@ void Permuter::InitDataVector(unsigned int sector_size,
         continue;
       }
 
+      current_epoch->ops.push_back({abs_index, *curr_op});
+      current_epoch->num_meta += curr_op->is_meta();
+
       // Check if the current operation overlaps anything we have seen already
       // in this epoch.
-      if (FindOverlapsAndInsert(*curr_op, epoch_overlaps)) {
+      if (FindOverlapsAndInsert(*current_epoch,
+            current_epoch->ops.size() - 1, epoch_overlaps)) {
         current_epoch->overlaps = true;
       }
-
-      current_epoch->ops.push_back({abs_index, *curr_op});
-      current_epoch->num_meta += curr_op->is_meta();
       ++abs_index;
       ++curr_op;
     }
@@ -274,10 +277,6 @@ void Permuter::InitDataVector(unsigned int sector_size,
         current_epoch->has_barrier = false;
         current_epoch->overlaps = false;
         current_epoch->checkpoint_epoch = curr_checkpoint_epoch;
-        // We are adding a new operation to the new epoch, so we need to record
-        // it in the list of things to check for overlaps.
-        epoch_overlaps.emplace_back(data_half.metadata.write_sector,
-            data_half.metadata.write_sector + data_half.metadata.size - 1);
 
         // Setup the rest of the data part of the operation.
         // TODO(ashmrtn): Find a better way to handle matching an index to a bio
@@ -285,6 +284,9 @@ void Permuter::InitDataVector(unsigned int sector_size,
         //++abs_index;
         current_epoch->ops.push_back({abs_index, data_half});
         current_epoch->num_meta += data_half.is_meta();
+        // We are adding a new operation to the new epoch, so we need to record
+        // it in the list of things to check for overlaps.
+        FindOverlapsAndInsert(*current_epoch, 0, epoch_overlaps);
 
         ++abs_index;
         ++curr_op;
@@ -303,20 +305,58 @@ void Permuter::InitDataVector(unsigned int sector_size,
       }
     }
   }
+
+  // Barrier ops were never passed to FindOverlapsAndInsert, so give them empty
+  // entries too.
+  for (epoch &e : epochs_) {
+    e.overlap_map.resize(e.ops.size());
+  }
+
+  init_data(&epochs_);
 }
 
 vector<epoch>* Permuter::GetEpochs() {
   return &epochs_;
 }
 
+unsigned long long Permuter::GetNumCrashStates(bool full_bio_replay) {
+  return 0;
+}
+
+void Permuter::ReserveCrashStates(unsigned long num_states) {
+  if (gen_unique_states()) {
+    return;
+  }
+  completed_permutations_.Reserve(num_states);
+}
+
+bool Permuter::GroupsStatesByPrefix() {
+  return false;
+}
+
+FingerprintSetStats Permuter::GetCrashStateStats() const {
+  return completed_permutations_.GetStats();
+}
+
 
 bool Permuter::GenerateCrashState(vector<DiskWriteData> &res,
     PermuteTestResult &log_data) {
   vector<epoch_op> crash_state;
   unsigned long retries = 0;
-  unsigned int exists = 0;
+  bool exists = false;
   bool new_state = true;
-  vector<unsigned int> crash_state_hash;
+  Fingerprint crash_state_hash;
+
+  if (gen_unique_states()) {
+    // No need to check for duplicates, the permuter promises there aren't any.
+    new_state = gen_one_state(crash_state, log_data);
+    res.resize(crash_state.size());
+    for (unsigned int i = 0; i < crash_state.size(); ++i) {
+      res.at(i) = crash_state.at(i).ToWriteData();
+    }
+    log_data.crash_state = res;
+    return new_state;
+  }
 
   unsigned long max_retries =
     ((kRetryMultiplier * completed_permutations_.size()) < kMinRetries)
@@ -325,14 +365,14 @@ bool Permuter::GenerateCrashState(vector<DiskWriteData> &res,
   do {
     new_state = gen_one_state(crash_state, log_data);
 
-    crash_state_hash.clear();
-    crash_state_hash.resize(crash_state.size());
-    for (unsigned int i = 0; i < crash_state.size(); ++i) {
-      crash_state_hash.at(i) = crash_state.at(i).abs_index;
+    FingerprintBuilder builder;
+    for (const epoch_op &op : crash_state) {
+      builder.Add(op.abs_index);
     }
+    crash_state_hash = builder.Finish();
 
     ++retries;
-    exists = completed_permutations_.count(crash_state_hash);
+    exists = completed_permutations_.Contains(crash_state_hash);
     if (!new_state || retries >= max_retries) {
       // We've likely found all possible crash states so just break. The
       // constant in the multiplier was randomly chosen in the hopes that it
@@ -341,7 +381,7 @@ bool Permuter::GenerateCrashState(vector<DiskWriteData> &res,
       // make unique permutations.
       break;
     }
-  } while (exists > 0);
+  } while (exists);
 
   // Move the permuted crash state data over into the returned crash state
   // vector.
@@ -353,8 +393,8 @@ bool Permuter::GenerateCrashState(vector<DiskWriteData> &res,
   // Messy bit to add everything to the logging data struct.
   log_data.crash_state = res;
 
-  if (exists == 0) {
-    completed_permutations_.insert(crash_state_hash);
+  if (!exists) {
+    completed_permutations_.Insert(crash_state_hash);
     // We broke out of the above loop because this state is unique.
     return new_state;
   }
@@ -367,9 +407,15 @@ bool Permuter::GenerateCrashState(vector<DiskWriteData> &res,
 bool Permuter::GenerateSectorCrashState(std::vector<DiskWriteData> &res,
     PermuteTestResult &log_data) {
   unsigned long retries = 0;
-  unsigned int exists = 0;
+  bool exists = false;
   bool new_state = true;
-  vector<unsigned int> crash_state_hash;
+  Fingerprint crash_state_hash;
+
+  if (gen_unique_states()) {
+    new_state = gen_one_sector_state(res, log_data);
+    log_data.crash_state = res;
+    return new_state;
+  }
 
   unsigned long max_retries =
     ((kRetryMultiplier * completed_permutations_.size()) < kMinRetries)
@@ -378,18 +424,18 @@ bool Permuter::GenerateSectorCrashState(std::vector<DiskWriteData> &res,
   do {
     new_state = gen_one_sector_state(res, log_data);
 
-    crash_state_hash.clear();
     // We need both the sector index in the epoch and and which epoch_op that
     // sector came from to ensure uniqueness (would also work to index all
     // sectors across all epoch_ops, but we haven't done that).
-    crash_state_hash.resize(res.size() * 2);
-    for (unsigned int i = 0; i < res.size(); ++i) {
-      crash_state_hash.at((i << 1)) = res.at(i).bio_index;
-      crash_state_hash.at((i << 1) + 1) = res.at(i).bio_sector_index;
+    FingerprintBuilder builder;
+    for (const DiskWriteData &dwd : res) {
+      builder.Add(dwd.bio_index);
+      builder.Add(dwd.bio_sector_index);
     }
+    crash_state_hash = builder.Finish();
 
     ++retries;
-    exists = completed_permutations_.count(crash_state_hash);
+    exists = completed_permutations_.Contains(crash_state_hash);
     if (!new_state || retries >= max_retries) {
       // We've likely found all possible crash states so just break. The
       // constant in the multiplier was randomly chosen in the hopes that it
@@ -398,14 +444,14 @@ bool Permuter::GenerateSectorCrashState(std::vector<DiskWriteData> &res,
       // make unique permutations.
       break;
     }
-  } while (exists > 0);
+  } while (exists);
 
   // Move the permuted crash state data over into the returned crash state
   // vector.
   log_data.crash_state = res;
 
-  if (exists == 0) {
-    completed_permutations_.insert(crash_state_hash);
+  if (!exists) {
+    completed_permutations_.Insert(crash_state_hash);
     // We broke out of the above loop because this state is unique.
     return new_state;
   }
@@ -415,6 +461,38 @@ bool Permuter::GenerateSectorCrashState(std::vector<DiskWriteData> &res,
   return false;
 }
 
+vector<EpochOpSector> Permuter::CoalesceSectors(epoch &epoch,
+    vector<EpochOpSector> &sector_list) {
+  if (!epoch.overlaps) {
+    // Nothing in the epoch writes the same place twice.
+    return sector_list;
+  }
+
+  vector<EpochOpSector> res(sector_list.size());
+  unsigned int num_unique_sectors = 0;
+  std::unordered_set<unsigned int> sector_offsets;
+
+  // Same as below, except sectors of ops that don't overlap anything can't be
+  // overwritten so they skip the set of seen offsets entirely.
+  for (auto iter = sector_list.rbegin(); iter != sector_list.rend(); ++iter) {
+    const unsigned int op_index = iter->parent - epoch.ops.data();
+    assert(op_index < epoch.ops.size());
+    if (epoch.overlap_map.at(op_index).empty()) {
+      res.at(num_unique_sectors) = *iter;
+      ++num_unique_sectors;
+    } else if (sector_offsets.count(iter->disk_offset) == 0) {
+      res.at(num_unique_sectors) = *iter;
+      ++num_unique_sectors;
+      sector_offsets.insert(iter->disk_offset);
+    }
+  }
+
+  res.resize(num_unique_sectors);
+  std::reverse(res.begin(), res.end());
+
+  return res;
+}
+
 vector<EpochOpSector> Permuter::CoalesceSectors(
     vector<EpochOpSector> &sector_list) {
 
@@ -1,11 +1,11 @@
 #ifndef PERMUTER_H
 #define PERMUTER_H
 
-#include <list>
-#include <unordered_set>
+#include <map>
 #include <utility>
 #include <vector>
 
+#include "../utils/FingerprintSet.h"
 #include "../utils/utils.h"
 #include "../results/PermuteTestResult.h"
 
@@ -15,15 +15,6 @@ namespace permuter {
 // Declare just so that we can reference it in a function below.
 struct EpochOpSector;
 
-struct BioVectorHash {
-  std::size_t operator() (const std::vector<unsigned int>& permutation) const;
-};
-
-struct BioVectorEqual {
-  bool operator() (const std::vector<unsigned int>& a,
-      const std::vector<unsigned int>& b) const;
-};
-
 struct epoch_op {
   std::vector<EpochOpSector> ToSectors(unsigned int sector_size);
   fs_testing::utils::DiskWriteData ToWriteData();
@@ -38,6 +29,12 @@ struct epoch {
   bool has_barrier;
   bool overlaps;
   std::vector<struct epoch_op> ops;
+  // Indexed the same as `ops`. For each op, the indices of the other ops in
+  // the epoch that either overwrite part of it or that it overwrites part of.
+  // An op with an empty list shares no sectors with any other op in the epoch,
+  // though ops that only overlap through a third op that overwrote both may
+  // not be listed against each other. Barrier ops are not tracked.
+  std::vector<std::vector<unsigned int>> overlap_map;
 };
 
 /*
@@ -75,6 +72,25 @@ class Permuter {
   bool GenerateSectorCrashState(
       std::vector<fs_testing::utils::DiskWriteData> &res,
       fs_testing::PermuteTestResult &log_data);
+  /*
+   * Returns the number of distinct crash states this permuter can generate for
+   * the data passed to InitDataVector, or 0 if the permuter has no way of
+   * knowing (ex. it picks crash states at random). Saturates instead of
+   * overflowing for very large epochs.
+   */
+  virtual unsigned long long GetNumCrashStates(bool full_bio_replay);
+  /*
+   * Size the set of completed crash states for the given number of crash
+   * states up front so it doesn't need to grow during the run.
+   */
+  void ReserveCrashStates(unsigned long num_states);
+  /*
+   * Returns true if crash states that share the same prefix of epochs (see
+   * PermuteTestResult::prefix_epochs) are generated back to back, so the
+   * harness can write the prefix once and reuse it.
+   */
+  virtual bool GroupsStatesByPrefix();
+  fs_testing::utils::FingerprintSetStats GetCrashStateStats() const;
 
  protected:
   std::vector<epoch>* GetEpochs();
@@ -86,6 +102,13 @@ class Permuter {
    */
   std::vector<EpochOpSector> CoalesceSectors(
       std::vector<EpochOpSector> &sector_list);
+  /*
+   * Same as above, but all sectors must come from ops in `epoch`. Uses the
+   * epoch's overlap_map to skip the work for sectors of ops that don't overlap
+   * anything.
+   */
+  std::vector<EpochOpSector> CoalesceSectors(epoch &epoch,
+      std::vector<EpochOpSector> &sector_list);
 
   unsigned int sector_size_;
 
@@ -96,13 +119,27 @@ class Permuter {
   virtual bool gen_one_sector_state(
       std::vector<fs_testing::utils::DiskWriteData> &res,
       fs_testing::PermuteTestResult &log_data) = 0;
+  /*
+   * Permuters that never return the same crash state twice can override this
+   * to skip the retry loop and the bookkeeping in completed_permutations_.
+   */
+  virtual bool gen_unique_states() { return false; }
+
+  /*
+   * Disjoint ranges of kernel sectors written in the current epoch, keyed by
+   * their first sector. Maps to the last sector in the range and the index in
+   * the epoch of the op that most recently wrote the range.
+   */
+  typedef std::map<unsigned long, std::pair<unsigned long, unsigned int>>
+    SectorRanges;
 
-  bool FindOverlapsAndInsert(fs_testing::utils::disk_write &dw,
-      std::list<std::pair<unsigned int, unsigned int>> &ranges) const;
+  bool FindOverlapsAndInsert(epoch &epoch, unsigned int op_index,
+      SectorRanges &ranges) const;
 
   std::vector<epoch> epochs_;
-  std::unordered_set<std::vector<unsigned int>, BioVectorHash, BioVectorEqual>
-    completed_permutations_;
+  // Fingerprints of the bio (and sector) indices of each crash state returned
+  // so far.
+  fs_testing::utils::FingerprintSet completed_permutations_;
 };
 
 typedef Permuter *permuter_create_t();
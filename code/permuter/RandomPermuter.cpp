@@ -59,6 +59,8 @@ bool RandomPermuter::gen_one_state(vector<epoch_op>& res,
   for (unsigned int i = 0; i < num_epochs - 1; ++i) {
     total_elements += GetEpochs()->at(i).ops.size();
   }
+  log_data.prefix_epochs = num_epochs - 1;
+  log_data.prefix_size = total_elements;
   total_elements += num_requests;
   res.resize(total_elements);
 
@@ -172,6 +174,8 @@ bool RandomPermuter::gen_one_sector_state(vector<DiskWriteData> &res,
   for (unsigned int i = 0; i < num_epochs - 1; ++i) {
     total_elements += epochs->at(i).ops.size();
   }
+  log_data.prefix_epochs = num_epochs - 1;
+  log_data.prefix_size = total_elements;
 
   if (final_epoch.empty()) {
     // No sectors to drop in the final epoch.
@@ -199,7 +203,7 @@ bool RandomPermuter::gen_one_sector_state(vector<DiskWriteData> &res,
       final_epoch.size());
   const unsigned int num_sectors = rand_num_sectors(rand);
 
-  final_epoch = CoalesceSectors(final_epoch);
+  final_epoch = CoalesceSectors(epochs->at(num_epochs - 1), final_epoch);
 
   // Result size is now a known quantity.
   res.resize(total_elements + num_sectors);
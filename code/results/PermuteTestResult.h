@@ -17,6 +17,11 @@ class PermuteTestResult {
 
   unsigned int last_checkpoint;
   std::vector<fs_testing::utils::DiskWriteData> crash_state;
+  // Number of epochs before the one the crash state was generated in, and the
+  // number of entries at the start of crash_state they account for. Crash
+  // states with the same prefix_epochs share those entries.
+  unsigned int prefix_epochs = 0;
+  unsigned int prefix_size = 0;
 
 };
 
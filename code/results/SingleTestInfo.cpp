@@ -45,6 +45,9 @@ void SingleTestInfo::PrintResults(ostream& os) const {
   os << "): ";
   permute_data.PrintCrashState(os) << endl;
   os << "\tlast checkpoint: " << permute_data.last_checkpoint << endl;
+  if (cached_from != 0) {
+    os << "\tsame disk contents as test #" << cached_from << endl;
+  }
   os << "\tfsck result: ";
   fs_test.PrintErrors(os);
   os << endl;
@@ -32,6 +32,10 @@ class SingleTestInfo {
   SingleTestInfo::ResultType GetTestResult() const;
 
   unsigned int test_num;
+  // If the crash state left the disk identical to that of an earlier test, the
+  // number of that test, whose results were reused instead of checking this
+  // crash state. 0 otherwise.
+  unsigned int cached_from = 0;
   fs_testing::tests::DataTestResult data_test;
   fs_testing::FileSystemTestResult fs_test;
   fs_testing::PermuteTestResult permute_data;
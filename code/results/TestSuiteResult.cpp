@@ -14,6 +14,9 @@ using fs_testing::FileSystemTestResult;
 using fs_testing::SingleTestInfo;
 
 void TestSuiteResult::TallyResult(SingleTestInfo &done, ResultSet &set) {
+  if (done.cached_from != 0) {
+    ++set.cached;
+  }
   switch (done.GetTestResult()) {
     case SingleTestInfo::kPassed:
       ++set.num_passed;
@@ -71,12 +74,17 @@ unsigned int TestSuiteResult::GetTimingCompleted() const {
     timing_results_.fsck_required + timing_results_.num_failed;
 }
 
+unsigned int TestSuiteResult::GetFailed() const {
+  return reordering_results_.num_failed + timing_results_.num_failed;
+}
+
 unsigned int TestSuiteResult::GetCompleted() const {
   return GetTimingCompleted() + GetReorderingCompleted();
 }
 
 void TestSuiteResult::PrintResults(ostream& os) const {
   os << "Reordering tests ran " << GetReorderingCompleted() << " tests with" <<
+    "\n\tcached: " << reordering_results_.cached <<
     "\n\tpassed cleanly: " << reordering_results_.num_passed <<
     "\n\tpassed fixed: " << reordering_results_.num_passed_fixed <<
     "\n\tfsck required: " << reordering_results_.fsck_required <<
@@ -24,6 +24,10 @@ struct ResultSet {
   unsigned int other = 0;
 
   unsigned int auto_check_failed = 0;
+
+  // Tests that reused the result of an earlier test with identical disk
+  // contents. These are also counted in the categories above.
+  unsigned int cached = 0;
 };
 
 class TestSuiteResult {
@@ -33,6 +37,7 @@ class TestSuiteResult {
   unsigned int GetCompleted() const;
   unsigned int GetReorderingCompleted() const;
   unsigned int GetTimingCompleted() const;
+  unsigned int GetFailed() const;
   void PrintResults(std::ostream& os) const;
 
  private:
@@ -0,0 +1,55 @@
+#include <getopt.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../utils/ProfileLog.h"
+#include "../utils/utils.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+using fs_testing::utils::disk_write;
+using fs_testing::utils::LoadProfileLog;
+using fs_testing::utils::SaveProfileLog;
+
+/*
+ * Rewrites a profile log (the <log file>_profile file saved with c_harness -l)
+ * in the current compact format. Works on logs in either the old 4K-padded
+ * format or the compact one, so it can also be used to compress a log.
+ */
+int main(int argc, char** argv) {
+  bool compress = false;
+  for (int c = getopt(argc, argv, "z"); c != -1; c = getopt(argc, argv, "z")) {
+    switch (c) {
+      case 'z':
+        compress = true;
+        break;
+      default:
+        cerr << "usage: " << argv[0] << " [-z] <input log> <output log>" <<
+          endl;
+        return -1;
+    }
+  }
+  if (argc - optind != 2) {
+    cerr << "usage: " << argv[0] << " [-z] <input log> <output log>" << endl;
+    return -1;
+  }
+  const string input(argv[optind]);
+  const string output(argv[optind + 1]);
+
+  vector<disk_write> log;
+  if (!LoadProfileLog(input, log)) {
+    cerr << "Error loading " << input << endl;
+    return -1;
+  }
+  if (!SaveProfileLog(output, log, compress)) {
+    cerr << "Error saving " << output << endl;
+    return -1;
+  }
+  cout << "converted " << log.size() << " disk operations" << endl;
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "../utils/communication/ClientSocket.h"
+#include "../utils/communication/SocketUtils.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using fs_testing::utils::communication::ClientSocket;
+using fs_testing::utils::communication::kSocketNameOutbound;
+using fs_testing::utils::communication::SocketError;
+using fs_testing::utils::communication::SocketMessage;
+
+// Asks a c_harness running as a daemon to run a test case and waits for the
+// result. Exits with 0 if no crash states failed and 1 if some did.
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " <test case .so>" << endl;
+    return -1;
+  }
+  // The harness may not be running in the same directory.
+  char path[PATH_MAX];
+  if (realpath(argv[1], path) == NULL) {
+    cerr << "Unable to find " << argv[1] << endl;
+    return -1;
+  }
+
+  ClientSocket conn(kSocketNameOutbound);
+  if (conn.Init() < 0) {
+    return -1;
+  }
+  SocketMessage m;
+  m.type = SocketMessage::kRunTest;
+  m.string_value = path;
+  if (conn.SendMessage(m) != SocketError::kNone) {
+    return -2;
+  }
+
+  SocketMessage ret;
+  if (conn.WaitForMessage(&ret) != SocketError::kNone ||
+      ret.type != SocketMessage::kRunTestDone) {
+    return -3;
+  }
+  if (ret.int_value < 0) {
+    cerr << "Harness couldn't run " << path << endl;
+    return -4;
+  }
+  cout << ret.int_value << " failed crash states" << endl;
+  return ret.int_value != 0;
+}
@@ -0,0 +1,100 @@
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+
+#include "BlockStore.h"
+#include "FileHash.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::memcmp;
+using std::memcpy;
+using std::min;
+using std::shared_ptr;
+using std::size_t;
+
+namespace {
+
+static const size_t kChunkSize = 1024 * 1024;
+
+}  // namespace
+
+const size_t BlockStore::kBlockSize;
+
+BlockStore::BlockStore() : current_(0), added_bytes_(0), stored_bytes_(0) { }
+
+size_t BlockStore::Reserve(const size_t size) {
+  if (current_ < chunks_.size() &&
+      chunks_[current_].size - chunks_[current_].used >= size) {
+    return current_;
+  }
+  // Large bios get a chunk of their own so the rest of the current chunk isn't
+  // wasted.
+  const bool own_chunk = size > kChunkSize / 4;
+  Chunk chunk;
+  chunk.size = own_chunk ? size : kChunkSize;
+  chunk.data = shared_ptr<char>(new char[chunk.size],
+      [](char *c) {delete[] c;});
+  chunk.used = 0;
+  chunks_.push_back(chunk);
+  if (!own_chunk) {
+    current_ = chunks_.size() - 1;
+  }
+  return chunks_.size() - 1;
+}
+
+void BlockStore::Add(disk_write &dw) {
+  shared_ptr<char> old_data = dw.get_data();
+  const size_t size = dw.metadata.size;
+  if (size == 0 || old_data.get() == NULL) {
+    return;
+  }
+  const char *data = old_data.get();
+  added_bytes_ += size;
+
+  const Fingerprint first = HashBytes(data, min(size, kBlockSize));
+  const auto found = blocks_.find(first);
+  if (found != blocks_.end()) {
+    const Chunk &chunk = chunks_[found->second.chunk];
+    const char *start = found->second.data;
+    if (start + size <= chunk.data.get() + chunk.used &&
+        memcmp(start, data, size) == 0) {
+      dw.share_data(shared_ptr<char>(chunk.data, (char *) start));
+      return;
+    }
+  }
+
+  const size_t index = Reserve(size);
+  Chunk &chunk = chunks_[index];
+  char *copy = chunk.data.get() + chunk.used;
+  memcpy(copy, data, size);
+  chunk.used += size;
+  stored_bytes_ += size;
+  blocks_.emplace(first, Block{copy, index});
+  for (size_t off = kBlockSize; off < size; off += kBlockSize) {
+    blocks_.emplace(HashBytes(copy + off, min(size - off, kBlockSize)),
+        Block{copy + off, index});
+  }
+  dw.share_data(shared_ptr<char>(chunk.data, copy));
+}
+
+void BlockStore::Clear() {
+  chunks_.clear();
+  blocks_.clear();
+  current_ = 0;
+  added_bytes_ = 0;
+  stored_bytes_ = 0;
+}
+
+uint64_t BlockStore::GetAddedBytes() const {
+  return added_bytes_;
+}
+
+uint64_t BlockStore::GetStoredBytes() const {
+  return stored_bytes_;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
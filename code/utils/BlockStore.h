@@ -0,0 +1,67 @@
+#ifndef UTILS_BLOCK_STORE_H
+#define UTILS_BLOCK_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "FingerprintSet.h"
+#include "utils.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Holds the data of logged bios with each copy of the same bytes kept only
+ * once. Journaling and copy-on-write file systems write many blocks more than
+ * once, first to the journal or a new location and then to where they belong.
+ *
+ * Data is packed into large chunks, and every 4K block of it is indexed by its
+ * hash. A bio whose data is already in the store, starting at the beginning of
+ * a stored block and running through the blocks after it, shares that data
+ * instead of getting a copy. Bio data is always kept contiguous, so a bio
+ * that only partly matches what is stored gets a copy of its own. Stored data
+ * lives as long as the store or any disk_write using it.
+ */
+class BlockStore {
+ public:
+  static const std::size_t kBlockSize = 4096;
+
+  BlockStore();
+  // Points dw at a copy of its data in the store, sharing data already there
+  // when possible. Whatever dw's data was shared with before is let go.
+  void Add(disk_write &dw);
+  void Clear();
+
+  // Bytes of data added, and the bytes actually kept for them.
+  uint64_t GetAddedBytes() const;
+  uint64_t GetStoredBytes() const;
+
+ private:
+  struct Chunk {
+    std::shared_ptr<char> data;
+    std::size_t size;
+    std::size_t used;
+  };
+  struct Block {
+    const char *data;
+    std::size_t chunk;
+  };
+
+  // Returns the index of a chunk with room for size more bytes.
+  std::size_t Reserve(std::size_t size);
+
+  std::vector<Chunk> chunks_;
+  // Chunk small bios are packed into.
+  std::size_t current_;
+  std::unordered_map<Fingerprint, Block, FingerprintHash> blocks_;
+  uint64_t added_bytes_;
+  uint64_t stored_bytes_;
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_BLOCK_STORE_H
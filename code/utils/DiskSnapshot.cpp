@@ -0,0 +1,421 @@
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "DiskSnapshot.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ios;
+using std::memcmp;
+using std::memcpy;
+using std::min;
+using std::ofstream;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const char kPagesMagic[8] = {'C', 'M', 'S', 'N', 'A', 'P', 'P', 'G'};
+static const uint32_t kPagesVersion = 1;
+static const char kPagesSuffix[] = ".pages";
+static const char kTmpSuffix[] = ".tmp";
+
+// magic, version, page size, device bytes, number of pages, image fingerprint.
+static const size_t kPagesHeaderSize = 8 + 4 + 4 + 8 + 8 + 16;
+// page number, page fingerprint.
+static const size_t kPageEntrySize = 8 + 16;
+
+// Amount of the device or image read at once.
+static const size_t kChunkSize = 1024 * 1024;
+
+struct PageEntry {
+  uint64_t page;
+  Fingerprint contents;
+};
+
+inline void Put32(char *buf, uint32_t val) {
+  val = htobe32(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+inline void Put64(char *buf, uint64_t val) {
+  val = htobe64(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+inline uint32_t Get32(const char *buf) {
+  uint32_t val;
+  memcpy(&val, buf, sizeof(val));
+  return be32toh(val);
+}
+
+inline uint64_t Get64(const char *buf) {
+  uint64_t val;
+  memcpy(&val, buf, sizeof(val));
+  return be64toh(val);
+}
+
+bool IsZero(const char *data, size_t size) {
+  static const char zeros[kDiskSnapshotPageSize] = {0};
+  return memcmp(data, zeros, size) == 0;
+}
+
+Fingerprint PageFingerprint(const char *data, size_t size) {
+  FingerprintBuilder builder;
+  size_t i = 0;
+  for (; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+    uint32_t word;
+    memcpy(&word, data + i, sizeof(word));
+    builder.Add(word);
+  }
+  for (; i < size; ++i) {
+    builder.Add((unsigned char) data[i]);
+  }
+  return builder.Finish();
+}
+
+// The image fingerprint covers where each page is as well as what is in it.
+void AddPage(FingerprintBuilder &image, const PageEntry &entry) {
+  image.Add(entry.page >> 32);
+  image.Add(entry.page);
+  image.Add(entry.contents.hi >> 32);
+  image.Add(entry.contents.hi);
+  image.Add(entry.contents.lo >> 32);
+  image.Add(entry.contents.lo);
+}
+
+bool PreadAll(int fd, char *buf, size_t size, off_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t res = pread(fd, buf + done, size - done, offset + done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    } else if (res <= 0) {
+      return false;
+    }
+    done += res;
+  }
+  return true;
+}
+
+bool PwriteAll(int fd, const char *buf, size_t size, off_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t res = pwrite(fd, buf + done, size - done, offset + done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    } else if (res < 0) {
+      return false;
+    }
+    done += res;
+  }
+  return true;
+}
+
+bool WritePages(const string &path, uint64_t dev_bytes,
+    const vector<PageEntry> &pages, const Fingerprint &image) {
+  vector<char> buf(kPagesHeaderSize + pages.size() * kPageEntrySize);
+  memcpy(buf.data(), kPagesMagic, sizeof(kPagesMagic));
+  Put32(buf.data() + 8, kPagesVersion);
+  Put32(buf.data() + 12, kDiskSnapshotPageSize);
+  Put64(buf.data() + 16, dev_bytes);
+  Put64(buf.data() + 24, pages.size());
+  Put64(buf.data() + 32, image.hi);
+  Put64(buf.data() + 40, image.lo);
+  char *entry = buf.data() + kPagesHeaderSize;
+  for (const PageEntry &page : pages) {
+    Put64(entry, page.page);
+    Put64(entry + 8, page.contents.hi);
+    Put64(entry + 16, page.contents.lo);
+    entry += kPageEntrySize;
+  }
+
+  ofstream out(path, ios::out | ios::binary | ios::trunc);
+  out.write(buf.data(), buf.size());
+  out.close();
+  return !out.fail();
+}
+
+// Returns false if there is no page list at path or it can't be parsed.
+bool ReadPages(const string &path, uint64_t &dev_bytes,
+    vector<PageEntry> &pages, Fingerprint &image) {
+  ifstream in(path, ios::in | ios::binary);
+  char header[kPagesHeaderSize];
+  if (!in.read(header, kPagesHeaderSize) ||
+      memcmp(header, kPagesMagic, sizeof(kPagesMagic)) != 0 ||
+      Get32(header + 8) != kPagesVersion ||
+      Get32(header + 12) != kDiskSnapshotPageSize) {
+    return false;
+  }
+  dev_bytes = Get64(header + 16);
+  const uint64_t num_pages = Get64(header + 24);
+  image.hi = Get64(header + 32);
+  image.lo = Get64(header + 40);
+
+  vector<char> buf(kPageEntrySize);
+  pages.clear();
+  for (uint64_t i = 0; i < num_pages; ++i) {
+    if (!in.read(buf.data(), kPageEntrySize)) {
+      return false;
+    }
+    PageEntry entry;
+    entry.page = Get64(buf.data());
+    entry.contents.hi = Get64(buf.data() + 8);
+    entry.contents.lo = Get64(buf.data() + 16);
+    pages.push_back(entry);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool SaveDiskSnapshot(int dev_fd, uint64_t dev_bytes, const string &path,
+    DiskSnapshotStats *stats) {
+  // Write to temporary files and move them into place at the end so a failed
+  // save never leaves a half written image behind under the real name.
+  const string image_tmp = path + kTmpSuffix;
+  const string pages_path = path + kPagesSuffix;
+  const string pages_tmp = pages_path + kTmpSuffix;
+  const int image_fd =
+    open(image_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (image_fd < 0) {
+    cerr << "error opening disk snapshot file " << image_tmp << endl;
+    return false;
+  }
+
+  vector<char> buf(kChunkSize);
+  vector<PageEntry> pages;
+  FingerprintBuilder image;
+  uint64_t data_bytes = 0;
+  unsigned int extents = 0;
+  bool ok = true;
+  for (uint64_t off = 0; ok && off < dev_bytes; off += kChunkSize) {
+    const size_t chunk = min((uint64_t) kChunkSize, dev_bytes - off);
+    if (!PreadAll(dev_fd, buf.data(), chunk, off)) {
+      cerr << "error reading device for disk snapshot" << endl;
+      ok = false;
+      break;
+    }
+
+    // Write each run of pages that hold data with a single call.
+    size_t run_start = 0;
+    size_t run_size = 0;
+    for (size_t i = 0; i < chunk; i += kDiskSnapshotPageSize) {
+      const size_t page_size = min((size_t) kDiskSnapshotPageSize, chunk - i);
+      const char *page = buf.data() + i;
+      if (!IsZero(page, page_size)) {
+        PageEntry entry;
+        entry.page = (off + i) / kDiskSnapshotPageSize;
+        entry.contents = PageFingerprint(page, page_size);
+        if (pages.empty() || pages.back().page + 1 != entry.page) {
+          ++extents;
+        }
+        pages.push_back(entry);
+        AddPage(image, entry);
+        if (run_size == 0) {
+          run_start = i;
+        }
+        run_size += page_size;
+        data_bytes += page_size;
+      }
+      if (run_size > 0 && (IsZero(page, page_size) || i + page_size == chunk)) {
+        if (!PwriteAll(image_fd, buf.data() + run_start, run_size,
+              off + run_start)) {
+          cerr << "error writing disk snapshot file" << endl;
+          ok = false;
+          break;
+        }
+        run_size = 0;
+      }
+    }
+  }
+
+  // Everything not written above is a hole that reads back as zeros.
+  if (ok && (ftruncate(image_fd, dev_bytes) < 0 || fsync(image_fd) < 0)) {
+    cerr << "error finishing disk snapshot file" << endl;
+    ok = false;
+  }
+  close(image_fd);
+
+  const Fingerprint image_fp = image.Finish();
+  if (ok && !WritePages(pages_tmp, dev_bytes, pages, image_fp)) {
+    cerr << "error writing disk snapshot page list" << endl;
+    ok = false;
+  }
+  if (ok && (rename(image_tmp.c_str(), path.c_str()) < 0 ||
+        rename(pages_tmp.c_str(), pages_path.c_str()) < 0)) {
+    cerr << "error moving disk snapshot into place" << endl;
+    ok = false;
+  }
+  if (!ok) {
+    unlink(image_tmp.c_str());
+    unlink(pages_tmp.c_str());
+    return false;
+  }
+
+  if (stats != NULL) {
+    stats->device_bytes = dev_bytes;
+    stats->data_bytes = data_bytes;
+    stats->extents = extents;
+    stats->image = image_fp;
+  }
+  return true;
+}
+
+bool LoadDiskSnapshot(const string &path, int dev_fd, uint64_t dev_bytes,
+    DiskSnapshotStats *stats) {
+  const int image_fd = open(path.c_str(), O_RDONLY);
+  if (image_fd < 0) {
+    cerr << "error opening disk snapshot file " << path << endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(image_fd, &st) < 0 || (uint64_t) st.st_size < dev_bytes) {
+    cerr << "disk snapshot file " << path << " is smaller than the device"
+      << endl;
+    close(image_fd);
+    return false;
+  }
+
+  // Images saved by older versions don't have a page list and aren't checked.
+  vector<PageEntry> expected;
+  Fingerprint expected_image;
+  uint64_t expected_bytes = 0;
+  const bool check = ReadPages(path + kPagesSuffix, expected_bytes, expected,
+      expected_image);
+  if (check && expected_bytes != dev_bytes) {
+    cerr << "disk snapshot " << path << " is for a device of "
+      << expected_bytes << " bytes" << endl;
+    close(image_fd);
+    return false;
+  }
+
+  vector<char> buf(kChunkSize);
+  FingerprintBuilder image;
+  size_t next_expected = 0;
+  uint64_t data_bytes = 0;
+  unsigned int extents = 0;
+  uint64_t last_page = 0;
+  bool ok = true;
+  uint64_t off = 0;
+  while (ok && off < dev_bytes) {
+    // Find the next extent the image has data for. Without SEEK_DATA support
+    // the whole image is treated as data.
+    off_t data_start = lseek(image_fd, off, SEEK_DATA);
+    off_t data_end;
+    if (data_start < 0 && errno == ENXIO) {
+      break;
+    } else if (data_start < 0 && errno == EINVAL) {
+      data_start = off;
+      data_end = dev_bytes;
+    } else if (data_start < 0) {
+      cerr << "error finding data in disk snapshot file" << endl;
+      ok = false;
+      break;
+    } else {
+      data_end = lseek(image_fd, data_start, SEEK_HOLE);
+      if (data_end < 0) {
+        data_end = dev_bytes;
+      }
+    }
+    uint64_t start = data_start - (data_start % kDiskSnapshotPageSize);
+    uint64_t end = min((uint64_t) data_end, dev_bytes);
+    if (start >= dev_bytes) {
+      break;
+    }
+
+    for (uint64_t chunk_off = start; ok && chunk_off < end;
+        chunk_off += kChunkSize) {
+      const size_t chunk = min((uint64_t) kChunkSize, end - chunk_off);
+      if (!PreadAll(image_fd, buf.data(), chunk, chunk_off)) {
+        cerr << "error reading disk snapshot file" << endl;
+        ok = false;
+        break;
+      }
+
+      size_t run_start = 0;
+      size_t run_size = 0;
+      for (size_t i = 0; i < chunk; i += kDiskSnapshotPageSize) {
+        const size_t page_size =
+          min((size_t) kDiskSnapshotPageSize, chunk - i);
+        const char *page = buf.data() + i;
+        const bool zero = IsZero(page, page_size);
+        if (!zero) {
+          PageEntry entry;
+          entry.page = (chunk_off + i) / kDiskSnapshotPageSize;
+          entry.contents = PageFingerprint(page, page_size);
+          if (check && (next_expected >= expected.size() ||
+                expected[next_expected].page != entry.page ||
+                expected[next_expected].contents != entry.contents)) {
+            cerr << "disk snapshot page " << entry.page
+              << " doesn't match its page list" << endl;
+            ok = false;
+            break;
+          }
+          ++next_expected;
+          if (data_bytes == 0 || last_page + 1 != entry.page) {
+            ++extents;
+          }
+          last_page = entry.page;
+          AddPage(image, entry);
+          if (run_size == 0) {
+            run_start = i;
+          }
+          run_size += page_size;
+          data_bytes += page_size;
+        }
+        if (run_size > 0 && (zero || i + page_size == chunk)) {
+          if (!PwriteAll(dev_fd, buf.data() + run_start, run_size,
+                chunk_off + run_start)) {
+            cerr << "error writing disk snapshot to device" << endl;
+            ok = false;
+            break;
+          }
+          run_size = 0;
+        }
+      }
+    }
+    off = end;
+  }
+  close(image_fd);
+
+  const Fingerprint image_fp = image.Finish();
+  if (ok && check &&
+      (next_expected != expected.size() || image_fp != expected_image)) {
+    cerr << "disk snapshot " << path << " is missing pages in its page list"
+      << endl;
+    ok = false;
+  }
+  if (!ok) {
+    return false;
+  }
+
+  if (stats != NULL) {
+    stats->device_bytes = dev_bytes;
+    stats->data_bytes = data_bytes;
+    stats->extents = extents;
+    stats->image = image_fp;
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
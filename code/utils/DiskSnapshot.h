@@ -0,0 +1,52 @@
+#ifndef UTILS_DISK_SNAPSHOT_H
+#define UTILS_DISK_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+
+#include "FingerprintSet.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Saved copy of the base disk image that crash states are built on.
+ *
+ * cow_brd only allocates pages for sectors that were written, so most of a
+ * freshly formatted disk reads back as zeros. The image is saved as a sparse
+ * file the size of the device where only pages holding data are written, and
+ * loading writes only the extents the file has data for (found with
+ * SEEK_DATA/SEEK_HOLE). Images saved by older versions, which are plain copies
+ * of the whole device, load the same way.
+ *
+ * Next to the image, <path>.pages lists every page that holds data along with
+ * a fingerprint of its contents, and a fingerprint of the whole image built
+ * from them. Loading checks pages against it.
+ */
+
+static const unsigned int kDiskSnapshotPageSize = 4096;
+
+struct DiskSnapshotStats {
+  uint64_t device_bytes;
+  // Bytes in pages that hold data, and the number of runs of such pages.
+  uint64_t data_bytes;
+  unsigned int extents;
+  Fingerprint image;
+};
+
+// Saves the first dev_bytes of the device open at dev_fd to path along with
+// its page list. Returns false if the image could not be written, in which case
+// any image already at path is left as is.
+bool SaveDiskSnapshot(int dev_fd, uint64_t dev_bytes, const std::string &path,
+    DiskSnapshotStats *stats);
+
+// Writes the data in the image at path to the device open at dev_fd, which is
+// expected to read back as zeros everywhere else. Returns false if the image
+// could not be read, is smaller than dev_bytes, or doesn't match its page list.
+bool LoadDiskSnapshot(const std::string &path, int dev_fd, uint64_t dev_bytes,
+    DiskSnapshotStats *stats);
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_DISK_SNAPSHOT_H
@@ -0,0 +1,328 @@
+#include "ExtentWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+namespace fs_testing {
+namespace utils {
+
+using std::free;
+using std::make_pair;
+using std::memcpy;
+using std::size_t;
+
+namespace {
+
+// O_DIRECT needs offsets, sizes, and buffers aligned to the logical block size
+// of the device, which is 512 bytes for the devices CrashMonkey writes to.
+static const unsigned int kDirectAlignment = 512;
+static const size_t kDirectBufferAlignment = 4096;
+// Largest single O_DIRECT write so the bounce buffer stays small.
+static const size_t kMaxDirectWrite = 1 << 20;
+
+}  // namespace
+
+ExtentWriter::ExtentWriter() :
+  extent_ioctl_(false), direct_buffer_(NULL), direct_buffer_size_(0),
+  syscalls_(0) { }
+
+ExtentWriter::~ExtentWriter() {
+  free(direct_buffer_);
+}
+
+void ExtentWriter::Add(unsigned long long offset, unsigned int size,
+    const char *data) {
+  if (size == 0) {
+    return;
+  }
+  const unsigned long long end = offset + size;
+
+  // Find the first extent that could overlap this one.
+  auto iter = extents_.upper_bound(offset);
+  if (iter != extents_.begin()) {
+    auto prev = std::prev(iter);
+    if (prev->first + prev->second.first > offset) {
+      iter = prev;
+    }
+  }
+
+  while (iter != extents_.end() && iter->first < end) {
+    const unsigned long long extent_start = iter->first;
+    const unsigned long long extent_end = extent_start + iter->second.first;
+    const char *extent_data = iter->second.second;
+
+    // Keep the parts of the old extent that fall outside the new one.
+    if (extent_end > end) {
+      extents_.emplace(end, make_pair((unsigned int) (extent_end - end),
+            extent_data + (end - extent_start)));
+    }
+    if (extent_start < offset) {
+      iter->second.first = offset - extent_start;
+      ++iter;
+    } else {
+      iter = extents_.erase(iter);
+    }
+  }
+  extents_.emplace(offset, make_pair(size, data));
+}
+
+void ExtentWriter::Clear() {
+  extents_.clear();
+}
+
+size_t ExtentWriter::size() const {
+  return extents_.size();
+}
+
+unsigned long long ExtentWriter::GetNumSyscalls() const {
+  return syscalls_;
+}
+
+void ExtentWriter::AddToFingerprint(FingerprintBuilder &builder) const {
+  auto iter = extents_.cbegin();
+  while (iter != extents_.cend()) {
+    // Hash each run of contiguous extents as one stream of bytes so that the
+    // boundaries between extents in the run don't matter.
+    const unsigned long long run_start = iter->first;
+    builder.Add(run_start >> 32);
+    builder.Add(run_start);
+
+    unsigned long long next_offset = run_start;
+    uint32_t word = 0;
+    unsigned int word_bytes = 0;
+    for (; iter != extents_.cend() && iter->first == next_offset; ++iter) {
+      const unsigned char *data = (const unsigned char *) iter->second.second;
+      const unsigned int size = iter->second.first;
+      unsigned int i = 0;
+      // Finish off a word started by the previous extent.
+      for (; i < size && word_bytes != 0; ++i) {
+        word |= (uint32_t) data[i] << (8 * word_bytes);
+        if (++word_bytes == sizeof(uint32_t)) {
+          builder.Add(word);
+          word = 0;
+          word_bytes = 0;
+        }
+      }
+      for (; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+        builder.Add((uint32_t) data[i] | (uint32_t) data[i + 1] << 8 |
+            (uint32_t) data[i + 2] << 16 | (uint32_t) data[i + 3] << 24);
+      }
+      for (; i < size; ++i) {
+        word |= (uint32_t) data[i] << (8 * word_bytes);
+        ++word_bytes;
+      }
+      next_offset += size;
+    }
+    if (word_bytes != 0) {
+      builder.Add(word);
+    }
+
+    const unsigned long long run_size = next_offset - run_start;
+    builder.Add(run_size >> 32);
+    builder.Add(run_size);
+  }
+}
+
+void ExtentWriter::EnableExtentIoctl() {
+  extent_ioctl_ = true;
+}
+
+int ExtentWriter::WriteIoctl(const int fd) {
+  ioctl_extents_.clear();
+  for (const auto &extent : extents_) {
+    ioctl_extents_.push_back({extent.first, extent.second.first,
+        (unsigned long long) extent.second.second});
+  }
+  struct cow_brd_extent_batch batch;
+  batch.extents = (unsigned long long) ioctl_extents_.data();
+  batch.num_extents = ioctl_extents_.size();
+
+  ++syscalls_;
+  if (ioctl(fd, COW_BRD_WRITE_EXTENTS, &batch) == 0) {
+    return 1;
+  }
+  return (errno == ENOTTY) ? 0 : -1;
+}
+
+bool ExtentWriter::Write(const int fd) {
+  if (extents_.empty()) {
+    return true;
+  }
+
+  if (extent_ioctl_) {
+    const int res = WriteIoctl(fd);
+    if (res != 0) {
+      return res > 0;
+    }
+    extent_ioctl_ = false;
+  }
+
+  ++syscalls_;
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return false;
+  }
+  const bool direct = flags & O_DIRECT;
+
+  auto run_start = extents_.cbegin();
+  while (run_start != extents_.cend()) {
+    // Extend the run for as long as the extents are back to back.
+    auto run_end = std::next(run_start);
+    unsigned long long next_offset =
+      run_start->first + run_start->second.first;
+    while (run_end != extents_.cend() && run_end->first == next_offset) {
+      next_offset += run_end->second.first;
+      ++run_end;
+    }
+
+    if (!WriteRun(fd, direct, run_start, run_end)) {
+      return false;
+    }
+    run_start = run_end;
+  }
+
+  return true;
+}
+
+bool ExtentWriter::WriteRun(const int fd, const bool direct,
+    const Extents::const_iterator &start,
+    const Extents::const_iterator &end) {
+  if (!direct) {
+    return WriteVectored(fd, start, end);
+  }
+
+  const auto last = std::prev(end);
+  const unsigned long long run_end = last->first + last->second.first;
+  if (start->first % kDirectAlignment == 0 && run_end % kDirectAlignment == 0) {
+    return WriteDirect(fd, start, end);
+  }
+
+  // Can't do this run with O_DIRECT, so drop it just for these writes.
+  const int flags = fcntl(fd, F_GETFL);
+  ++syscalls_;
+  if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+    return false;
+  }
+  ++syscalls_;
+  const bool res = WriteVectored(fd, start, end);
+  ++syscalls_;
+  if (fcntl(fd, F_SETFL, flags) < 0) {
+    return false;
+  }
+  return res;
+}
+
+bool ExtentWriter::ReserveDirectBuffer(size_t size) {
+  if (size <= direct_buffer_size_) {
+    return true;
+  }
+  free(direct_buffer_);
+  direct_buffer_ = NULL;
+  direct_buffer_size_ = 0;
+  void *buf = NULL;
+  if (posix_memalign(&buf, kDirectBufferAlignment, size) != 0) {
+    return false;
+  }
+  direct_buffer_ = (char *) buf;
+  direct_buffer_size_ = size;
+  return true;
+}
+
+bool ExtentWriter::WriteDirect(const int fd,
+    const Extents::const_iterator &start,
+    const Extents::const_iterator &end) {
+  const auto last = std::prev(end);
+  const size_t run_size = last->first + last->second.first - start->first;
+  if (!ReserveDirectBuffer((run_size < kMaxDirectWrite)
+        ? run_size
+        : kMaxDirectWrite)) {
+    return false;
+  }
+
+  // Copy extents into the aligned buffer, flushing it whenever it fills up.
+  // kMaxDirectWrite is a multiple of kDirectAlignment, so every write but the
+  // last is a full buffer and stays aligned.
+  unsigned long long buffer_offset = start->first;
+  size_t buffered = 0;
+  for (auto iter = start; iter != end; ++iter) {
+    const char *data = iter->second.second;
+    size_t remaining = iter->second.first;
+    while (remaining > 0) {
+      const size_t copy = (remaining < direct_buffer_size_ - buffered)
+        ? remaining
+        : direct_buffer_size_ - buffered;
+      memcpy(direct_buffer_ + buffered, data, copy);
+      buffered += copy;
+      data += copy;
+      remaining -= copy;
+
+      if (buffered == direct_buffer_size_ ||
+          (remaining == 0 && std::next(iter) == end)) {
+        size_t written = 0;
+        while (written < buffered) {
+          ++syscalls_;
+          const ssize_t res = pwrite(fd, direct_buffer_ + written,
+              buffered - written, buffer_offset + written);
+          if (res < 0) {
+            return false;
+          }
+          written += res;
+        }
+        buffer_offset += buffered;
+        buffered = 0;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool ExtentWriter::WriteVectored(const int fd,
+    const Extents::const_iterator &start,
+    const Extents::const_iterator &end) {
+  unsigned long long offset = start->first;
+  auto iter = start;
+  while (iter != end) {
+    // pwritev takes at most IOV_MAX buffers at a time.
+    iovecs_.clear();
+    size_t batch_size = 0;
+    for (; iter != end && iovecs_.size() < IOV_MAX; ++iter) {
+      iovecs_.push_back({(void *) iter->second.second, iter->second.first});
+      batch_size += iter->second.first;
+    }
+
+    // Handle short writes by skipping over whatever was already written.
+    struct iovec *iov = iovecs_.data();
+    int iov_count = iovecs_.size();
+    while (batch_size > 0) {
+      ++syscalls_;
+      ssize_t res = pwritev(fd, iov, iov_count, offset);
+      if (res < 0) {
+        return false;
+      }
+      offset += res;
+      batch_size -= res;
+      while (res > 0 && (size_t) res >= iov->iov_len) {
+        res -= iov->iov_len;
+        ++iov;
+        --iov_count;
+      }
+      if (res > 0) {
+        iov->iov_base = (char *) iov->iov_base + res;
+        iov->iov_len -= res;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
@@ -0,0 +1,87 @@
+#ifndef UTILS_EXTENT_WRITER_H
+#define UTILS_EXTENT_WRITER_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "FingerprintSet.h"
+#include "../disk_wrapper_ioctl.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Collects writes destined for a block device and issues them with as few
+ * syscalls as possible. Writes are kept as disjoint extents sorted by device
+ * offset, where a later write replaces any part of an earlier write it
+ * overlaps. Contiguous extents are then sent to the device together with
+ * pwritev, or, if the file descriptor was opened with O_DIRECT, copied into an
+ * aligned buffer and written with a single pwrite.
+ *
+ * The data passed to Add() is not copied and must stay valid until Write()
+ * returns.
+ *
+ * cow_brd devices can instead take every extent in one COW_BRD_WRITE_EXTENTS
+ * ioctl that copies them straight into the device's pages, which Write() tries
+ * first once EnableExtentIoctl() is called.
+ */
+class ExtentWriter {
+ public:
+  ExtentWriter();
+  ~ExtentWriter();
+
+  void Add(unsigned long long offset, unsigned int size, const char *data);
+  // Stays off after the first device that doesn't support the ioctl.
+  void EnableExtentIoctl();
+  /*
+   * Write all extents added since the last call to Clear() to fd. Returns false
+   * if any write fails.
+   */
+  bool Write(const int fd);
+  void Clear();
+  /*
+   * Add the contents of the disk region covered by the extents to builder. The
+   * result only depends on which bytes end up at which offsets, not on how the
+   * writes that put them there were split up or ordered.
+   */
+  void AddToFingerprint(FingerprintBuilder &builder) const;
+
+  // Number of disjoint extents currently held.
+  std::size_t size() const;
+  // Number of syscalls made by Write() since this object was created.
+  unsigned long long GetNumSyscalls() const;
+
+ private:
+  // Maps device offset to the size of the extent and the data for it.
+  typedef std::map<unsigned long long, std::pair<unsigned int, const char *>>
+    Extents;
+
+  bool WriteRun(const int fd, const bool direct,
+      const Extents::const_iterator &start,
+      const Extents::const_iterator &end);
+  bool WriteDirect(const int fd, const Extents::const_iterator &start,
+      const Extents::const_iterator &end);
+  bool WriteVectored(const int fd, const Extents::const_iterator &start,
+      const Extents::const_iterator &end);
+  bool ReserveDirectBuffer(std::size_t size);
+  // Returns 1 if the extents were written, 0 if the ioctl isn't supported, or
+  // -1 if it failed.
+  int WriteIoctl(const int fd);
+
+  Extents extents_;
+  std::vector<struct iovec> iovecs_;
+  bool extent_ioctl_;
+  std::vector<struct cow_brd_extent> ioctl_extents_;
+  char *direct_buffer_;
+  std::size_t direct_buffer_size_;
+  unsigned long long syscalls_;
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_EXTENT_WRITER_H
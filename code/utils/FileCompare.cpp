@@ -0,0 +1,121 @@
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <algorithm>
+#include <vector>
+
+#include "FileCompare.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::max;
+using std::memcmp;
+using std::min;
+using std::vector;
+
+namespace {
+
+static const uint64_t kChunkSize = 256 * 1024;
+
+// Start of the next data at or after pos, or size if the rest of the file is a
+// hole. File systems without SEEK_DATA report everything as data.
+uint64_t NextData(const int fd, const uint64_t pos, const uint64_t size) {
+  const off_t res = lseek(fd, pos, SEEK_DATA);
+  if (res < 0 && errno == ENXIO) {
+    return size;
+  } else if (res < 0) {
+    return pos;
+  }
+  return res;
+}
+
+bool ReadFully(const int fd, char *buf, uint64_t size, uint64_t pos) {
+  while (size > 0) {
+    const ssize_t res = pread(fd, buf, size, pos);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    } else if (res <= 0) {
+      return false;
+    }
+    buf += res;
+    size -= res;
+    pos += res;
+  }
+  return true;
+}
+
+}  // namespace
+
+int CompareFileRanges(const int fd1, const int fd2, const uint64_t offset,
+    const uint64_t length, RangeMismatch *mismatch) {
+  struct stat st1, st2;
+  if (fstat(fd1, &st1) < 0 || fstat(fd2, &st2) < 0) {
+    return -1;
+  }
+  const uint64_t end = offset + length;
+  // Both files have bytes up to common_end, and only the larger one has bytes
+  // from there to any_end.
+  const uint64_t common_end = min(end,
+      max(offset, (uint64_t) min(st1.st_size, st2.st_size)));
+  const uint64_t any_end = min(end,
+      max(offset, (uint64_t) max(st1.st_size, st2.st_size)));
+
+  bool found = false;
+  uint64_t first = 0;
+  uint64_t last = 0;
+  vector<char> buf1(min(kChunkSize, common_end - offset));
+  vector<char> buf2(buf1.size());
+  uint64_t pos = offset;
+  while (pos < common_end) {
+    // Holes in both files read as zeros in both, so they always match.
+    const uint64_t next_data = min(NextData(fd1, pos, st1.st_size),
+        NextData(fd2, pos, st2.st_size));
+    if (next_data > pos) {
+      pos = min(next_data, common_end);
+      continue;
+    }
+
+    const uint64_t chunk = min(kChunkSize, common_end - pos);
+    if (!ReadFully(fd1, buf1.data(), chunk, pos) ||
+        !ReadFully(fd2, buf2.data(), chunk, pos)) {
+      return -1;
+    }
+    if (memcmp(buf1.data(), buf2.data(), chunk) != 0) {
+      uint64_t i = 0;
+      while (buf1[i] == buf2[i]) {
+        ++i;
+      }
+      if (!found) {
+        first = pos + i;
+        found = true;
+      }
+      uint64_t j = chunk - 1;
+      while (buf1[j] == buf2[j]) {
+        --j;
+      }
+      last = pos + j;
+    }
+    pos += chunk;
+  }
+
+  if (common_end < any_end) {
+    if (!found) {
+      first = common_end;
+      found = true;
+    }
+    last = any_end - 1;
+  }
+  if (!found) {
+    return 0;
+  }
+  mismatch->offset = first;
+  mismatch->length = last - first + 1;
+  return 1;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
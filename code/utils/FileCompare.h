@@ -0,0 +1,33 @@
+#ifndef UTILS_FILE_COMPARE_H
+#define UTILS_FILE_COMPARE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Byte-for-byte comparison of the same range in two files. The range is read
+ * in fixed size chunks, so large ranges don't need large buffers, and parts of
+ * the range that are holes in both files are skipped without being read. Bytes
+ * past the end of one file but not the other count as mismatched.
+ */
+
+struct RangeMismatch {
+  // First and last mismatched bytes are at offset and offset + length - 1.
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Compares length bytes starting at offset in the files open at fd1 and fd2.
+// Returns 0 if they match, 1 if they don't and fills in mismatch, or -1 if
+// either file couldn't be read.
+int CompareFileRanges(int fd1, int fd2, uint64_t offset, uint64_t length,
+    RangeMismatch *mismatch);
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_FILE_COMPARE_H
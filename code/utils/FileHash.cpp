@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileHash.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::atomic;
+using std::memcpy;
+using std::min;
+using std::size_t;
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace {
+
+static const uint64_t kC1 = 0x87c37b91114253d5ULL;
+static const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+// Each extra thread needs at least this many files to hash, since starting a
+// thread costs more than hashing a handful of small files.
+static const size_t kMinFilesPerThread = 8;
+// Read size used when a file can't be mapped.
+static const size_t kReadSize = 64 * 1024;
+
+inline uint64_t Rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/*
+ * MurmurHash3 x64_128 state, fed 16 byte blocks. Kept as a struct so a file
+ * that has to be read in pieces hashes the same as one that is mapped.
+ */
+struct Murmur3 {
+  Murmur3() : h1(0), h2(0), len(0) {}
+
+  void Block(const char *data) {
+    uint64_t k1, k2;
+    memcpy(&k1, data, sizeof(k1));
+    memcpy(&k2, data + sizeof(k1), sizeof(k2));
+
+    k1 *= kC1; k1 = Rotl64(k1, 31); k1 *= kC2; h1 ^= k1;
+    h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= kC2; k2 = Rotl64(k2, 33); k2 *= kC1; h2 ^= k2;
+    h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  // Hashes all whole blocks in data and returns how many bytes were used.
+  size_t Blocks(const char *data, size_t size) {
+    const size_t whole = size - (size % 16);
+    for (size_t i = 0; i < whole; i += 16) {
+      Block(data + i);
+    }
+    len += whole;
+    return whole;
+  }
+
+  Fingerprint Finish(const char *tail, size_t tail_size) {
+    const unsigned char *t = (const unsigned char *) tail;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    len += tail_size;
+    for (size_t i = tail_size; i > 8; --i) {
+      k2 ^= ((uint64_t) t[i - 1]) << ((i - 9) * 8);
+    }
+    if (tail_size > 8) {
+      k2 *= kC2; k2 = Rotl64(k2, 33); k2 *= kC1; h2 ^= k2;
+    }
+    for (size_t i = min(tail_size, (size_t) 8); i > 0; --i) {
+      k1 ^= ((uint64_t) t[i - 1]) << ((i - 1) * 8);
+    }
+    if (tail_size > 0) {
+      k1 *= kC1; k1 = Rotl64(k1, 31); k1 *= kC2; h1 ^= k1;
+    }
+
+    uint64_t r1 = h1 ^ len;
+    uint64_t r2 = h2 ^ len;
+    r1 += r2;
+    r2 += r1;
+    r1 = Fmix64(r1);
+    r2 = Fmix64(r2);
+    r1 += r2;
+    r2 += r1;
+
+    Fingerprint res;
+    res.hi = r1;
+    res.lo = r2;
+    return res;
+  }
+
+  uint64_t h1;
+  uint64_t h2;
+  uint64_t len;
+};
+
+// For files that can't be mapped, like those on some special file systems.
+bool HashByReading(const int fd, Fingerprint &hash) {
+  Murmur3 state;
+  vector<char> buf(kReadSize + 16);
+  size_t pending = 0;
+  while (true) {
+    const ssize_t res = read(fd, buf.data() + pending, kReadSize);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    } else if (res < 0) {
+      return false;
+    } else if (res == 0) {
+      break;
+    }
+    pending += res;
+    const size_t used = state.Blocks(buf.data(), pending);
+    memcpy(buf.data(), buf.data() + used, pending - used);
+    pending -= used;
+  }
+  hash = state.Finish(buf.data(), pending);
+  return true;
+}
+
+}  // namespace
+
+Fingerprint HashBytes(const char *data, size_t size) {
+  Murmur3 state;
+  const size_t used = state.Blocks(data, size);
+  return state.Finish(data + used, size - used);
+}
+
+bool HashFile(const string &path, Fingerprint &hash) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    hash = HashBytes(NULL, 0);
+    return true;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    const bool res = HashByReading(fd, hash);
+    close(fd);
+    return res;
+  }
+  close(fd);
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  hash = HashBytes((const char *) data, st.st_size);
+  munmap(data, st.st_size);
+  return true;
+}
+
+void HashFiles(const vector<string> &paths, vector<Fingerprint> &hashes,
+    vector<bool> &ok, unsigned int max_threads) {
+  hashes.assign(paths.size(), Fingerprint());
+  // vector<bool> packs its elements, so threads write their results to a
+  // vector<char> and they are copied over at the end.
+  vector<char> hashed(paths.size(), 0);
+  atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      hashed[i] = HashFile(paths[i], hashes[i]);
+    }
+  };
+
+  const unsigned int num_threads = min((size_t) max_threads,
+      paths.size() / kMinFilesPerThread);
+  vector<thread> threads;
+  for (unsigned int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (thread &t : threads) {
+    t.join();
+  }
+  ok.assign(hashed.begin(), hashed.end());
+}
+
+string FingerprintToString(const Fingerprint &hash) {
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long) hash.hi,
+      (unsigned long long) hash.lo);
+  return string(buf);
+}
+
+}  // namespace utils
+}  // namespace fs_testing
@@ -0,0 +1,37 @@
+#ifndef UTILS_FILE_HASH_H
+#define UTILS_FILE_HASH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "FingerprintSet.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * In-process hashing of file contents for comparing the files in a crash state
+ * against an oracle. The hash is the 128-bit x64 variant of MurmurHash3, which
+ * is fast and well distributed but not cryptographic.
+ */
+
+Fingerprint HashBytes(const char *data, std::size_t size);
+
+// Hashes the contents of the file at path, which is mapped instead of read
+// when it isn't empty. Returns false if the file can't be opened or read.
+bool HashFile(const std::string &path, Fingerprint &hash);
+
+// Hashes every file in paths, spread across at most max_threads threads. ok[i]
+// is false if paths[i] couldn't be hashed.
+void HashFiles(const std::vector<std::string> &paths,
+    std::vector<Fingerprint> &hashes, std::vector<bool> &ok,
+    unsigned int max_threads);
+
+// 32 hex digits, for printing and comparing hashes as strings.
+std::string FingerprintToString(const Fingerprint &hash);
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_FILE_HASH_H
@@ -0,0 +1,185 @@
+#include "FingerprintSet.h"
+
+#include <algorithm>
+
+namespace fs_testing {
+namespace utils {
+
+using std::size_t;
+
+namespace {
+
+static const uint64_t kMul1 = 0x87c37b91114253d5ULL;
+static const uint64_t kMul2 = 0x4cf5ad432745937fULL;
+static const uint64_t kSeed1 = 0x9e3779b97f4a7c15ULL;
+static const uint64_t kSeed2 = 0xc2b2ae3d27d4eb4fULL;
+
+static const size_t kMinCapacity = 16;
+// Don't let a large iteration count make us allocate more than 256MB up front.
+// The table can still grow past this if that many states are actually found.
+static const size_t kMaxReserveCapacity = 1 << 24;
+
+inline uint64_t Rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3 64-bit finalizer.
+inline uint64_t Fmix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+inline size_t NextPowerOfTwo(size_t n) {
+  size_t res = kMinCapacity;
+  while (res < n) {
+    res <<= 1;
+  }
+  return res;
+}
+
+inline bool IsEmpty(const Fingerprint &fp) {
+  return fp.hi == 0 && fp.lo == 0;
+}
+
+}  // namespace
+
+bool Fingerprint::operator==(const Fingerprint &other) const {
+  return hi == other.hi && lo == other.lo;
+}
+
+bool Fingerprint::operator!=(const Fingerprint &other) const {
+  return !(*this == other);
+}
+
+size_t FingerprintHash::operator()(const Fingerprint &fingerprint) const {
+  // The fingerprint is already well mixed, so any part of it will do.
+  return fingerprint.lo;
+}
+
+FingerprintBuilder::FingerprintBuilder() :
+  h1_(kSeed1), h2_(kSeed2), len_(0) { }
+
+void FingerprintBuilder::Add(uint32_t value) {
+  h1_ = Rotl((h1_ ^ value) * kMul1, 31);
+  h2_ = Rotl((h2_ ^ value) * kMul2, 33) + h1_;
+  ++len_;
+}
+
+Fingerprint FingerprintBuilder::Finish() const {
+  uint64_t h1 = h1_ ^ len_;
+  uint64_t h2 = h2_ ^ len_;
+  h1 += h2;
+  h2 += h1;
+  h1 = Fmix(h1);
+  h2 = Fmix(h2);
+  h1 += h2;
+  h2 += h1;
+  return {h1, h2};
+}
+
+FingerprintSet::FingerprintSet() :
+  size_(0), lookups_(0), probe_collisions_(0), max_probe_length_(0),
+  resizes_(0) { }
+
+Fingerprint FingerprintSet::Normalize(const Fingerprint &fp) {
+  // The all zero fingerprint marks an empty slot, so move it somewhere else.
+  if (IsEmpty(fp)) {
+    return {0, 1};
+  }
+  return fp;
+}
+
+void FingerprintSet::Reserve(size_t num_elements) {
+  if (num_elements > kMaxReserveCapacity / 2) {
+    num_elements = kMaxReserveCapacity / 2;
+  }
+  const size_t capacity = NextPowerOfTwo(num_elements * 2);
+  if (capacity > slots_.size()) {
+    Grow(capacity);
+  }
+}
+
+size_t FingerprintSet::FindSlot(const Fingerprint &fp) {
+  const size_t mask = slots_.size() - 1;
+  size_t index = fp.lo & mask;
+  unsigned int probes = 0;
+  ++lookups_;
+  while (!IsEmpty(slots_[index]) && slots_[index] != fp) {
+    index = (index + 1) & mask;
+    ++probes;
+  }
+  probe_collisions_ += probes;
+  if (probes > max_probe_length_) {
+    max_probe_length_ = probes;
+  }
+  return index;
+}
+
+void FingerprintSet::Grow(size_t new_capacity) {
+  std::vector<Fingerprint> old_slots(new_capacity, Fingerprint{0, 0});
+  old_slots.swap(slots_);
+  if (!old_slots.empty()) {
+    ++resizes_;
+  }
+  const size_t mask = slots_.size() - 1;
+  for (const Fingerprint &fp : old_slots) {
+    if (IsEmpty(fp)) {
+      continue;
+    }
+    size_t index = fp.lo & mask;
+    while (!IsEmpty(slots_[index])) {
+      index = (index + 1) & mask;
+    }
+    slots_[index] = fp;
+  }
+}
+
+bool FingerprintSet::Insert(const Fingerprint &fp) {
+  // Keep the load factor at or below 1/2.
+  if ((size_ + 1) * 2 > slots_.size()) {
+    Grow(NextPowerOfTwo((size_ + 1) * 2));
+  }
+  const Fingerprint key = Normalize(fp);
+  const size_t index = FindSlot(key);
+  if (!IsEmpty(slots_[index])) {
+    return false;
+  }
+  slots_[index] = key;
+  ++size_;
+  return true;
+}
+
+bool FingerprintSet::Contains(const Fingerprint &fp) {
+  if (size_ == 0) {
+    return false;
+  }
+  return !IsEmpty(slots_[FindSlot(Normalize(fp))]);
+}
+
+void FingerprintSet::Clear() {
+  std::fill(slots_.begin(), slots_.end(), Fingerprint{0, 0});
+  size_ = 0;
+}
+
+size_t FingerprintSet::size() const {
+  return size_;
+}
+
+FingerprintSetStats FingerprintSet::GetStats() const {
+  FingerprintSetStats res;
+  res.size = size_;
+  res.capacity = slots_.size();
+  res.memory_bytes = slots_.capacity() * sizeof(Fingerprint);
+  res.lookups = lookups_;
+  res.probe_collisions = probe_collisions_;
+  res.max_probe_length = max_probe_length_;
+  res.resizes = resizes_;
+  return res;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
@@ -0,0 +1,99 @@
+#ifndef UTILS_FINGERPRINT_SET_H
+#define UTILS_FINGERPRINT_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * 128-bit fingerprint of a sequence of unsigned ints. Two different sequences
+ * are treated as equal if their fingerprints match, so this must never be used
+ * where a (vanishingly unlikely) false match would be harmful.
+ */
+struct Fingerprint {
+  bool operator==(const Fingerprint &other) const;
+  bool operator!=(const Fingerprint &other) const;
+
+  uint64_t hi;
+  uint64_t lo;
+};
+
+// Lets Fingerprints be used as keys in unordered containers.
+struct FingerprintHash {
+  std::size_t operator()(const Fingerprint &fingerprint) const;
+};
+
+/*
+ * Computes a Fingerprint one element at a time so callers don't have to build
+ * a vector of the whole sequence just to hash it.
+ */
+class FingerprintBuilder {
+ public:
+  FingerprintBuilder();
+  void Add(uint32_t value);
+  Fingerprint Finish() const;
+
+ private:
+  uint64_t h1_;
+  uint64_t h2_;
+  uint64_t len_;
+};
+
+struct FingerprintSetStats {
+  std::size_t size;
+  std::size_t capacity;
+  // Bytes used by the slot table.
+  std::size_t memory_bytes;
+  unsigned long long lookups;
+  // Number of occupied slots skipped over while probing, summed across all
+  // lookups and inserts.
+  unsigned long long probe_collisions;
+  unsigned int max_probe_length;
+  unsigned int resizes;
+};
+
+/*
+ * Set of Fingerprints stored inline in a single power-of-two sized table with
+ * linear probing. The table is kept at most half full so probe sequences stay
+ * short and within a few cache lines.
+ */
+class FingerprintSet {
+ public:
+  FingerprintSet();
+
+  /*
+   * Size the table so that `num_elements` fingerprints can be inserted without
+   * growing it. Never shrinks the table.
+   */
+  void Reserve(std::size_t num_elements);
+  /*
+   * Returns true if the fingerprint was not already in the set.
+   */
+  bool Insert(const Fingerprint &fp);
+  bool Contains(const Fingerprint &fp);
+  void Clear();
+
+  std::size_t size() const;
+  FingerprintSetStats GetStats() const;
+
+ private:
+  // Returns the slot holding `fp` or the empty slot where it should go.
+  std::size_t FindSlot(const Fingerprint &fp);
+  void Grow(std::size_t new_capacity);
+  static Fingerprint Normalize(const Fingerprint &fp);
+
+  std::vector<Fingerprint> slots_;
+  std::size_t size_;
+  unsigned long long lookups_;
+  unsigned long long probe_collisions_;
+  unsigned int max_probe_length_;
+  unsigned int resizes_;
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_FINGERPRINT_SET_H
@@ -0,0 +1,486 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ProfileLog.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ios;
+using std::memcmp;
+using std::memcpy;
+using std::ofstream;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const char kMagic[8] = {'C', 'M', 'P', 'R', 'O', 'F', 'L', 'G'};
+static const uint32_t kVersion = 1;
+
+// magic, version, flags, number of records, index offset.
+static const size_t kHeaderSize = 8 + 4 + 4 + 8 + 8;
+// bi_flags, bi_rw, write_sector, time_ns, size, stored size, encoding,
+// checksum.
+static const size_t kRecordHeaderSize = 4 * 8 + 4 * 4;
+// The checksum is the last field in the record header and isn't covered by
+// itself.
+static const size_t kRecordChecksumOffset = kRecordHeaderSize - 4;
+static const size_t kRecordAlignment = 8;
+
+enum RecordEncoding {
+  kEncodingRaw = 0,
+  kEncodingLz = 1,
+};
+
+// Smallest match the compressor bothers with, and the largest distance back it
+// looks for one.
+static const size_t kMinMatch = 4;
+static const size_t kMaxMatchOffset = 0xffff;
+static const unsigned int kHashBits = 12;
+
+inline size_t PaddedSize(size_t size) {
+  return (size + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+inline void Put32(char *buf, uint32_t val) {
+  val = htobe32(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+inline void Put64(char *buf, uint64_t val) {
+  val = htobe64(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+inline uint32_t Get32(const char *buf) {
+  uint32_t val;
+  memcpy(&val, buf, sizeof(val));
+  return be32toh(val);
+}
+
+inline uint64_t Get64(const char *buf) {
+  uint64_t val;
+  memcpy(&val, buf, sizeof(val));
+  return be64toh(val);
+}
+
+vector<uint32_t> MakeCrc32Table() {
+  vector<uint32_t> table(256);
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (unsigned int k = 0; k < 8; ++k) {
+      c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+/*
+ * Standard (zlib) CRC32.
+ */
+uint32_t Crc32(uint32_t crc, const char *data, size_t size) {
+  static const vector<uint32_t> table = MakeCrc32Table();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ (unsigned char) data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/*
+ * Compression is a small LZ77 variant in the style of LZ4. The data is a series
+ * of sequences, each made of:
+ *    * a token byte, with the number of literals in the high 4 bits and the
+ *      match length minus kMinMatch in the low 4 bits
+ *    * more bytes of literal length if the high bits were 15, each added to
+ *      the length, ending at the first byte that isn't 255
+ *    * the literals
+ *    * the 2 byte little endian offset back to the start of the match
+ *    * more bytes of match length if the low bits were 15, as for literals
+ * The last sequence has only literals and ends at the end of the data. The
+ * decompressed size is stored in the record so it is not encoded here. Runs of
+ * a single byte, like the zeroed blocks common in file system metadata, turn
+ * into a single match with an offset of 1.
+ */
+void PutLength(vector<char> &out, size_t len) {
+  while (len >= 255) {
+    out.push_back((char) 255);
+    len -= 255;
+  }
+  out.push_back((char) len);
+}
+
+void PutSequence(vector<char> &out, const char *literals, size_t num_literals,
+    size_t match_offset, size_t match_len) {
+  const size_t lit_code = (num_literals < 15) ? num_literals : 15;
+  size_t match_code = 0;
+  if (match_len > 0) {
+    match_code = (match_len - kMinMatch < 15) ? match_len - kMinMatch : 15;
+  }
+  out.push_back((char) ((lit_code << 4) | match_code));
+  if (lit_code == 15) {
+    PutLength(out, num_literals - 15);
+  }
+  out.insert(out.end(), literals, literals + num_literals);
+  if (match_len == 0) {
+    return;
+  }
+  out.push_back((char) (match_offset & 0xff));
+  out.push_back((char) (match_offset >> 8));
+  if (match_code == 15) {
+    PutLength(out, match_len - kMinMatch - 15);
+  }
+}
+
+void Compress(const char *in, size_t size, vector<char> &out) {
+  out.clear();
+  // Positions are stored plus one so that 0 means empty.
+  vector<uint32_t> table(1 << kHashBits, 0);
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + kMinMatch <= size) {
+    uint32_t word;
+    memcpy(&word, in + i, sizeof(word));
+    const uint32_t hash = (word * 2654435761U) >> (32 - kHashBits);
+    const size_t candidate = table[hash];
+    table[hash] = i + 1;
+    if (candidate == 0 || i - (candidate - 1) > kMaxMatchOffset ||
+        memcmp(in + candidate - 1, in + i, kMinMatch) != 0) {
+      ++i;
+      continue;
+    }
+
+    const size_t match_start = candidate - 1;
+    size_t len = kMinMatch;
+    while (i + len < size && in[match_start + len] == in[i + len]) {
+      ++len;
+    }
+    PutSequence(out, in + anchor, i - anchor, i - match_start, len);
+    i += len;
+    anchor = i;
+  }
+  PutSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+bool GetLength(const char *&in, const char *end, size_t &len) {
+  unsigned char byte;
+  do {
+    if (in >= end) {
+      return false;
+    }
+    byte = *in++;
+    len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool Decompress(const char *in, size_t in_size, char *out, size_t out_size) {
+  const char *in_end = in + in_size;
+  size_t done = 0;
+  while (true) {
+    if (in >= in_end) {
+      return false;
+    }
+    const unsigned char token = *in++;
+    size_t num_literals = token >> 4;
+    if (num_literals == 15 && !GetLength(in, in_end, num_literals)) {
+      return false;
+    }
+    if (num_literals > (size_t) (in_end - in) ||
+        num_literals > out_size - done) {
+      return false;
+    }
+    memcpy(out + done, in, num_literals);
+    in += num_literals;
+    done += num_literals;
+
+    if (in == in_end) {
+      // Only the last sequence is allowed to have no match.
+      return done == out_size;
+    }
+
+    if (in_end - in < 2) {
+      return false;
+    }
+    const size_t offset =
+      (unsigned char) in[0] | ((size_t) (unsigned char) in[1] << 8);
+    in += 2;
+    size_t match_len = token & 0xf;
+    if (match_len == 15 && !GetLength(in, in_end, match_len)) {
+      return false;
+    }
+    match_len += kMinMatch;
+    if (offset == 0 || offset > done || match_len > out_size - done) {
+      return false;
+    }
+    // Matches can overlap the bytes they produce, so copy a byte at a time.
+    const char *src = out + done - offset;
+    for (size_t j = 0; j < match_len; ++j) {
+      out[done + j] = src[j];
+    }
+    done += match_len;
+  }
+}
+
+/*
+ * Keeps a mapping of a profile log alive for as long as any disk_write points
+ * into it.
+ */
+class Mapping {
+ public:
+  Mapping(char *addr, size_t size) : addr_(addr), size_(size) { }
+  ~Mapping() {
+    munmap(addr_, size_);
+  }
+
+ private:
+  char *addr_;
+  size_t size_;
+};
+
+}  // namespace
+
+ProfileLogWriter::ProfileLogWriter(bool compress) : compress_(compress) { }
+
+bool ProfileLogWriter::Open(const string &path) {
+  path_ = path;
+  index_.clear();
+  offset_ = kHeaderSize;
+  out_.open(path, std::ofstream::trunc | ios::binary);
+  if (!out_.is_open()) {
+    cerr << "error opening profile log " << path << endl;
+    return false;
+  }
+
+  // Filled in by Close once the number of records is known.
+  char header[kHeaderSize];
+  memset(header, 0, kHeaderSize);
+  out_.write(header, kHeaderSize);
+  return out_.good();
+}
+
+bool ProfileLogWriter::Append(disk_write &dw) {
+  const char *data = dw.get_data().get();
+  const uint32_t size = (data == NULL) ? 0 : dw.metadata.size;
+  uint32_t encoding = kEncodingRaw;
+  uint32_t stored_size = size;
+  if (compress_ && size > 0) {
+    Compress(data, size, compressed_);
+    if (compressed_.size() < size) {
+      encoding = kEncodingLz;
+      stored_size = compressed_.size();
+      data = compressed_.data();
+    }
+  }
+
+  char record[kRecordHeaderSize];
+  Put64(record, dw.metadata.bi_flags);
+  Put64(record + 8, dw.metadata.bi_rw);
+  Put64(record + 16, dw.metadata.write_sector);
+  Put64(record + 24, dw.metadata.time_ns);
+  Put32(record + 32, size);
+  Put32(record + 36, stored_size);
+  Put32(record + 40, encoding);
+  uint32_t crc = Crc32(0, record, kRecordChecksumOffset);
+  crc = Crc32(crc, data, stored_size);
+  Put32(record + kRecordChecksumOffset, crc);
+
+  static const char padding[kRecordAlignment] = {0};
+  out_.write(record, kRecordHeaderSize);
+  out_.write(data, stored_size);
+  out_.write(padding, PaddedSize(stored_size) - stored_size);
+  index_.push_back(offset_);
+  offset_ += kRecordHeaderSize + PaddedSize(stored_size);
+  return out_.good();
+}
+
+bool ProfileLogWriter::Close() {
+  // Record index, then its checksum.
+  vector<char> index_buf(index_.size() * 8 + 4);
+  for (size_t i = 0; i < index_.size(); ++i) {
+    Put64(index_buf.data() + i * 8, index_.at(i));
+  }
+  Put32(index_buf.data() + index_.size() * 8,
+      Crc32(0, index_buf.data(), index_.size() * 8));
+  out_.write(index_buf.data(), index_buf.size());
+
+  char header[kHeaderSize];
+  memcpy(header, kMagic, sizeof(kMagic));
+  Put32(header + 8, kVersion);
+  Put32(header + 12, 0);
+  Put64(header + 16, index_.size());
+  Put64(header + 24, offset_);
+  out_.seekp(0);
+  out_.write(header, kHeaderSize);
+  out_.close();
+  if (out_.fail()) {
+    cerr << "error writing profile log " << path_ << endl;
+    return false;
+  }
+  return true;
+}
+
+uint64_t ProfileLogWriter::GetNumRecords() const {
+  return index_.size();
+}
+
+bool SaveProfileLog(const string &path, vector<disk_write> &log,
+    bool compress) {
+  ProfileLogWriter writer(compress);
+  if (!writer.Open(path)) {
+    return false;
+  }
+  for (disk_write &dw : log) {
+    writer.Append(dw);
+  }
+  return writer.Close();
+}
+
+bool IsCompactProfileLog(const string &path) {
+  ifstream in(path, ios::binary);
+  char magic[sizeof(kMagic)];
+  in.read(magic, sizeof(magic));
+  return in.good() && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool LoadProfileLog(const string &path, vector<disk_write> &log) {
+  if (!IsCompactProfileLog(path)) {
+    return LoadLegacyProfileLog(path, log);
+  }
+
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "error opening profile log " << path << endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < kHeaderSize) {
+    cerr << "error reading profile log " << path << endl;
+    close(fd);
+    return false;
+  }
+  const size_t file_size = st.st_size;
+  // Private and writable so nothing that gets handed the data can change the
+  // file, even by accident.
+  void *addr = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+      0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    cerr << "error mapping profile log " << path << endl;
+    return false;
+  }
+  shared_ptr<Mapping> mapping(new Mapping((char *) addr, file_size));
+  const char *file = (const char *) addr;
+
+  const uint32_t version = Get32(file + 8);
+  const uint64_t num_records = Get64(file + 16);
+  const uint64_t index_offset = Get64(file + 24);
+  if (version != kVersion) {
+    cerr << "unsupported profile log version " << version << endl;
+    return false;
+  }
+  if (index_offset > file_size ||
+      num_records > (file_size - index_offset) / 8 ||
+      file_size - index_offset != num_records * 8 + 4) {
+    cerr << "corrupt profile log index" << endl;
+    return false;
+  }
+  const char *index = file + index_offset;
+  if (Crc32(0, index, num_records * 8) != Get32(index + num_records * 8)) {
+    cerr << "corrupt profile log index" << endl;
+    return false;
+  }
+
+  log.reserve(log.size() + num_records);
+  for (uint64_t i = 0; i < num_records; ++i) {
+    const uint64_t offset = Get64(index + i * 8);
+    if (offset < kHeaderSize || offset > index_offset ||
+        index_offset - offset < kRecordHeaderSize) {
+      cerr << "corrupt profile log record " << i << endl;
+      return false;
+    }
+    const char *record = file + offset;
+    const uint32_t size = Get32(record + 32);
+    const uint32_t stored_size = Get32(record + 36);
+    const uint32_t encoding = Get32(record + 40);
+    const char *data = record + kRecordHeaderSize;
+    if (stored_size > index_offset - offset - kRecordHeaderSize) {
+      cerr << "corrupt profile log record " << i << endl;
+      return false;
+    }
+    uint32_t crc = Crc32(0, record, kRecordChecksumOffset);
+    crc = Crc32(crc, data, stored_size);
+    if (crc != Get32(record + kRecordChecksumOffset)) {
+      cerr << "checksum mismatch in profile log record " << i << endl;
+      return false;
+    }
+
+    disk_write_op_meta meta;
+    meta.bi_flags = Get64(record);
+    meta.bi_rw = Get64(record + 8);
+    meta.write_sector = Get64(record + 16);
+    meta.time_ns = Get64(record + 24);
+    meta.size = size;
+    disk_write dw(meta, NULL);
+    if (size == 0) {
+      log.push_back(dw);
+      continue;
+    }
+
+    if (encoding == kEncodingRaw && stored_size == size) {
+      // Share the mapped data, holding a reference to the mapping.
+      dw.share_data(shared_ptr<char>(mapping, (char *) data));
+    } else if (encoding == kEncodingLz) {
+      shared_ptr<char> buf(new char[size], [](char *c) {delete[] c;});
+      if (!Decompress(data, stored_size, buf.get(), size)) {
+        cerr << "corrupt data in profile log record " << i << endl;
+        return false;
+      }
+      dw.share_data(buf);
+    } else {
+      cerr << "unknown encoding in profile log record " << i << endl;
+      return false;
+    }
+    log.push_back(dw);
+  }
+  return true;
+}
+
+bool LoadLegacyProfileLog(const string &path, vector<disk_write> &log) {
+  ifstream in(path, ios::binary);
+  if (!in.is_open()) {
+    cerr << "error opening profile log " << path << endl;
+    return false;
+  }
+  while (in.peek() != EOF) {
+    log.push_back(disk_write::deserialize(in));
+  }
+  if (in.fail()) {
+    cerr << "error reading profile log " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
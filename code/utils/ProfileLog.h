@@ -0,0 +1,77 @@
+#ifndef UTILS_PROFILE_LOG_H
+#define UTILS_PROFILE_LOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Compact file format for the bios recorded while profiling a workload.
+ *
+ * The file starts with a header holding a magic string, the format version,
+ * the number of records, and the offset of the record index. Each record is
+ * the bio's metadata followed by its data, padded to 8 bytes, and carries a
+ * CRC32 of both. Record data can optionally be compressed, in which case
+ * records whose data doesn't shrink are stored as is. The record index at the
+ * end of the file lists the offset of every record and has its own checksum.
+ * All integers are stored big endian.
+ *
+ * Files written by the old disk_write::serialize, which pads the metadata and
+ * the data of each bio out to 4K blocks, have no header and can still be
+ * loaded.
+ */
+
+// Writes a profile log a bio at a time, for logs that are saved while they are
+// still being recorded. The file can't be loaded until Close is called.
+class ProfileLogWriter {
+ public:
+  // If compress is set, the data of each bio is compressed when doing so makes
+  // it smaller.
+  ProfileLogWriter(bool compress);
+  bool Open(const std::string &path);
+  // Returns false if the bio could not be written.
+  bool Append(disk_write &dw);
+  // Writes the record index and header. Returns false if any part of the log
+  // could not be written.
+  bool Close();
+  uint64_t GetNumRecords() const;
+
+ private:
+  const bool compress_;
+  std::string path_;
+  std::ofstream out_;
+  std::vector<uint64_t> index_;
+  uint64_t offset_ = 0;
+  std::vector<char> compressed_;
+};
+
+// Returns false if the log could not be written. If compress is set, the data
+// of each bio is compressed when doing so makes it smaller.
+bool SaveProfileLog(const std::string &path, std::vector<disk_write> &log,
+    bool compress);
+
+// Loads a log written by SaveProfileLog or by the old format, appending the
+// bios to log. Returns false if the file could not be read or is corrupt. The
+// data of uncompressed bios points into a private mapping of the file instead
+// of being copied out of it; the mapping stays around until every disk_write
+// that uses it is gone.
+bool LoadProfileLog(const std::string &path, std::vector<disk_write> &log);
+
+// Loads a log in the old 4K-padded format, appending the bios to log.
+bool LoadLegacyProfileLog(const std::string &path,
+    std::vector<disk_write> &log);
+
+// Returns true if the file at path starts with the header of the compact
+// format.
+bool IsCompactProfileLog(const std::string &path);
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_PROFILE_LOG_H
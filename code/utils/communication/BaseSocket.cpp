@@ -43,11 +43,22 @@ int BaseSocket::ReadMessageFromSocket(int socket, SocketMessage *m) {
     case SocketMessage::kCheckpoint:
     case SocketMessage::kCheckpointDone:
     case SocketMessage::kCheckpointFailed:
+    case SocketMessage::kStopHarness:
+    case SocketMessage::kStopHarnessDone:
       // Somebody sent us extra data anyway. Gobble it up and throw it away.
       if (m->size != 0) {
         res = GobbleData(socket, m->size);
       }
       break;
+    case SocketMessage::kRunTest:
+      res = ReadStringFromSocket(socket, m->size, &m->string_value);
+      break;
+    case SocketMessage::kRunTestDone:
+      if (m->size != sizeof(int32_t)) {
+        return -1;
+      }
+      res = ReadIntFromSocket(socket, &m->int_value);
+      break;
     default:
       res = -1;
   }
@@ -77,6 +88,8 @@ int BaseSocket::WriteMessageToSocket(int socket, SocketMessage &m) {
     case SocketMessage::kCheckpoint:
     case SocketMessage::kCheckpointDone:
     case SocketMessage::kCheckpointFailed:
+    case SocketMessage::kStopHarness:
+    case SocketMessage::kStopHarnessDone:
       // By default, always send the proper size of the message and no other,
       // extra data.
       res = WriteIntToSocket(socket, 0);
@@ -84,6 +97,17 @@ int BaseSocket::WriteMessageToSocket(int socket, SocketMessage &m) {
         return res;
       }
       break;
+    case SocketMessage::kRunTest:
+      // Sends the size of the string along with it.
+      res = WriteStringToSocket(socket, m.string_value);
+      break;
+    case SocketMessage::kRunTestDone:
+      res = WriteIntToSocket(socket, sizeof(int32_t));
+      if (res < 0) {
+        return res;
+      }
+      res = WriteIntToSocket(socket, m.int_value);
+      break;
     default:
       res = -1;
   }
@@ -158,16 +182,17 @@ int BaseSocket::ReadStringFromSocket(int socket, unsigned int len,
   for (int i = 0; i < len / sizeof(uint32_t); ++i) {
     *(tmp + i) = ntohl(*(tmp + i));
   }
-  *data = read_string;
+  *data = string(read_string, strnlen(read_string, len));
   return 0;
 }
 
 // Assume all messages are sent in network endian. Furthermore, strings are
 // rounded up to the nearest multiple of sizeof(uint32_t) bytes.
 int BaseSocket::WriteStringToSocket(int socket, string &data) {
-  // Some prep work so we can send everything one after the other.
+  // Some prep work so we can send everything one after the other. Leave room
+  // for the terminating NUL.
   const int len =
-    (data.size() + (sizeof(uint32_t) - 1)) & ~(sizeof(uint32_t) - 1);
+    (data.size() + sizeof(uint32_t)) & ~(sizeof(uint32_t) - 1);
 
   char send_data[len];
   memset(send_data, 0, len);
@@ -134,6 +134,21 @@ void ServerSocket::CloseClient() {
   client_socket = -1;
 }
 
+int ServerSocket::DetachClient() {
+  const int client = client_socket;
+  client_socket = -1;
+  return client;
+}
+
+SocketError ServerSocket::ReplyToDetached(int client, SocketMessage &m) {
+  const int res = BaseSocket::WriteMessageToSocket(client, m);
+  close(client);
+  if (res < 0) {
+    return SocketError::kSyscall;
+  }
+  return SocketError::kNone;
+}
+
 void ServerSocket::CloseServer() {
   close(client_socket);
   client_socket = -1;
@@ -26,6 +26,10 @@ class ServerSocket {
   SocketError TryForMessage(SocketMessage *m);
   void CloseClient();
   void CloseServer();
+  // Lets other clients connect while a request that takes a while is handled.
+  // The returned client is answered, and closed, with ReplyToDetached.
+  int DetachClient();
+  SocketError ReplyToDetached(int client, SocketMessage &m);
  private:
   int server_socket = -1;
   int client_socket = -1;
@@ -56,6 +56,14 @@ struct SocketMessage {
     kCheckpoint,
     kCheckpointDone,
     kCheckpointFailed,
+    // Run the test case .so at the path in string_value. Only valid when the
+    // harness is running as a daemon.
+    kRunTest,
+    // int_value is the number of failed crash states, or -1 if the test case
+    // couldn't be run.
+    kRunTestDone,
+    kStopHarness,
+    kStopHarnessDone,
   };
 
   CmCommand type;
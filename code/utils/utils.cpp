@@ -217,6 +217,29 @@ disk_write disk_write::deserialize(ifstream& is) {
   return res;
 }
 
+bool disk_write::deserialize_batch(shared_ptr<char> buf, size_t used,
+    size_t num_entries, vector<disk_write>& log) {
+  size_t offset = 0;
+  for (size_t i = 0; i < num_entries; ++i) {
+    if (used - offset < sizeof(disk_write_op_meta)) {
+      return false;
+    }
+    disk_write entry;
+    memcpy(&entry.metadata, buf.get() + offset, sizeof(disk_write_op_meta));
+    const size_t entry_size = HWM_LOG_BATCH_ENTRY_SIZE(entry.metadata.size);
+    if (entry_size > used - offset) {
+      return false;
+    }
+    if (entry.metadata.size > 0) {
+      entry.share_data(shared_ptr<char>(buf,
+            buf.get() + offset + sizeof(disk_write_op_meta)));
+    }
+    log.push_back(entry);
+    offset += entry_size;
+  }
+  return true;
+}
+
 std::string disk_write::flags_to_string(long long flags) {
   std::string res;
 
@@ -289,6 +312,10 @@ shared_ptr<char> disk_write::get_data() {
   return data;
 }
 
+void disk_write::share_data(shared_ptr<char> d) {
+  data = d;
+}
+
 void disk_write::clear_data() {
   data.reset();
 }
@@ -39,6 +39,11 @@ class disk_write {
   static std::string flags_to_string(long long flags);
   static void serialize(std::ofstream& fs, const disk_write& dw);
   static disk_write deserialize(std::ifstream& is);
+  // Appends the num_entries entries in a buffer filled by HWM_GET_LOG_BATCH to
+  // log. The data of each entry is left in buf and shared with buf. Returns
+  // false if the entries don't fit in the first used bytes of buf.
+  static bool deserialize_batch(std::shared_ptr<char> buf, size_t used,
+      size_t num_entries, std::vector<disk_write>& log);
 
   // Returns a pointer to the data which was assigned or NULL if data could not
   // be assigned. Pointer is valid only as long as the object exists. The user
@@ -49,6 +54,9 @@ class disk_write {
   // Pointer is valid only as long as the object exists or otherwise attempt
   // memory management of it.
   std::shared_ptr<char> get_data();
+  // Use the given data, which must be at least metadata.size bytes, without
+  // copying it.
+  void share_data(std::shared_ptr<char> data);
   void clear_data();
 
  private:
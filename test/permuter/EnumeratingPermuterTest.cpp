@@ -0,0 +1,143 @@
+#include <set>
+#include <vector>
+
+#include "../../code/disk_wrapper_ioctl.h"
+#include "../../code/permuter/EnumeratingPermuter.h"
+#include "../../code/results/PermuteTestResult.h"
+#include "../../code/utils/utils.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+using std::set;
+using std::vector;
+
+using fs_testing::permuter::EnumeratingPermuter;
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteData;
+
+namespace {
+
+const unsigned int kWriteSize = 1024;
+const unsigned int kSectorSize = 512;
+
+/*
+ * Builds a log with two epochs. The first has three writes and ends with a
+ * flush, the second has two writes and no barrier. All writes are kWriteSize
+ * bytes and none of them overlap.
+ */
+vector<disk_write> MakeLog() {
+  vector<disk_write> log;
+  char data[kWriteSize] = {0};
+
+  // All logs start with a Checkpoint.
+  disk_write checkpoint;
+  checkpoint.metadata.write_sector = 0;
+  checkpoint.metadata.bi_flags = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.bi_rw = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.size = 0;
+  checkpoint.metadata.time_ns = 0;
+  log.push_back(checkpoint);
+
+  for (unsigned int i = 0; i < 5; ++i) {
+    disk_write_op_meta meta;
+    meta.bi_flags = 0;
+    meta.bi_rw = HWM_WRITE_FLAG;
+    meta.write_sector = 8 * i;
+    meta.size = kWriteSize;
+    meta.time_ns = 0;
+    log.emplace_back(meta, data);
+
+    if (i == 2) {
+      disk_write barrier;
+      barrier.metadata.bi_rw = HWM_FLUSH_FLAG | HWM_WRITE_FLAG;
+      barrier.metadata.write_sector = 0;
+      barrier.metadata.size = 0;
+      log.push_back(barrier);
+    }
+  }
+  return log;
+}
+
+}  // namespace
+
+/*
+ * Bio crash states: 2^3 for the epoch with a barrier (all subsets of the three
+ * writes plus the full epoch) and 2^2 - 1 for the epoch without one.
+ */
+TEST(EnumeratingPermuter, GeneratesEveryBioStateOnce) {
+  vector<disk_write> log = MakeLog();
+  EnumeratingPermuter p(&log);
+  p.InitDataVector(kSectorSize, log);
+  ASSERT_EQ(p.GetNumCrashStates(true), 11);
+
+  set<vector<unsigned int>> seen;
+  vector<vector<unsigned int>> order;
+  vector<DiskWriteData> res;
+  PermuteTestResult log_data;
+  while (p.GenerateCrashState(res, log_data)) {
+    vector<unsigned int> state;
+    for (const DiskWriteData &dwd : res) {
+      state.push_back(dwd.bio_index);
+    }
+    EXPECT_TRUE(seen.insert(state).second);
+    order.push_back(state);
+    ASSERT_LE(seen.size(), 11);
+
+    // States are grouped by the epochs before the one they crash in.
+    const unsigned int prefix_epochs = (order.size() <= 8) ? 0 : 1;
+    EXPECT_EQ(log_data.prefix_epochs, prefix_epochs);
+    EXPECT_EQ(log_data.prefix_size, prefix_epochs * 4);
+  }
+  ASSERT_EQ(seen.size(), 11);
+
+  // Each epoch starts with its full version, then drops ops from it.
+  EXPECT_EQ(order.at(0), vector<unsigned int>({1, 2, 3, 4}));
+  EXPECT_EQ(order.at(1), vector<unsigned int>({1, 2, 3}));
+  EXPECT_EQ(order.at(7), vector<unsigned int>({3}));
+  EXPECT_EQ(order.at(8), vector<unsigned int>({1, 2, 3, 4, 5, 6}));
+  EXPECT_EQ(order.at(9), vector<unsigned int>({1, 2, 3, 4, 5}));
+  EXPECT_EQ(order.at(10), vector<unsigned int>({1, 2, 3, 4, 6}));
+}
+
+/*
+ * Sector crash states: each write is two sectors, so 2^6 for the first epoch
+ * and 2^4 - 1 for the second.
+ */
+TEST(EnumeratingPermuter, GeneratesEverySectorStateOnce) {
+  vector<disk_write> log = MakeLog();
+  EnumeratingPermuter p(&log);
+  p.InitDataVector(kSectorSize, log);
+  ASSERT_EQ(p.GetNumCrashStates(false), 79);
+
+  set<vector<unsigned int>> seen;
+  vector<DiskWriteData> res;
+  PermuteTestResult log_data;
+  while (p.GenerateSectorCrashState(res, log_data)) {
+    // Whole bios and the first sector of a bio have the same indices.
+    vector<unsigned int> state;
+    for (const DiskWriteData &dwd : res) {
+      state.push_back(dwd.full_bio);
+      state.push_back(dwd.bio_index);
+      state.push_back(dwd.bio_sector_index);
+    }
+    EXPECT_TRUE(seen.insert(state).second);
+    ASSERT_LE(seen.size(), 79);
+  }
+  EXPECT_EQ(seen.size(), 79);
+}
+
+TEST(EnumeratingPermuter, EmptyLogHasNoStates) {
+  vector<disk_write> log;
+  EnumeratingPermuter p(&log);
+  p.InitDataVector(kSectorSize, log);
+  EXPECT_EQ(p.GetNumCrashStates(true), 0);
+
+  vector<DiskWriteData> res;
+  PermuteTestResult log_data;
+  EXPECT_FALSE(p.GenerateCrashState(res, log_data));
+  EXPECT_FALSE(p.GenerateSectorCrashState(res, log_data));
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -26,7 +26,8 @@ class TestPermuter : public Permuter {
       PermuteTestResult &log_data) {
     return false;
   }
-  bool gen_one_sector_state(std::vector<EpochOpSector>& res,
+  bool gen_one_sector_state(
+      std::vector<fs_testing::utils::DiskWriteData>& res,
       PermuteTestResult &log_data) {
     return false;
   }
@@ -35,6 +36,11 @@ class TestPermuter : public Permuter {
     return CoalesceSectors(sectors);
   }
 
+  vector<EpochOpSector> Coalesce(epoch &epoch,
+      vector<EpochOpSector> &sectors) {
+    return CoalesceSectors(epoch, sectors);
+  }
+
   vector<epoch>* GetInternalEpochs() {
     return GetEpochs();
   };
@@ -831,6 +837,98 @@ TEST(Permuter, CoalesceSectorDropSector2) {
   EXPECT_EQ(coalesced.at(0), sectors.at(0));
 }
 
+/*
+ * Builds a single epoch where ops 0 and 1 are overwritten in part by op 2, op 3
+ * overlaps nothing, and op 4 overwrites a part of op 0 that op 2 didn't touch.
+ * The epoch ends with a FUA.
+ */
+static vector<disk_write> MakeOverlappingEpoch() {
+  vector<disk_write> test_epoch;
+  static char data[4096] = {0};
+
+  disk_write checkpoint;
+  checkpoint.metadata.write_sector = 0;
+  checkpoint.metadata.bi_flags = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.bi_rw = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.size = 0;
+  checkpoint.metadata.time_ns = 0;
+  test_epoch.push_back(checkpoint);
+
+  // {write_sector, size} with sectors being 512 bytes.
+  const unsigned int writes[][2] = {
+    {0, 4096},
+    {8, 4096},
+    {4, 4096},
+    {100, 1024},
+    {0, 512},
+  };
+  for (const auto &w : writes) {
+    disk_write_op_meta meta;
+    meta.bi_flags = 0;
+    meta.bi_rw = HWM_WRITE_FLAG;
+    meta.write_sector = w[0];
+    meta.size = w[1];
+    meta.time_ns = 0;
+    test_epoch.emplace_back(meta, data);
+  }
+
+  disk_write barrier;
+  barrier.metadata.bi_rw = HWM_FUA_FLAG | HWM_WRITE_FLAG;
+  barrier.metadata.write_sector = 0;
+  barrier.metadata.size = 0;
+  test_epoch.push_back(barrier);
+
+  return test_epoch;
+}
+
+/*
+ * Test that the overlap map of an epoch records which ops overwrite which.
+ */
+TEST(Permuter, InitDataVectorOverlapMap) {
+  vector<disk_write> test_epoch = MakeOverlappingEpoch();
+
+  TestPermuter tp;
+  tp.InitDataVector(512, test_epoch);
+  vector<epoch> *internal = tp.GetInternalEpochs();
+
+  ASSERT_EQ(internal->size(), 1);
+  epoch &e = internal->front();
+  EXPECT_TRUE(e.overlaps);
+  ASSERT_EQ(e.overlap_map.size(), e.ops.size());
+  EXPECT_EQ(e.overlap_map.at(0), vector<unsigned int>({2, 4}));
+  EXPECT_EQ(e.overlap_map.at(1), vector<unsigned int>({2}));
+  EXPECT_EQ(e.overlap_map.at(2), vector<unsigned int>({0, 1}));
+  EXPECT_TRUE(e.overlap_map.at(3).empty());
+  EXPECT_EQ(e.overlap_map.at(4), vector<unsigned int>({0}));
+  // Barrier.
+  EXPECT_TRUE(e.overlap_map.at(5).empty());
+}
+
+/*
+ * Test that coalescing with the overlap map gives the same result as checking
+ * every sector.
+ */
+TEST(Permuter, CoalesceSectorsWithOverlapMap) {
+  const unsigned int sector_size = 512;
+  vector<disk_write> test_epoch = MakeOverlappingEpoch();
+
+  TestPermuter tp;
+  tp.InitDataVector(sector_size, test_epoch);
+  epoch &e = tp.GetInternalEpochs()->front();
+
+  vector<EpochOpSector> sectors;
+  for (unsigned int i = 0; i < e.ops.size() - 1; ++i) {
+    vector<EpochOpSector> op_sectors = e.ops.at(i).ToSectors(sector_size);
+    sectors.insert(sectors.end(), op_sectors.begin(), op_sectors.end());
+  }
+
+  vector<EpochOpSector> expected = tp.Coalesce(sectors);
+  vector<EpochOpSector> coalesced = tp.Coalesce(e, sectors);
+  // 16 distinct sectors from ops 0-2 plus 2 sectors from op 3.
+  EXPECT_EQ(coalesced.size(), 18);
+  EXPECT_EQ(coalesced, expected);
+}
+
 /*
  * Test that ToSectors() generates the correct number of sectors.
  */
@@ -0,0 +1,104 @@
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include "../../code/utils/BlockStore.h"
+#include "../../code/utils/utils.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::string;
+using std::vector;
+
+using fs_testing::utils::BlockStore;
+using fs_testing::utils::disk_write;
+
+namespace {
+
+static const unsigned int kBlockSize = BlockStore::kBlockSize;
+
+// Data where every block is different unless seeded the same.
+string MakeData(const unsigned int size, const unsigned int seed) {
+  string data(size, '\0');
+  for (unsigned int i = 0; i < size; ++i) {
+    data[i] = (char) (i * 31 + (i / kBlockSize + seed) * 7);
+  }
+  return data;
+}
+
+disk_write MakeWrite(const unsigned int sector, const string &data) {
+  struct disk_write_op_meta meta;
+  memset(&meta, 0, sizeof(meta));
+  meta.bi_rw = HWM_WRITE_FLAG;
+  meta.write_sector = sector;
+  meta.size = data.size();
+  return disk_write(meta, data.data());
+}
+
+}  // namespace
+
+TEST(BlockStore, RepeatedDataIsSharedAndUnchanged) {
+  const string journal = MakeData(kBlockSize, 1);
+  const string other = MakeData(kBlockSize, 2);
+  vector<disk_write> log;
+  log.push_back(MakeWrite(100, journal));
+  log.push_back(MakeWrite(8, other));
+  log.push_back(MakeWrite(200, journal));
+
+  BlockStore store;
+  for (disk_write &dw : log) {
+    store.Add(dw);
+  }
+  EXPECT_EQ(3 * kBlockSize, store.GetAddedBytes());
+  EXPECT_EQ(2 * kBlockSize, store.GetStoredBytes());
+  EXPECT_EQ(log[0].get_data().get(), log[2].get_data().get());
+  EXPECT_EQ(0, memcmp(journal.data(), log[2].get_data().get(), kBlockSize));
+  EXPECT_EQ(0, memcmp(other.data(), log[1].get_data().get(), kBlockSize));
+}
+
+TEST(BlockStore, SharesBlocksInsideLargerWrites) {
+  // A multi-block write followed by writes of some of its blocks, as when
+  // blocks written together are later rewritten one at a time.
+  const string big = MakeData(4 * kBlockSize, 3);
+  vector<disk_write> log;
+  log.push_back(MakeWrite(0, big));
+  log.push_back(MakeWrite(64, big.substr(kBlockSize, 2 * kBlockSize)));
+  log.push_back(MakeWrite(72, big.substr(3 * kBlockSize)));
+  // Starts with a stored block but then differs.
+  string mixed = big.substr(2 * kBlockSize, kBlockSize) +
+    MakeData(kBlockSize, 9);
+  log.push_back(MakeWrite(80, mixed));
+
+  BlockStore store;
+  for (disk_write &dw : log) {
+    store.Add(dw);
+  }
+  EXPECT_EQ(6 * kBlockSize, store.GetStoredBytes());
+  EXPECT_EQ(log[0].get_data().get() + kBlockSize, log[1].get_data().get());
+  EXPECT_EQ(log[0].get_data().get() + 3 * kBlockSize,
+      log[2].get_data().get());
+  EXPECT_EQ(0, memcmp(mixed.data(), log[3].get_data().get(), mixed.size()));
+}
+
+TEST(BlockStore, DataOutlivesStore) {
+  const string data = MakeData(kBlockSize + 100, 4);
+  disk_write dw = MakeWrite(0, data);
+  disk_write empty = MakeWrite(8, "");
+  {
+    BlockStore store;
+    store.Add(dw);
+    store.Add(empty);
+    EXPECT_EQ(data.size(), store.GetAddedBytes());
+    store.Clear();
+    EXPECT_EQ(0, store.GetStoredBytes());
+  }
+  EXPECT_EQ(0, memcmp(data.data(), dw.get_data().get(), data.size()));
+  EXPECT_EQ(MakeWrite(0, data), dw);
+}
+
+}  // namespace test
+}  // namespace fs_testing
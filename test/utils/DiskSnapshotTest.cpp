@@ -0,0 +1,160 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../../code/utils/DiskSnapshot.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::string;
+using std::vector;
+
+using fs_testing::utils::DiskSnapshotStats;
+using fs_testing::utils::LoadDiskSnapshot;
+using fs_testing::utils::SaveDiskSnapshot;
+
+namespace {
+
+// Not a multiple of the page size, like a device of an odd number of 1K
+// blocks.
+static const unsigned int kDevBytes = 3 * 1024 * 1024 + 1024;
+
+string TempPath() {
+  char path[] = "/tmp/DiskSnapshotTestXXXXXX";
+  const int fd = mkstemp(path);
+  close(fd);
+  return path;
+}
+
+class DiskSnapshotTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    dev_path_ = TempPath();
+    snap_path_ = TempPath();
+    restored_path_ = TempPath();
+
+    // A stand in for cow_brd with a few pages of data in it, including the
+    // short page at the end of the device.
+    contents_.assign(kDevBytes, '\0');
+    for (unsigned int i = 0; i < 4096; ++i) {
+      contents_[i] = 'a' + (i % 26);
+      contents_[40960 + i] = i;
+      contents_[45056 + i] = 'x';
+      contents_[2 * 1024 * 1024 - 2048 + i] = 'y';
+    }
+    for (unsigned int i = 0; i < 1024; ++i) {
+      contents_[kDevBytes - 1024 + i] = 'z';
+    }
+    ASSERT_TRUE(WriteFile(dev_path_, contents_));
+  }
+
+  virtual void TearDown() {
+    unlink(dev_path_.c_str());
+    unlink(snap_path_.c_str());
+    unlink((snap_path_ + ".pages").c_str());
+    unlink(restored_path_.c_str());
+  }
+
+  bool WriteFile(const string &path, const vector<char> &data) {
+    const int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    const bool res = fd >= 0 &&
+      write(fd, data.data(), data.size()) == (ssize_t) data.size();
+    close(fd);
+    return res;
+  }
+
+  vector<char> ReadFile(const string &path) {
+    vector<char> data(kDevBytes);
+    const int fd = open(path.c_str(), O_RDONLY);
+    EXPECT_EQ(kDevBytes, pread(fd, data.data(), data.size(), 0));
+    close(fd);
+    return data;
+  }
+
+  bool Save(DiskSnapshotStats *stats) {
+    const int fd = open(dev_path_.c_str(), O_RDONLY);
+    const bool res = SaveDiskSnapshot(fd, kDevBytes, snap_path_, stats);
+    close(fd);
+    return res;
+  }
+
+  // Loads the snapshot onto a new, zeroed device.
+  bool Load(DiskSnapshotStats *stats) {
+    const int fd = open(restored_path_.c_str(), O_WRONLY | O_TRUNC);
+    ftruncate(fd, kDevBytes);
+    const bool res = LoadDiskSnapshot(snap_path_, fd, kDevBytes, stats);
+    close(fd);
+    return res;
+  }
+
+  string dev_path_;
+  string snap_path_;
+  string restored_path_;
+  vector<char> contents_;
+};
+
+}  // namespace
+
+TEST_F(DiskSnapshotTest, SaveAndLoad) {
+  DiskSnapshotStats saved;
+  ASSERT_TRUE(Save(&saved));
+  EXPECT_EQ(kDevBytes, saved.device_bytes);
+  EXPECT_EQ(4u * 4096 + 4096 + 1024, saved.data_bytes);
+  EXPECT_EQ(4u, saved.extents);
+
+  struct stat st;
+  ASSERT_EQ(0, stat(snap_path_.c_str(), &st));
+  EXPECT_EQ(kDevBytes, st.st_size);
+
+  DiskSnapshotStats loaded;
+  ASSERT_TRUE(Load(&loaded));
+  EXPECT_EQ(saved.data_bytes, loaded.data_bytes);
+  EXPECT_EQ(saved.extents, loaded.extents);
+  EXPECT_EQ(saved.image, loaded.image);
+  EXPECT_EQ(contents_, ReadFile(restored_path_));
+}
+
+TEST_F(DiskSnapshotTest, FingerprintTracksContents) {
+  DiskSnapshotStats first;
+  ASSERT_TRUE(Save(&first));
+  DiskSnapshotStats second;
+  ASSERT_TRUE(Save(&second));
+  EXPECT_EQ(first.image, second.image);
+
+  // Same data in a different place is a different image.
+  for (unsigned int i = 0; i < 4096; ++i) {
+    contents_[i + 8192] = contents_[i];
+    contents_[i] = '\0';
+  }
+  ASSERT_TRUE(WriteFile(dev_path_, contents_));
+  DiskSnapshotStats moved;
+  ASSERT_TRUE(Save(&moved));
+  EXPECT_NE(first.image, moved.image);
+}
+
+TEST_F(DiskSnapshotTest, DetectsCorruption) {
+  ASSERT_TRUE(Save(NULL));
+  const int fd = open(snap_path_.c_str(), O_WRONLY);
+  ASSERT_EQ(1, pwrite(fd, "!", 1, 45056 + 100));
+  close(fd);
+  EXPECT_FALSE(Load(NULL));
+}
+
+TEST_F(DiskSnapshotTest, LoadsFullImageWithoutPageList) {
+  // Older versions saved a plain copy of the whole device.
+  ASSERT_TRUE(WriteFile(snap_path_, contents_));
+  DiskSnapshotStats loaded;
+  ASSERT_TRUE(Load(&loaded));
+  EXPECT_EQ(4u * 4096 + 4096 + 1024, loaded.data_bytes);
+  EXPECT_EQ(contents_, ReadFile(restored_path_));
+}
+
+}  // namespace test
+}  // namespace fs_testing
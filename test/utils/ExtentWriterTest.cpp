@@ -0,0 +1,182 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../../code/utils/ExtentWriter.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::string;
+using std::vector;
+
+using fs_testing::utils::ExtentWriter;
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintBuilder;
+
+namespace {
+
+static const unsigned int kFileSize = 8192;
+
+class ExtentWriterTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[] = "/tmp/ExtentWriterTestXXXXXX";
+    fd_ = mkstemp(path);
+    ASSERT_GE(fd_, 0);
+    unlink(path);
+    ASSERT_EQ(0, ftruncate(fd_, kFileSize));
+  }
+
+  virtual void TearDown() {
+    close(fd_);
+  }
+
+  string ReadFile() {
+    string res(kFileSize, '\0');
+    EXPECT_EQ(kFileSize, pread(fd_, &res[0], kFileSize, 0));
+    return res;
+  }
+
+  int fd_ = -1;
+};
+
+Fingerprint FingerprintOf(const ExtentWriter &writer) {
+  FingerprintBuilder builder;
+  writer.AddToFingerprint(builder);
+  return builder.Finish();
+}
+
+}  // namespace
+
+TEST_F(ExtentWriterTest, LaterWritesWin) {
+  const string a(1024, 'a');
+  const string b(512, 'b');
+  const string c(256, 'c');
+
+  ExtentWriter writer;
+  writer.Add(0, a.size(), a.data());
+  // Lands in the middle of `a`, splitting it in two.
+  writer.Add(256, b.size(), b.data());
+  // Covers the end of `b` and the start of the second half of `a`.
+  writer.Add(640, c.size(), c.data());
+  EXPECT_EQ(4, writer.size());
+  ASSERT_TRUE(writer.Write(fd_));
+
+  string expected(kFileSize, '\0');
+  expected.replace(0, a.size(), a);
+  expected.replace(256, b.size(), b);
+  expected.replace(640, c.size(), c);
+  EXPECT_EQ(expected, ReadFile());
+}
+
+TEST_F(ExtentWriterTest, CoveredExtentsAreDropped) {
+  const string a(512, 'a');
+  const string b(512, 'b');
+  const string c(2048, 'c');
+
+  ExtentWriter writer;
+  writer.Add(1024, a.size(), a.data());
+  writer.Add(2048, b.size(), b.data());
+  writer.Add(512, c.size(), c.data());
+  EXPECT_EQ(1, writer.size());
+  ASSERT_TRUE(writer.Write(fd_));
+
+  string expected(kFileSize, '\0');
+  expected.replace(512, c.size(), c);
+  EXPECT_EQ(expected, ReadFile());
+}
+
+TEST_F(ExtentWriterTest, ContiguousExtentsShareSyscalls) {
+  // Sector sized writes in reverse order, like a crash state built from
+  // sectors of many bios.
+  vector<string> sectors;
+  for (unsigned int i = 0; i < kFileSize / 512; ++i) {
+    sectors.push_back(string(512, 'a' + i));
+  }
+
+  ExtentWriter writer;
+  for (unsigned int i = sectors.size(); i > 0; --i) {
+    writer.Add((i - 1) * 512, 512, sectors.at(i - 1).data());
+  }
+  ASSERT_TRUE(writer.Write(fd_));
+  // One fcntl to check for O_DIRECT and one pwritev for the run.
+  EXPECT_EQ(2, writer.GetNumSyscalls());
+
+  string expected;
+  for (const string &sector : sectors) {
+    expected += sector;
+  }
+  EXPECT_EQ(expected, ReadFile());
+
+  // Clearing drops the extents but keeps the syscall count.
+  writer.Clear();
+  EXPECT_EQ(0, writer.size());
+  ASSERT_TRUE(writer.Write(fd_));
+  EXPECT_EQ(2, writer.GetNumSyscalls());
+}
+
+TEST_F(ExtentWriterTest, ExtentIoctlFallsBackToWrites) {
+  const string a(512, 'a');
+  const string b(512, 'b');
+
+  ExtentWriter writer;
+  writer.EnableExtentIoctl();
+  writer.Add(0, a.size(), a.data());
+  writer.Add(1024, b.size(), b.data());
+  ASSERT_TRUE(writer.Write(fd_));
+  // The ioctl regular files don't support, then the fcntl and one pwritev for
+  // each run.
+  EXPECT_EQ(4, writer.GetNumSyscalls());
+
+  string expected(kFileSize, '\0');
+  expected.replace(0, a.size(), a);
+  expected.replace(1024, b.size(), b);
+  EXPECT_EQ(expected, ReadFile());
+
+  // The ioctl isn't tried again.
+  ASSERT_TRUE(writer.Write(fd_));
+  EXPECT_EQ(7, writer.GetNumSyscalls());
+}
+
+TEST(ExtentWriter, FingerprintIgnoresHowDataWasWritten) {
+  const string a(1024, 'a');
+  string b(a);
+  b[1000] = 'b';
+
+  // All of `a` in one write.
+  ExtentWriter whole;
+  whole.Add(4096, a.size(), a.data());
+
+  // The same bytes split at an odd offset and written back to front, with some
+  // data that is later overwritten.
+  ExtentWriter split;
+  split.Add(4096 + 301, a.size() - 301, a.data() + 301);
+  split.Add(4096, 512, b.data());
+  split.Add(4096, 301, a.data());
+  EXPECT_EQ(FingerprintOf(whole), FingerprintOf(split));
+
+  // Different data at the same offsets.
+  ExtentWriter different;
+  different.Add(4096, b.size(), b.data());
+  EXPECT_NE(FingerprintOf(whole), FingerprintOf(different));
+
+  // Same data at a different offset.
+  ExtentWriter moved;
+  moved.Add(4608, a.size(), a.data());
+  EXPECT_NE(FingerprintOf(whole), FingerprintOf(moved));
+
+  // Same data with a hole in the middle.
+  ExtentWriter holes;
+  holes.Add(4096, 512, a.data());
+  holes.Add(4096 + 513, a.size() - 513, a.data() + 513);
+  EXPECT_NE(FingerprintOf(whole), FingerprintOf(holes));
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,80 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "../../code/utils/FileCompare.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::string;
+
+using fs_testing::utils::CompareFileRanges;
+using fs_testing::utils::RangeMismatch;
+
+namespace {
+
+// Opens a temp file holding contents at offset, with a hole before it.
+int TempFileWith(const string &contents, off_t offset, off_t size) {
+  char path[] = "/tmp/FileCompareTestXXXXXX";
+  const int fd = mkstemp(path);
+  unlink(path);
+  EXPECT_EQ(0, ftruncate(fd, size));
+  EXPECT_EQ((ssize_t) contents.size(),
+      pwrite(fd, contents.data(), contents.size(), offset));
+  return fd;
+}
+
+}  // namespace
+
+TEST(FileCompare, BinaryDataAfterNul) {
+  const string a("ab\0cdef", 7);
+  const string b("ab\0cdXf", 7);
+  const int fd1 = TempFileWith(a, 0, a.size());
+  const int fd2 = TempFileWith(b, 0, b.size());
+  RangeMismatch mismatch;
+  EXPECT_EQ(0, CompareFileRanges(fd1, fd2, 0, 5, &mismatch));
+  ASSERT_EQ(1, CompareFileRanges(fd1, fd2, 0, 7, &mismatch));
+  EXPECT_EQ(5u, mismatch.offset);
+  EXPECT_EQ(1u, mismatch.length);
+  close(fd1);
+  close(fd2);
+}
+
+TEST(FileCompare, MismatchExtentAcrossChunksAndHoles) {
+  // Large files that are mostly holes, differing in two places far apart.
+  const off_t size = 8 * 1024 * 1024;
+  const int fd1 = TempFileWith("same", 1024 * 1024, size);
+  const int fd2 = TempFileWith("same", 1024 * 1024, size);
+  RangeMismatch mismatch;
+  EXPECT_EQ(0, CompareFileRanges(fd1, fd2, 0, size, &mismatch));
+
+  ASSERT_EQ(1, pwrite(fd1, "x", 1, 3 * 1024 * 1024 + 7));
+  ASSERT_EQ(1, pwrite(fd2, "y", 1, 6 * 1024 * 1024));
+  ASSERT_EQ(1, CompareFileRanges(fd1, fd2, 0, size, &mismatch));
+  EXPECT_EQ(3u * 1024 * 1024 + 7, mismatch.offset);
+  EXPECT_EQ(3u * 1024 * 1024 - 7 + 1, mismatch.length);
+  EXPECT_EQ(0, CompareFileRanges(fd1, fd2, 0, 3 * 1024 * 1024, &mismatch));
+  close(fd1);
+  close(fd2);
+}
+
+TEST(FileCompare, ShorterFileMismatches) {
+  const int fd1 = TempFileWith("abcdef", 0, 6);
+  const int fd2 = TempFileWith("abc", 0, 3);
+  RangeMismatch mismatch;
+  ASSERT_EQ(1, CompareFileRanges(fd1, fd2, 1, 10, &mismatch));
+  EXPECT_EQ(3u, mismatch.offset);
+  EXPECT_EQ(3u, mismatch.length);
+  // Ranges past the end of both files are empty in both.
+  EXPECT_EQ(0, CompareFileRanges(fd1, fd2, 20, 10, &mismatch));
+  close(fd1);
+  close(fd2);
+}
+
+}  // namespace test
+}  // namespace fs_testing
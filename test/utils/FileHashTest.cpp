@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/utils/FileHash.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintToString;
+using fs_testing::utils::HashBytes;
+using fs_testing::utils::HashFile;
+using fs_testing::utils::HashFiles;
+
+namespace {
+
+string WriteTempFile(const string &contents) {
+  char path[] = "/tmp/FileHashTestXXXXXX";
+  const int fd = mkstemp(path);
+  close(fd);
+  ofstream out(path, std::ios::binary);
+  out.write(contents.data(), contents.size());
+  return path;
+}
+
+}  // namespace
+
+TEST(FileHash, KnownValues) {
+  // Reference values for MurmurHash3_x64_128 with a seed of 0.
+  EXPECT_EQ("00000000000000000000000000000000",
+      FingerprintToString(HashBytes("", 0)));
+  const char fox[] = "The quick brown fox jumps over the lazy dog";
+  EXPECT_EQ("e34bbc7bbc071b6c7a433ca9c49a9347",
+      FingerprintToString(HashBytes(fox, strlen(fox))));
+}
+
+TEST(FileHash, FileMatchesBytes) {
+  // Sizes around the 16 byte block size and one much larger file.
+  for (const size_t size : {0, 1, 15, 16, 17, 1000, 300000}) {
+    string contents(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+      contents[i] = (char) (i * 7 + size);
+    }
+    const string path = WriteTempFile(contents);
+    Fingerprint hash;
+    EXPECT_TRUE(HashFile(path, hash));
+    EXPECT_EQ(HashBytes(contents.data(), contents.size()), hash) << size;
+    unlink(path.c_str());
+  }
+}
+
+TEST(FileHash, HashesManyFiles) {
+  vector<string> paths;
+  vector<Fingerprint> expected;
+  for (unsigned int i = 0; i < 50; ++i) {
+    const string contents = "file " + std::to_string(i);
+    paths.push_back(WriteTempFile(contents));
+    expected.push_back(HashBytes(contents.data(), contents.size()));
+  }
+  paths.push_back("/tmp/FileHashTest_does_not_exist");
+
+  vector<Fingerprint> hashes;
+  vector<bool> ok;
+  HashFiles(paths, hashes, ok, 4);
+  ASSERT_EQ(paths.size(), hashes.size());
+  ASSERT_EQ(paths.size(), ok.size());
+  for (unsigned int i = 0; i < expected.size(); ++i) {
+    EXPECT_TRUE(ok[i]);
+    EXPECT_EQ(expected[i], hashes[i]);
+    unlink(paths[i].c_str());
+  }
+  EXPECT_FALSE(ok.back());
+}
+
+}  // namespace test
+}  // namespace fs_testing
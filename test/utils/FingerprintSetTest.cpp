@@ -0,0 +1,83 @@
+#include <vector>
+
+#include "../../code/utils/FingerprintSet.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::vector;
+
+using fs_testing::utils::Fingerprint;
+using fs_testing::utils::FingerprintBuilder;
+using fs_testing::utils::FingerprintSet;
+using fs_testing::utils::FingerprintSetStats;
+
+namespace {
+
+Fingerprint FingerprintOf(const vector<unsigned int> &values) {
+  FingerprintBuilder builder;
+  for (const unsigned int v : values) {
+    builder.Add(v);
+  }
+  return builder.Finish();
+}
+
+}  // namespace
+
+TEST(FingerprintBuilder, OrderAndLengthMatter) {
+  EXPECT_EQ(FingerprintOf({1, 2, 3}), FingerprintOf({1, 2, 3}));
+  EXPECT_NE(FingerprintOf({1, 2, 3}), FingerprintOf({3, 2, 1}));
+  EXPECT_NE(FingerprintOf({1, 2}), FingerprintOf({1, 2, 0}));
+  EXPECT_NE(FingerprintOf({}), FingerprintOf({0}));
+}
+
+TEST(FingerprintSet, InsertAndContains) {
+  FingerprintSet set;
+  EXPECT_FALSE(set.Contains(FingerprintOf({1})));
+  EXPECT_TRUE(set.Insert(FingerprintOf({1})));
+  EXPECT_FALSE(set.Insert(FingerprintOf({1})));
+  EXPECT_TRUE(set.Contains(FingerprintOf({1})));
+  EXPECT_FALSE(set.Contains(FingerprintOf({2})));
+
+  // The all zero fingerprint is used internally to mark empty slots.
+  EXPECT_TRUE(set.Insert({0, 0}));
+  EXPECT_TRUE(set.Contains({0, 0}));
+  EXPECT_EQ(set.size(), 2);
+}
+
+TEST(FingerprintSet, GrowsPastReservation) {
+  const unsigned int kNumStates = 10000;
+  FingerprintSet set;
+  set.Reserve(100);
+  const FingerprintSetStats reserved = set.GetStats();
+  EXPECT_GE(reserved.capacity, 200);
+  EXPECT_EQ(reserved.memory_bytes, reserved.capacity * sizeof(Fingerprint));
+
+  for (unsigned int i = 0; i < kNumStates; ++i) {
+    EXPECT_TRUE(set.Insert(FingerprintOf({i, i + 1})));
+  }
+  for (unsigned int i = 0; i < kNumStates; ++i) {
+    EXPECT_TRUE(set.Contains(FingerprintOf({i, i + 1})));
+  }
+  EXPECT_FALSE(set.Contains(FingerprintOf({kNumStates, kNumStates + 1})));
+
+  const FingerprintSetStats stats = set.GetStats();
+  EXPECT_EQ(stats.size, kNumStates);
+  EXPECT_LE(stats.size * 2, stats.capacity);
+  EXPECT_GT(stats.resizes, 0);
+  EXPECT_EQ(stats.lookups, 2 * kNumStates + 1);
+}
+
+TEST(FingerprintSet, ReserveAvoidsResizing) {
+  FingerprintSet set;
+  set.Reserve(1000);
+  for (unsigned int i = 0; i < 1000; ++i) {
+    set.Insert(FingerprintOf({i}));
+  }
+  EXPECT_EQ(set.GetStats().resizes, 0);
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,83 @@
+#include <cstring>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../../code/disk_wrapper_ioctl.h"
+#include "../../code/utils/utils.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::memcpy;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+
+namespace {
+
+// Lays out entries the way disk_wrapper's HWM_GET_LOG_BATCH does.
+size_t FillBatch(char *buf, const vector<disk_write_op_meta> &metas,
+    const vector<string> &datas) {
+  size_t used = 0;
+  for (unsigned int i = 0; i < metas.size(); ++i) {
+    memcpy(buf + used, &metas[i], sizeof(disk_write_op_meta));
+    memcpy(buf + used + sizeof(disk_write_op_meta), datas[i].data(),
+        datas[i].size());
+    used += HWM_LOG_BATCH_ENTRY_SIZE(metas[i].size);
+  }
+  return used;
+}
+
+}  // namespace
+
+TEST(LogBatch, ParsesEntriesInPlace) {
+  const vector<string> datas = {"", string(4096, 'a'), "odd"};
+  const vector<disk_write_op_meta> metas = {
+    {HWM_CHECKPOINT_FLAG, HWM_CHECKPOINT_FLAG, 0, 0, 1},
+    {0, HWM_WRITE_FLAG | HWM_META_FLAG, 8, 4096, 2},
+    {0, HWM_WRITE_FLAG | HWM_FUA_FLAG, 16, 3, 3},
+  };
+  shared_ptr<char> buf(new char[8192], [](char* c) {delete[] c;});
+  const size_t used = FillBatch(buf.get(), metas, datas);
+  EXPECT_EQ(0u, used % HWM_LOG_BATCH_ALIGN);
+
+  vector<disk_write> log;
+  ASSERT_TRUE(disk_write::deserialize_batch(buf, used, metas.size(), log));
+  ASSERT_EQ(metas.size(), log.size());
+  for (unsigned int i = 0; i < metas.size(); ++i) {
+    EXPECT_EQ(disk_write(metas[i], datas[i].data()), log[i]);
+  }
+  EXPECT_EQ(NULL, log[0].get_data().get());
+  // Data is used where it lies in the buffer, not copied.
+  const size_t data_offset =
+    HWM_LOG_BATCH_ENTRY_SIZE(0) + sizeof(disk_write_op_meta);
+  EXPECT_EQ(buf.get() + data_offset, log[1].get_data().get());
+
+  // The entries keep the buffer alive.
+  char *const base = buf.get();
+  buf.reset();
+  EXPECT_EQ(0, memcmp(base + data_offset, datas[1].data(), datas[1].size()));
+  EXPECT_EQ(string("odd"), string(log[2].get_data().get(), 3));
+}
+
+TEST(LogBatch, RejectsTruncatedBatch) {
+  const vector<string> datas = {string(100, 'b')};
+  const vector<disk_write_op_meta> metas = {
+    {0, HWM_WRITE_FLAG, 8, 100, 1},
+  };
+  shared_ptr<char> buf(new char[4096], [](char* c) {delete[] c;});
+  const size_t used = FillBatch(buf.get(), metas, datas);
+
+  vector<disk_write> log;
+  EXPECT_FALSE(disk_write::deserialize_batch(buf, used - 8, 1, log));
+  EXPECT_FALSE(disk_write::deserialize_batch(buf, used, 2, log));
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <ios>
+#include <string>
+#include <vector>
+
+#include "../../code/utils/ProfileLog.h"
+#include "../../code/utils/utils.h"
+
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ios;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+using fs_testing::utils::IsCompactProfileLog;
+using fs_testing::utils::LoadProfileLog;
+using fs_testing::utils::ProfileLogWriter;
+using fs_testing::utils::SaveProfileLog;
+
+namespace {
+
+class ProfileLogTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[] = "/tmp/ProfileLogTestXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+
+    // A checkpoint, a bio of zeros, a bio with data that doesn't compress, and
+    // a bio whose size isn't a multiple of 8.
+    disk_write_op_meta meta = {0, HWM_CHECKPOINT_FLAG, 0, 0, 1};
+    log_.push_back(disk_write(meta, NULL));
+
+    string zeros(8192, '\0');
+    meta = {0, HWM_WRITE_FLAG | HWM_META_FLAG, 16, 8192, 2};
+    log_.push_back(disk_write(meta, zeros.data()));
+
+    string noise(4096, '\0');
+    unsigned int seed = 42;
+    for (char &c : noise) {
+      seed = seed * 1103515245 + 12345;
+      c = seed >> 16;
+    }
+    meta = {0, HWM_WRITE_FLAG | HWM_FUA_FLAG, 64, 4096, 3};
+    log_.push_back(disk_write(meta, noise.data()));
+
+    string text;
+    while (text.size() < 1000) {
+      text += "CrashMonkey profile log ";
+    }
+    text.resize(1001);
+    meta = {0, HWM_WRITE_FLAG, 128, 1001, 4};
+    log_.push_back(disk_write(meta, text.data()));
+  }
+
+  virtual void TearDown() {
+    unlink(path_.c_str());
+  }
+
+  off_t FileSize() {
+    struct stat st;
+    EXPECT_EQ(0, stat(path_.c_str(), &st));
+    return st.st_size;
+  }
+
+  void ExpectSameLog(vector<disk_write> &loaded) {
+    ASSERT_EQ(log_.size(), loaded.size());
+    for (unsigned int i = 0; i < log_.size(); ++i) {
+      EXPECT_EQ(log_.at(i), loaded.at(i)) << "bio " << i;
+      EXPECT_EQ(log_.at(i).metadata.time_ns, loaded.at(i).metadata.time_ns);
+    }
+  }
+
+  string path_;
+  vector<disk_write> log_;
+};
+
+}  // namespace
+
+TEST_F(ProfileLogTest, SaveAndLoad) {
+  ASSERT_TRUE(SaveProfileLog(path_, log_, false));
+  EXPECT_TRUE(IsCompactProfileLog(path_));
+
+  vector<disk_write> loaded;
+  ASSERT_TRUE(LoadProfileLog(path_, loaded));
+  ExpectSameLog(loaded);
+}
+
+TEST_F(ProfileLogTest, CompressedSaveAndLoad) {
+  ASSERT_TRUE(SaveProfileLog(path_, log_, false));
+  const off_t raw_size = FileSize();
+  ASSERT_TRUE(SaveProfileLog(path_, log_, true));
+  // The zeroed bio alone should save most of its 8K.
+  EXPECT_LT(FileSize(), raw_size - 7000);
+
+  vector<disk_write> loaded;
+  ASSERT_TRUE(LoadProfileLog(path_, loaded));
+  ExpectSameLog(loaded);
+}
+
+TEST_F(ProfileLogTest, WriterMatchesSave) {
+  ASSERT_TRUE(SaveProfileLog(path_, log_, true));
+  const off_t saved_size = FileSize();
+
+  // Bios appended as they come in end up in the same file.
+  ProfileLogWriter writer(true);
+  ASSERT_TRUE(writer.Open(path_));
+  for (disk_write &dw : log_) {
+    ASSERT_TRUE(writer.Append(dw));
+  }
+  EXPECT_EQ(log_.size(), writer.GetNumRecords());
+  ASSERT_TRUE(writer.Close());
+  EXPECT_EQ(saved_size, FileSize());
+
+  vector<disk_write> loaded;
+  ASSERT_TRUE(LoadProfileLog(path_, loaded));
+  ExpectSameLog(loaded);
+}
+
+TEST_F(ProfileLogTest, LoadedDataOutlivesVector) {
+  ASSERT_TRUE(SaveProfileLog(path_, log_, false));
+  disk_write kept;
+  {
+    vector<disk_write> loaded;
+    ASSERT_TRUE(LoadProfileLog(path_, loaded));
+    kept = loaded.at(2);
+  }
+  // The file can go away too since the data is in a private mapping.
+  unlink(path_.c_str());
+  EXPECT_EQ(log_.at(2), kept);
+}
+
+TEST_F(ProfileLogTest, DetectsCorruption) {
+  ASSERT_TRUE(SaveProfileLog(path_, log_, false));
+  // Flip a byte in the data of the second bio.
+  const int fd = open(path_.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  char c;
+  const off_t offset = 32 + 48 + 48 + 100;
+  ASSERT_EQ(1, pread(fd, &c, 1, offset));
+  c = ~c;
+  ASSERT_EQ(1, pwrite(fd, &c, 1, offset));
+  close(fd);
+
+  vector<disk_write> loaded;
+  EXPECT_FALSE(LoadProfileLog(path_, loaded));
+}
+
+TEST_F(ProfileLogTest, LoadsLegacyFormat) {
+  {
+    ofstream out(path_, std::ofstream::trunc | ios::binary);
+    for (const disk_write &dw : log_) {
+      disk_write::serialize(out, dw);
+    }
+  }
+  EXPECT_FALSE(IsCompactProfileLog(path_));
+
+  vector<disk_write> loaded;
+  ASSERT_TRUE(LoadProfileLog(path_, loaded));
+  ExpectSameLog(loaded);
+}
+
+}  // namespace test
+}  // namespace fs_testing